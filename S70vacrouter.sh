@@ -8,20 +8,43 @@
 # So /config/overlay/etc/init.d/thisfile.sh would get copied to /etc/init.d
 #
 # 
-# Starts ardith and the vacrouter operating scripts
+# Starts the vacrouter bridge (host/vacrouter-bridge), which replaces the ardith.sh
+# and vacrouter-mqtt.sh pair with one process holding the serial port and MQTT session.
+# Nothing else opens the port then.
+# MODE=scripts starts the pair instead, as does a camera without the bridge built for it.
+# The port then belongs to the vacrouter-serial broker (host/vacrouter-serial), started
+# first: it queues both scripts' commands, pairs the answers and reopens the port when
+# the Mega re-enumerates.  Neither script opens the tty.  vacrouter-mqtt.sh starts
+# ardith.sh itself, and leaves it running across a restart so the arm isn't homed again.
 #
 
+MODE=bridge             # bridge or scripts
+BRIDGE=/sdcard/vacrouter-bridge
+SERIAL_BROKER=/sdcard/vacrouter-serial
+CONSOLE=/dev/ttyACM0
+SCRIPT=/sdcard/vacrouter-mqtt.sh
+PIDFILE=/var/run/vacrouter-mqtt.pid
+
+if [ ! -x $BRIDGE ]; then
+        MODE=scripts
+fi
+
 start() {
-        printf "Starting vacrouter: "
-        start-stop-daemon -S  -b --exec /sdcard/ardith.sh
-        start-stop-daemon -S  -b --exec /sdcard/vacrouter.sh
+        printf "Starting vacrouter ($MODE): "
+        if [ "$MODE" = "scripts" ]; then
+                start-stop-daemon -S -b --exec $SERIAL_BROKER -- --console $CONSOLE --quiet
+                start-stop-daemon -S -b -m -p $PIDFILE --exec $SCRIPT
+        else
+                start-stop-daemon -S  -b --exec $BRIDGE
+        fi
         echo "OK"
 }
 stop() {
         printf "Stopping vacrouter: "
-        #start-stop-daemon -K -q -p $( pidof vacrouter.sh )
-        killall vacrouter.sh
-        killall ardith.sh
+        # Whichever is running, MODE may have changed since it started
+        start-stop-daemon -K -q --exec $BRIDGE
+        start-stop-daemon -K -q -p $PIDFILE && rm -f $PIDFILE
+        start-stop-daemon -K -q --exec $SERIAL_BROKER
         echo "OK"
 }
 restart() {
@@ -2,24 +2,26 @@
 #
 # ardith.sh     a simple bash script to provide a command line interface to an arduino Mega 2560
 #               arduino running code based on this commmand line structure: https://create.arduino.cc/projecthub/mikefarr/simple-command-line-interface-4f0a3f
-#               This script initializes and holds open the serial port and does initial homing.
+#               This script passes the arm's lines on to vacrouter.sh and does initial homing.
 #               Other than homing, all other commands are handled by vacrouter.sh
+#               The port itself belongs to vacrouter-serial (host/vacrouter-serial.cpp), which
+#               S70vacrouter.sh starts first.  Both scripts are its clients.
 #               JAC
 #
 # Version       .1  3/9/2022 - First version
 #               .2 3/15/2022 - Simplified script as we will do all sending from vacrouter.sh now
+#               .3           - Every line goes to the $CHANNEL FIFO instead of overwriting /tmp/lastline.txt
+#               .4           - Writes to $CHANNEL block while it is full, no line is dropped
+#               .5           - Lines come from, and HOME goes through, vacrouter-serial rather than the tty
 #
-# TODO:         -Store last received line in /tmp
 #set -x
 
 # CONFIGURATION
-CONSOLE="/dev/ttyACM0"
+SERIAL_CLIENT=/sdcard/vacrouter-serial  # Port broker, --sub for every line from the arm, --send for a command
 
-# Last line temp file
-TMP_LINE=/tmp/lastline.txt
-
-# Configure the serial port
-stty -F $CONSOLE cs8 115200 ignbrk -brkint -icrnl -imaxbel -opost -onlcr -isig -icanon -iexten -echo -echoe -echok -echoctl -echoke noflsh -ixon -crtscts
+# Serial line channel read by vacrouter.sh.  A FIFO, so every line is delivered in order and the
+# reader sleeps in read until one arrives; the pipe buffer (64k) holds lines while it is busy.
+CHANNEL=/tmp/vacrouter.serial
 
 # Times & Flags
 START_DELAY=0   # Give the Arduino time to become ready after serial connect
@@ -28,17 +30,39 @@ START_FLAG=1    # Indicate first run state
 LOCAL_ECHO=0
 
 ### Functions
+# Pass a line to the reader.  A full pipe blocks the write until the reader catches up, and the
+# arm's lines wait in vacrouter-serial meanwhile (it drops a subscriber 64k behind, and we reconnect).
+Channel.println() {
+    echo "$1" >&3
+}
+
+# Through the broker, queued behind vacrouter.sh's commands rather than interleaved with them
 Serial.println() {
-    echo "$1" > $CONSOLE
+    if ! RESULT=$($SERIAL_CLIENT --send "$1"); then
+        echo "ARDITH: Arduino didn't take $1: ${RESULT##*$'\n'}"
+    fi
     if [ $LOCAL_ECHO = 1 ]; then
     echo "$1"
     fi
 }
 
-# On startup, ensure there are is no output left in /tmp
-echo > $TMP_LINE
+# Create the channel if vacrouter.sh hasn't already.  Opening it read-write never blocks waiting
+# for the other end and keeps the pipe open across reader restarts.
+if [ ! -p $CHANNEL ]; then
+    rm -f $CHANNEL
+    mkfifo $CHANNEL
+fi
+exec 3<>$CHANNEL
 
+# The broker sends the arm's lines as "LINE <text>", with "PORT UP" whenever the port (re)opens and
+# once straight away if it is open.  Reconnect if the broker itself restarts.
+while :; do
 while read -r LINE; do
+    case $LINE in
+        "LINE "*)   LINE=${LINE#LINE } ;;
+        "PORT UP")  LINE="" ;;      # Nothing to pass on, but HOME below if we haven't yet
+        *)          continue ;;     # OK SUB, PORT DOWN, binary frames
+    esac
     # Strip tabs & EOL character
     CLEAN_LINE=${LINE//[$'\t\r\n']}
     LINE="$CLEAN_LINE"
@@ -66,8 +90,14 @@ while read -r LINE; do
      START_FLAG=2
 
    fi
+    if [ -z "$LINE" ]; then
+        continue
+    fi
     # If no other task, print the line
      echo $LINE
-     echo $LINE > $TMP_LINE
+     Channel.println "$LINE"
 
-done < $CONSOLE
+done < <($SERIAL_CLIENT --sub)
+echo "ARDITH: Lost vacrouter-serial, reconnecting"
+sleep $LINE_DELAY
+done
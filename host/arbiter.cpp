@@ -0,0 +1,91 @@
+/*  arbiter.cpp - Tool arbitration for the vacuum, see arbiter.h
+*/
+#include "arbiter.h"
+
+#include <algorithm>
+
+ToolArbiter::ToolArbiter(TimerWheel &timers, uint32_t run_on_ms, const std::string &park,
+                         const std::vector<std::string> &priority)
+    : TIMERS(timers), RUN_ON_MS(run_on_ms), PARK(park), PRIORITY(priority), REFS(0), ON_COUNT(0) {}
+
+bool ToolArbiter::running(const std::string &tool) const {
+    std::map<std::string, Tool>::const_iterator it = TOOLS.find(tool);
+    return (it != TOOLS.end()) && (it->second.STATE == TOOL_ON);
+}
+
+void ToolArbiter::power(const std::string &tool, const std::string &station, bool on, uint64_t now_ms) {
+    Tool &t = TOOLS[tool];
+    t.STATION = station;
+    if (on) {
+        if (t.STATE == TOOL_ON) {
+            return;
+        }
+        if (t.STATE == TOOL_CLEARING) {
+            TIMERS.cancel(t.RUN_ON);        // Still holding its reference
+            t.RUN_ON = 0;
+        } else if (REFS++ == 0) {
+            if (VACUUM_HANDLER) {
+                VACUUM_HANDLER(true);
+            }
+        }
+        t.STATE = TOOL_ON;
+        t.ON_ORDER = ++ON_COUNT;
+    } else {
+        if (t.STATE != TOOL_ON) {
+            return;
+        }
+        t.STATE = TOOL_CLEARING;
+        t.RUN_ON = TIMERS.schedule(now_ms, RUN_ON_MS, [this, tool]() {
+            run_on_done(tool);
+        });
+    }
+    serve();
+}
+
+void ToolArbiter::run_on_done(const std::string &tool) {
+    Tool &t = TOOLS[tool];
+    t.STATE = TOOL_OFF;
+    t.RUN_ON = 0;
+    if (--REFS > 0) {
+        return;
+    }
+    if (VACUUM_HANDLER) {
+        VACUUM_HANDLER(false);
+    }
+    SERVING.clear();
+    if (SERVE_HANDLER) {
+        SERVE_HANDLER(PARK);
+    }
+}
+
+// Station of the running tool the policy puts first, empty if none is running
+std::string ToolArbiter::choose() const {
+    std::string latest;
+    uint32_t order = 0;
+    size_t rank = PRIORITY.size();
+    for (std::map<std::string, Tool>::const_iterator it = TOOLS.begin(); it != TOOLS.end(); ++it) {
+        const Tool &t = it->second;
+        if (t.STATE != TOOL_ON) {
+            continue;
+        }
+        size_t at = std::find(PRIORITY.begin(), PRIORITY.end(), t.STATION) - PRIORITY.begin();
+        if ((at < rank) || ((at == rank) && (t.ON_ORDER > order))) {
+            latest = t.STATION;
+            order = t.ON_ORDER;
+            rank = at;
+        }
+    }
+    return latest;
+}
+
+// Only a running tool moves the arm, while everything is clearing it stays where it is
+void ToolArbiter::serve() {
+    std::string station = choose();
+    if (station.empty() || (station == SERVING)) {
+        return;
+    }
+    SERVING = station;
+    if (SERVE_HANDLER) {
+        SERVE_HANDLER(station);
+    }
+}
@@ -0,0 +1,73 @@
+/*  arbiter.h - Which tool the arm serves, and when the vacuum may go off
+
+                Keeps a table of every tool's POWER state and counts a reference on the vacuum for each
+                tool that is running or still clearing its line.  A tool is a device, served at a
+                station, so two devices on one station each hold their own reference.  The vacuum goes
+                on with the first reference and off only when the last run-on finishes, then the arm
+                parks.  While more than one tool runs the policy picks the station: the first in the
+                priority list with a tool running, or with no list the tool that turned ON last (the old
+                one-event-at-a-time behaviour).  A tool that turns OFF while another still runs hands
+                the arm over at once, its own line clears through the other tool's port for the run-on.
+
+                Repeated events (a QoS 1 redelivery, a Tasmota restart re-reporting ON) change nothing.
+                There is no I/O in here: the owner feeds power() and the timer wheel and acts on the
+                handlers, which is what vacrouter-bridge --replay does with a recorded event log.
+*/
+#ifndef VACROUTER_ARBITER_H
+#define VACROUTER_ARBITER_H
+
+#include "timer_wheel.h"
+
+#include <stdint.h>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+class ToolArbiter {
+  public:
+    typedef std::function<void(bool on)> VacuumHandler;
+    typedef std::function<void(const std::string &station)> ServeHandler;
+
+    // park is the station the arm goes back to when nothing needs it, priority (stations) may be empty
+    ToolArbiter(TimerWheel &timers, uint32_t run_on_ms, const std::string &park,
+                const std::vector<std::string> &priority);
+
+    void on_vacuum(VacuumHandler handler) { VACUUM_HANDLER = handler; }
+    void on_serve(ServeHandler handler) { SERVE_HANDLER = handler; }
+
+    void power(const std::string &tool, const std::string &station, bool on, uint64_t now_ms);
+
+    int refs() const { return REFS; }                       // Tools running or clearing
+    bool running(const std::string &tool) const;
+    const std::string &serving() const { return SERVING; } // Station, empty when parked
+
+  private:
+    enum State { TOOL_OFF, TOOL_ON, TOOL_CLEARING };
+
+    struct Tool {
+        State               STATE;
+        uint32_t            ON_ORDER;       // Larger turned ON more recently
+        TimerWheel::TimerId RUN_ON;         // 0 unless TOOL_CLEARING
+        std::string         STATION;
+
+        Tool() : STATE(TOOL_OFF), ON_ORDER(0), RUN_ON(0) {}
+    };
+
+    void run_on_done(const std::string &tool);
+    std::string choose() const;
+    void serve();
+
+    TimerWheel               &TIMERS;
+    uint32_t                 RUN_ON_MS;
+    std::string              PARK;
+    std::vector<std::string> PRIORITY;
+    std::map<std::string, Tool> TOOLS;
+    int                      REFS;
+    uint32_t                 ON_COUNT;
+    std::string              SERVING;
+    VacuumHandler            VACUUM_HANDLER;
+    ServeHandler             SERVE_HANDLER;
+};
+
+#endif
@@ -0,0 +1,220 @@
+/*  framelink.cpp - Host side of the binary serial protocol, see framelink.h
+*/
+#include "framelink.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// MOVE words in the text CLI and their FRAME_OP_MOVE targets
+static const struct {
+    const char *WORD;
+    uint8_t     TARGET;
+} MOVE_TARGETS[] = {
+    { "STOP",        FRAME_MOVE_STOP },
+    { "RIGHT",       FRAME_MOVE_RIGHT },
+    { "LEFT",        FRAME_MOVE_LEFT },
+    { "GL1",         FRAME_MOVE_GL1 },
+    { "GR1",         FRAME_MOVE_GR1 },
+    { "H1",          FRAME_MOVE_H1 },
+    { "H2",          FRAME_MOVE_H2 },
+    { "H3",          FRAME_MOVE_H3 },
+    { "H4",          FRAME_MOVE_H4 },
+    { "GOWORKBENCH", FRAME_MOVE_WORKBENCH },
+    { "GOCHOPSAW",   FRAME_MOVE_CHOPSAW },
+    { "GOCNC",       FRAME_MOVE_CNC },
+};
+
+bool FrameLink::encode(const std::string &command, uint8_t *op, uint8_t *payload, uint8_t *len) {
+    *len = 0;
+    if (command == "HOME") {
+        *op = FRAME_OP_HOME;
+        return true;
+    }
+    if (command == "STATUS") {
+        *op = FRAME_OP_STATUS;
+        return true;
+    }
+    if (command == "STATS") {
+        *op = FRAME_OP_STATS;   // Answered with the usual text line
+        return true;
+    }
+    if (command.compare(0, 5, "GOTO ") == 0) {
+        // By number only, the station names live in the firmware
+        char *end;
+        long station = strtol(command.c_str() + 5, &end, 10);
+        if ((end != command.c_str() + 5) && (*end == '\0') && (station >= 1) && (station <= 255)) {
+            *op = FRAME_OP_GOTO;
+            payload[0] = (uint8_t)station;
+            *len = 1;
+            return true;
+        }
+        return false;
+    }
+    if (command.compare(0, 5, "MOVE ") == 0) {
+        std::string word = command.substr(5);
+        for (size_t i = 0; i < sizeof(MOVE_TARGETS) / sizeof(MOVE_TARGETS[0]); i++) {
+            if (word == MOVE_TARGETS[i].WORD) {
+                *op = FRAME_OP_MOVE;
+                payload[0] = MOVE_TARGETS[i].TARGET;
+                *len = 1;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+uint8_t FrameLink::next_seq() {
+    do {
+        SEQ++;
+    } while ((SEQ == 0) || IN_FLIGHT.count(SEQ));
+    return SEQ;
+}
+
+bool FrameLink::send(const std::string &command, uint64_t now_ms) {
+    Pending pending;
+    if (!encode(command, &pending.OP, pending.PAYLOAD, &pending.LEN)) {
+        return false;
+    }
+    pending.COMMAND = command;
+    pending.SENT_MS = 0;
+    pending.TRIES = 0;
+    pending.QUEUED = false;
+    WAITING.push_back(pending);
+    fill_window(now_ms);
+    return true;
+}
+
+// Frames wait here rather than in the port for credit, so their ack timeout starts when they go out
+void FrameLink::fill_window(uint64_t now_ms) {
+    while (!WAITING.empty() && (IN_FLIGHT.size() < FRAME_WINDOW) && (PORT.can_send() || is_stop(WAITING.front()))) {
+        uint8_t seq = next_seq();
+        Pending &pending = IN_FLIGHT[seq] = WAITING.front();
+        WAITING.pop_front();
+        ISSUED[seq] = pending.COMMAND;
+        transmit(seq, pending, now_ms);
+    }
+}
+
+// MOVE STOP needs no credit, the firmware keeps room for one
+bool FrameLink::is_stop(const Pending &pending) {
+    return (pending.OP == FRAME_OP_MOVE) && (pending.LEN > 0) && (pending.PAYLOAD[0] == FRAME_MOVE_STOP);
+}
+
+void FrameLink::transmit(uint8_t seq, Pending &pending, uint64_t now_ms) {
+    pending.SENT_MS = now_ms;
+    pending.TRIES++;
+    PORT.write_frame(pending.OP, seq, pending.PAYLOAD, pending.LEN);
+}
+
+void FrameLink::on_frame(const FRAME &frame, uint64_t now_ms) {
+    switch (frame.OP) {
+        case FRAME_OP_ACK: {
+            std::map<uint8_t, Pending>::iterator it = IN_FLIGHT.find(frame.SEQ);
+            if ((frame.LEN < 2) || (it == IN_FLIGHT.end()) || (frame.PAYLOAD[0] != it->second.OP)) {
+                return;     // Repeat ack for a command we already finished with
+            }
+            Pending &pending = it->second;
+            switch (frame.PAYLOAD[1]) {
+                case FRAME_ACK_QUEUED:
+                    pending.QUEUED = true;
+                    return;
+                case FRAME_ACK_CRC:
+                    transmit(frame.SEQ, pending, now_ms);
+                    return;
+                case FRAME_ACK_BUSY:
+                    pending.SENT_MS = now_ms;   // Try again after the ack timeout, without using up a try
+                    pending.TRIES--;
+                    return;
+                default:
+                    break;
+            }
+            std::string command = pending.COMMAND;
+            IN_FLIGHT.erase(it);
+            if (ACK_HANDLER) {
+                ACK_HANDLER(command, frame.PAYLOAD[1]);
+            }
+            fill_window(now_ms);
+            return;
+        }
+
+        case FRAME_OP_POS:
+            if ((frame.LEN >= 2) && POSITION_HANDLER) {
+                std::map<uint8_t, std::string>::iterator it = ISSUED.find(frame.SEQ);
+                POSITION_HANDLER((it != ISSUED.end()) ? it->second : std::string(), (int8_t)frame.PAYLOAD[0],
+                                 (int8_t)frame.PAYLOAD[1]);
+            }
+            return;
+
+        case FRAME_OP_EVENT:
+            if ((frame.LEN >= EVENT_PAYLOAD) && EVENT_HANDLER) {
+                EVENT_HANDLER((uint16_t)(frame.PAYLOAD[1] | (frame.PAYLOAD[2] << 8)), frame.PAYLOAD[0],
+                              (int16_t)(frame.PAYLOAD[3] | (frame.PAYLOAD[4] << 8)));
+            }
+            return;
+
+        case FRAME_OP_STATUS_REPLY:
+            if ((frame.LEN >= 5) && STATUS_HANDLER) {
+                STATUS_HANDLER((int8_t)frame.PAYLOAD[0], (int8_t)frame.PAYLOAD[1], (int8_t)frame.PAYLOAD[2],
+                               (int8_t)frame.PAYLOAD[3], (int8_t)frame.PAYLOAD[4]);
+            }
+            return;
+
+        default:
+            return;
+    }
+}
+
+void FrameLink::tick(uint64_t now_ms) {
+    std::map<uint8_t, Pending>::iterator it = IN_FLIGHT.begin();
+    while (it != IN_FLIGHT.end()) {
+        Pending &pending = it->second;
+        if (pending.QUEUED || (now_ms - pending.SENT_MS < LINK_ACK_TIMEOUT_MS)) {
+            ++it;
+            continue;
+        }
+        if (pending.TRIES < LINK_MAX_TRIES) {
+            transmit(it->first, pending, now_ms);
+            ++it;
+            continue;
+        }
+        std::string command = pending.COMMAND;
+        IN_FLIGHT.erase(it++);
+        if (ACK_HANDLER) {
+            ACK_HANDLER(command, LINK_NO_ACK);
+        }
+    }
+    fill_window(now_ms);
+}
+
+int FrameLink::next_timeout_ms(uint64_t now_ms) const {
+    int timeout = -1;
+    for (std::map<uint8_t, Pending>::const_iterator it = IN_FLIGHT.begin(); it != IN_FLIGHT.end(); ++it) {
+        if (it->second.QUEUED) {
+            continue;
+        }
+        uint64_t due = it->second.SENT_MS + LINK_ACK_TIMEOUT_MS;
+        int wait = (due <= now_ms) ? 0 : (int)(due - now_ms);
+        if ((timeout < 0) || (wait < timeout)) {
+            timeout = wait;
+        }
+    }
+    return timeout;
+}
+
+void FrameLink::reset() {
+    // A reopened port resets the Mega, so nothing queued for the old session should move the arm now
+    std::deque<std::string> dropped;
+    for (std::map<uint8_t, Pending>::iterator it = IN_FLIGHT.begin(); it != IN_FLIGHT.end(); ++it) {
+        dropped.push_back(it->second.COMMAND);
+    }
+    for (size_t i = 0; i < WAITING.size(); i++) {
+        dropped.push_back(WAITING[i].COMMAND);
+    }
+    IN_FLIGHT.clear();
+    WAITING.clear();
+    ISSUED.clear();
+    for (size_t i = 0; ACK_HANDLER && (i < dropped.size()); i++) {
+        ACK_HANDLER(dropped[i], LINK_NO_ACK);
+    }
+}
@@ -0,0 +1,84 @@
+/*  framelink.h - Host side of the binary serial protocol (src/frame.h)
+
+                Takes the same text commands the bridge would send ("HOME", "MOVE GOCNC", "STATUS"),
+                sends them as frames numbered with a sequence ID, and keeps each one until the
+                firmware acks it.  A frame is resent if its ack doesn't arrive, if it was corrupted on
+                the way (FRAME_ACK_CRC) or if the firmware's queue was full (FRAME_ACK_BUSY).  At most
+                FRAME_WINDOW commands are in flight, fewer while the port is short of credit (see
+                serial.h), later ones wait here in order.  Acks, position
+                reports and status replies are handed back matched to the command that caused them, events
+                (src/event.h) are handed on as they come.
+*/
+#ifndef VACROUTER_FRAMELINK_H
+#define VACROUTER_FRAMELINK_H
+
+#include "serial.h"
+#include "../src/event.h"
+
+#include <stdint.h>
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+
+#define LINK_ACK_TIMEOUT_MS  500     // Resend a frame not acked in this long
+#define LINK_MAX_TRIES       4       // Give up on a command after this many sends
+#define LINK_NO_ACK          0xFF    // Result passed to the ack handler when we gave up
+
+class FrameLink {
+  public:
+    // Final result of a command, FRAME_ACK_OK, _ERROR, _INVALID or LINK_NO_ACK
+    typedef std::function<void(const std::string &command, uint8_t result)> AckHandler;
+    typedef std::function<void(const std::string &command, int ppos, int cpos)> PositionHandler;
+    typedef std::function<void(int homing, int step, int motion, int ppos, int cpos)> StatusHandler;
+    typedef std::function<void(uint16_t seq, uint8_t id, int arg)> EventHandler;
+
+    explicit FrameLink(SerialPort &port) : PORT(port), SEQ(0) {}
+
+    void on_ack(AckHandler handler) { ACK_HANDLER = handler; }
+    void on_position(PositionHandler handler) { POSITION_HANDLER = handler; }
+    void on_status(StatusHandler handler) { STATUS_HANDLER = handler; }
+    void on_event(EventHandler handler) { EVENT_HANDLER = handler; }
+
+    // Frame op and payload for a text command.  False if it has no binary form.
+    static bool encode(const std::string &command, uint8_t *op, uint8_t *payload, uint8_t *len);
+
+    // Send a text command as a frame, false if it has no binary form
+    bool send(const std::string &command, uint64_t now_ms);
+
+    void on_frame(const FRAME &frame, uint64_t now_ms);
+    void tick(uint64_t now_ms);
+    int  next_timeout_ms(uint64_t now_ms) const;
+
+    // The port was reopened, drop everything in flight or waiting (each gets LINK_NO_ACK)
+    void reset();
+
+  private:
+    struct Pending {
+        std::string COMMAND;
+        uint8_t     OP;
+        uint8_t     PAYLOAD[FRAME_MAX_PAYLOAD];
+        uint8_t     LEN;
+        uint64_t    SENT_MS;
+        int         TRIES;
+        bool        QUEUED;     // Acked FRAME_ACK_QUEUED, waiting for the ack with its result
+    };
+
+    void transmit(uint8_t seq, Pending &pending, uint64_t now_ms);
+    void fill_window(uint64_t now_ms);
+    static bool is_stop(const Pending &pending);
+    uint8_t next_seq();
+
+    SerialPort                &PORT;
+    uint8_t                    SEQ;
+    std::map<uint8_t, Pending> IN_FLIGHT;
+    std::deque<Pending>        WAITING;     // Beyond the window, sent as acks free it up
+    std::map<uint8_t, std::string> ISSUED;  // Command behind each SEQ, for position reports after the ack
+
+    AckHandler      ACK_HANDLER;
+    PositionHandler POSITION_HANDLER;
+    StatusHandler   STATUS_HANDLER;
+    EventHandler    EVENT_HANDLER;
+};
+
+#endif
@@ -0,0 +1,421 @@
+/*  mqtt.cpp - Minimal non-blocking MQTT 3.1.1 client, see mqtt.h
+*/
+#include "mqtt.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+// Control packet types (high nibble of the fixed header)
+#define MQTT_CONNECT     0x10
+#define MQTT_CONNACK     0x20
+#define MQTT_PUBLISH     0x30
+#define MQTT_PUBACK      0x40
+#define MQTT_SUBSCRIBE   0x82   // Reserved flag bits 0010 are mandatory
+#define MQTT_SUBACK      0x90
+#define MQTT_PINGREQ     0xC0
+#define MQTT_PINGRESP    0xD0
+#define MQTT_DISCONNECT  0xE0
+
+static void put_u16(std::string &s, uint16_t v) {
+    s += (char)(v >> 8);
+    s += (char)(v & 0xFF);
+}
+
+static void put_str(std::string &s, const std::string &v) {
+    put_u16(s, (uint16_t)v.size());
+    s += v;
+}
+
+static uint16_t get_u16(const std::string &s, size_t at) {
+    return (uint16_t)(((uint8_t)s[at] << 8) | (uint8_t)s[at + 1]);
+}
+
+MqttClient::MqttClient(const Options &opts)
+    : OPTS(opts), ADDR_LEN(0), FD(-1), STATE(STATE_IDLE), PACKET_ID(0), LAST_SENT_MS(0), LAST_RECV_MS(0),
+      NOW_MS(0), PING_OUTSTANDING(false), DROPPED(0), DROPPED_REPORTED(0) {
+    memset(&ADDR, 0, sizeof(ADDR));
+}
+
+MqttClient::~MqttClient() {
+    disconnect();
+}
+
+uint16_t MqttClient::next_id() {
+    do {
+        PACKET_ID++;
+    } while ((PACKET_ID == 0) || INFLIGHT.count(PACKET_ID));
+    return PACKET_ID;
+}
+
+// getaddrinfo() blocks on DNS, so it only runs until it has worked once.  An IP address is taken as is.
+bool MqttClient::resolve() {
+    struct addrinfo hints;
+    struct addrinfo *res = 0;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST;
+    char port[8];
+    snprintf(port, sizeof(port), "%d", OPTS.PORT);
+    if ((getaddrinfo(OPTS.HOST.c_str(), port, &hints, &res) != 0) || !res) {
+        hints.ai_flags = 0;
+        if ((getaddrinfo(OPTS.HOST.c_str(), port, &hints, &res) != 0) || !res) {
+            return false;
+        }
+    }
+    memcpy(&ADDR, res->ai_addr, res->ai_addrlen);
+    ADDR_LEN = res->ai_addrlen;
+    freeaddrinfo(res);
+    return true;
+}
+
+bool MqttClient::connect() {
+    disconnect();
+
+    if ((ADDR_LEN == 0) && !resolve()) {
+        return fail("cannot resolve broker");
+    }
+    FD = socket(ADDR.ss_family, SOCK_STREAM, 0);
+    if (FD < 0) {
+        return fail("socket");
+    }
+    fcntl(FD, F_SETFL, fcntl(FD, F_GETFL) | O_NONBLOCK);
+    int one = 1;
+    setsockopt(FD, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));   // Commands are tiny, don't let Nagle hold them
+    int rc = ::connect(FD, (const struct sockaddr *)&ADDR, ADDR_LEN);
+    if ((rc != 0) && (errno != EINPROGRESS)) {
+        return fail("connect");
+    }
+    STATE = STATE_TCP_CONNECTING;
+    IN.clear();
+    OUT.clear();
+    if (rc == 0) {
+        send_connect();
+    }
+    return true;
+}
+
+void MqttClient::disconnect() {
+    if (FD >= 0) {
+        if (STATE == STATE_CONNECTED) {
+            // Whatever is still queued, best effort, then a clean DISCONNECT (the broker discards the will)
+            OUT += (char)MQTT_DISCONNECT;
+            OUT += (char)0;
+            ssize_t n = write(FD, OUT.data(), OUT.size());
+            (void)n;
+        }
+        OUT.clear();
+        close(FD);
+    }
+    FD = -1;
+    STATE = STATE_IDLE;
+}
+
+bool MqttClient::fail(const char *why) {
+    fprintf(stderr, "mqtt: %s: %s\n", why, errno ? strerror(errno) : "protocol error");
+    if (FD >= 0) {
+        close(FD);
+    }
+    FD = -1;
+    STATE = STATE_IDLE;
+    return false;
+}
+
+void MqttClient::send_packet(uint8_t header, const std::string &body) {
+    std::string pkt;
+    pkt += (char)header;
+    size_t len = body.size();
+    do {
+        uint8_t b = len % 128;
+        len /= 128;
+        if (len > 0) {
+            b |= 0x80;
+        }
+        pkt += (char)b;
+    } while (len > 0);
+    pkt += body;
+    OUT += pkt;
+    LAST_SENT_MS = NOW_MS;
+    if (STATE != STATE_TCP_CONNECTING) {
+        on_writable();
+    }
+}
+
+void MqttClient::send_connect() {
+    std::string body;
+    put_str(body, "MQTT");
+    body += (char)4;    // Protocol level 3.1.1
+    uint8_t flags = 0;
+    if (OPTS.CLEAN_SESSION) {
+        flags |= 0x02;
+    }
+    if (!OPTS.WILL_TOPIC.empty()) {
+        flags |= 0x04 | ((OPTS.WILL_QOS & 3) << 3) | (OPTS.WILL_RETAIN ? 0x20 : 0);
+    }
+    body += (char)flags;
+    put_u16(body, (uint16_t)OPTS.KEEPALIVE);
+    put_str(body, OPTS.CLIENT_ID);
+    if (!OPTS.WILL_TOPIC.empty()) {
+        put_str(body, OPTS.WILL_TOPIC);
+        put_str(body, OPTS.WILL_PAYLOAD);
+    }
+    STATE = STATE_MQTT_CONNECTING;
+    send_packet(MQTT_CONNECT, body);
+}
+
+void MqttClient::send_publish(uint16_t id, const Pending &msg, int qos, bool dup) {
+    std::string body;
+    put_str(body, msg.TOPIC);
+    if (qos > 0) {
+        put_u16(body, id);
+    }
+    body += msg.PAYLOAD;
+    uint8_t header = MQTT_PUBLISH | (dup ? 0x08 : 0) | ((qos & 3) << 1) | (msg.RETAIN ? 0x01 : 0);
+    send_packet(header, body);
+}
+
+void MqttClient::subscribe(const std::string &topic, int qos) {
+    SUBS.push_back(std::make_pair(topic, qos));
+    if (STATE == STATE_CONNECTED) {
+        std::string body;
+        put_u16(body, next_id());
+        put_str(body, topic);
+        body += (char)qos;
+        send_packet(MQTT_SUBSCRIBE, body);
+    }
+}
+
+void MqttClient::publish(const std::string &topic, const std::string &payload, int qos, bool retain) {
+    Pending msg;
+    msg.TOPIC = topic;
+    msg.PAYLOAD = payload;
+    msg.RETAIN = retain;
+    if (qos > 0) {
+        // Held until PUBACK, and sent on the next connect if we're offline now.  Ids count up through
+        // all 65535 before one comes round again, so a late PUBACK for one dropped here can't ack another.
+        if (retain) {
+            for (std::map<uint16_t, Pending>::iterator it = INFLIGHT.begin(); it != INFLIGHT.end();) {
+                if (it->second.RETAIN && (it->second.TOPIC == topic)) {
+                    INFLIGHT.erase(it++);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        if (INFLIGHT.size() >= MQTT_MAX_INFLIGHT) {
+            // Oldest first: ids above the last one given out are from before it wrapped
+            std::map<uint16_t, Pending>::iterator oldest = INFLIGHT.upper_bound(PACKET_ID);
+            if (oldest == INFLIGHT.end()) {
+                oldest = INFLIGHT.begin();
+            }
+            if (DROPPED == DROPPED_REPORTED) {
+                fprintf(stderr, "mqtt: %zu messages waiting for the broker, dropping the oldest\n", INFLIGHT.size());
+            }
+            INFLIGHT.erase(oldest);
+            DROPPED++;
+        }
+        uint16_t id = next_id();
+        INFLIGHT[id] = msg;
+        if (STATE == STATE_CONNECTED) {
+            send_publish(id, msg, 1, false);
+        }
+    } else if (STATE == STATE_CONNECTED) {
+        send_publish(0, msg, 0, false);
+    }
+}
+
+bool MqttClient::on_writable() {
+    if (FD < 0) {
+        return false;
+    }
+    if (STATE == STATE_TCP_CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(FD, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0) {
+            errno = err;
+            return fail("connect");
+        }
+        send_connect();
+        return true;
+    }
+    while (!OUT.empty()) {
+        ssize_t n = write(FD, OUT.data(), OUT.size());
+        if (n < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                return true;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return fail("write");
+        }
+        OUT.erase(0, n);
+    }
+    return true;
+}
+
+bool MqttClient::on_readable() {
+    if (FD < 0) {
+        return false;
+    }
+    char buf[1024];
+    for (;;) {
+        ssize_t n = read(FD, buf, sizeof(buf));
+        if (n == 0) {
+            errno = 0;
+            return fail("broker closed the connection");
+        }
+        if (n < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return fail("read");
+        }
+        IN.append(buf, n);
+    }
+    LAST_RECV_MS = NOW_MS;
+
+    // Parse every complete packet in the buffer
+    for (;;) {
+        if (IN.size() < 2) {
+            break;
+        }
+        size_t len = 0;
+        size_t mult = 1;
+        size_t at = 1;
+        bool complete = false;
+        while (at < IN.size() && at <= 4) {
+            uint8_t b = IN[at++];
+            len += (b & 0x7F) * mult;
+            mult *= 128;
+            if (!(b & 0x80)) {
+                complete = true;
+                break;
+            }
+        }
+        if (!complete) {
+            if (at > 4) {
+                errno = 0;
+                return fail("malformed remaining length");
+            }
+            break;
+        }
+        if (IN.size() < at + len) {
+            break;
+        }
+        uint8_t header = IN[0];
+        std::string body = IN.substr(at, len);
+        IN.erase(0, at + len);
+        if (!handle_packet(header, body)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MqttClient::handle_packet(uint8_t header, const std::string &body) {
+    switch (header & 0xF0) {
+        case MQTT_CONNACK: {
+            if ((body.size() < 2) || (body[1] != 0)) {
+                errno = 0;
+                return fail("connection refused by broker");
+            }
+            bool session_present = body[0] & 0x01;
+            STATE = STATE_CONNECTED;
+            PING_OUTSTANDING = false;
+            if (DROPPED != DROPPED_REPORTED) {
+                fprintf(stderr, "mqtt: %lu messages dropped while away\n", DROPPED - DROPPED_REPORTED);
+                DROPPED_REPORTED = DROPPED;
+            }
+            // Re-subscribe even with a persistent session, the broker may have lost it
+            for (size_t i = 0; i < SUBS.size(); i++) {
+                std::string sub;
+                put_u16(sub, next_id());
+                put_str(sub, SUBS[i].first);
+                sub += (char)SUBS[i].second;
+                send_packet(MQTT_SUBSCRIBE, sub);
+            }
+            for (std::map<uint16_t, Pending>::iterator it = INFLIGHT.begin(); it != INFLIGHT.end(); ++it) {
+                send_publish(it->first, it->second, 1, true);
+            }
+            if (CONNECT_HANDLER) {
+                CONNECT_HANDLER(session_present);
+            }
+            return true;
+        }
+
+        case MQTT_PUBLISH: {
+            int qos = (header >> 1) & 3;
+            if (body.size() < 2) {
+                return true;
+            }
+            size_t tlen = get_u16(body, 0);
+            size_t at = 2 + tlen;
+            if (body.size() < at + ((qos > 0) ? 2 : 0)) {
+                return true;
+            }
+            std::string topic = body.substr(2, tlen);
+            if (qos > 0) {
+                uint16_t id = get_u16(body, at);
+                at += 2;
+                std::string ack;
+                put_u16(ack, id);
+                send_packet(MQTT_PUBACK, ack);   // QoS 2 is never granted, we subscribe at 1
+            }
+            if (MESSAGE_HANDLER) {
+                MESSAGE_HANDLER(topic, body.substr(at), header & 0x01);
+            }
+            return true;
+        }
+
+        case MQTT_PUBACK:
+            if (body.size() >= 2) {
+                INFLIGHT.erase(get_u16(body, 0));
+            }
+            return true;
+
+        case MQTT_PINGRESP:
+            PING_OUTSTANDING = false;
+            return true;
+
+        default:    // SUBACK and anything else we don't act on
+            return true;
+    }
+}
+
+bool MqttClient::tick(uint64_t now_ms) {
+    NOW_MS = now_ms;
+    if ((STATE != STATE_CONNECTED) || (OPTS.KEEPALIVE <= 0)) {
+        return true;
+    }
+    uint64_t keepalive_ms = (uint64_t)OPTS.KEEPALIVE * 1000;
+    if (PING_OUTSTANDING && (now_ms - LAST_RECV_MS >= keepalive_ms)) {
+        return fail("keepalive timeout");
+    }
+    if (!PING_OUTSTANDING && (now_ms - LAST_SENT_MS >= keepalive_ms / 2)) {
+        PING_OUTSTANDING = true;
+        LAST_RECV_MS = now_ms;
+        send_packet(MQTT_PINGREQ, std::string());
+    }
+    return true;
+}
+
+int MqttClient::next_timeout_ms(uint64_t now_ms) const {
+    if ((STATE != STATE_CONNECTED) || (OPTS.KEEPALIVE <= 0)) {
+        return -1;
+    }
+    uint64_t keepalive_ms = (uint64_t)OPTS.KEEPALIVE * 1000;
+    uint64_t due = PING_OUTSTANDING ? (LAST_RECV_MS + keepalive_ms) : (LAST_SENT_MS + keepalive_ms / 2);
+    return (due <= now_ms) ? 0 : (int)(due - now_ms);
+}
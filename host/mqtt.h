@@ -0,0 +1,117 @@
+/*  mqtt.h - Minimal non-blocking MQTT 3.1.1 client for the vacrouter host daemons
+
+                Just enough of the protocol for one long-lived session with the shop broker:
+                CONNECT (persistent session, optional last will), SUBSCRIBE, PUBLISH at QoS 0/1
+                with retransmission of unacknowledged QoS 1 messages after a reconnect, and
+                keepalive pings.  No threads and no library dependencies (the Openmiko image has
+                neither to spare): the owner polls fd() in its own event loop and calls
+                on_readable()/on_writable()/tick().
+
+                QoS 1 messages wait for their PUBACK, across reconnects, but no more than
+                MQTT_MAX_INFLIGHT of them: past that the oldest is dropped, so a broker that is away
+                for hours can't run the camera out of memory.  A retained message replaces any still
+                waiting for the same topic, the broker would only keep the last one anyway.  The
+                broker's address is looked up once, on the first connect that resolves it, so a
+                reconnect never waits on DNS in the owner's loop.  An IP address never does.
+*/
+#ifndef VACROUTER_MQTT_H
+#define VACROUTER_MQTT_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#define MQTT_MAX_INFLIGHT   100     // QoS 1 messages kept for a PUBACK, the oldest goes first
+
+class MqttClient {
+  public:
+    struct Options {
+        std::string HOST;
+        int         PORT;
+        std::string CLIENT_ID;
+        int         KEEPALIVE;          // Seconds
+        bool        CLEAN_SESSION;
+        std::string WILL_TOPIC;         // Empty for no last will
+        std::string WILL_PAYLOAD;
+        int         WILL_QOS;
+        bool        WILL_RETAIN;
+
+        Options() : PORT(1883), KEEPALIVE(30), CLEAN_SESSION(false), WILL_QOS(0), WILL_RETAIN(false) {}
+    };
+
+    typedef std::function<void(const std::string &topic, const std::string &payload, bool retained)> MessageHandler;
+    typedef std::function<void(bool session_present)> ConnectHandler;
+
+    explicit MqttClient(const Options &opts);
+    ~MqttClient();
+
+    void on_message(MessageHandler handler) { MESSAGE_HANDLER = handler; }
+    void on_connect(ConnectHandler handler) { CONNECT_HANDLER = handler; }
+
+    // Start a non-blocking connect.  Returns false if it failed immediately.
+    bool connect();
+    void disconnect();
+
+    int  fd() const { return FD; }
+    bool connected() const { return STATE == STATE_CONNECTED; }
+    bool idle() const { return STATE == STATE_IDLE; }
+    bool wants_write() const { return (STATE == STATE_TCP_CONNECTING) || !OUT.empty(); }
+
+    // Event loop hooks, all return false when the connection was lost (fd() is then -1)
+    bool on_readable();
+    bool on_writable();
+    bool tick(uint64_t now_ms);
+
+    // Milliseconds until tick() next has work to do
+    int next_timeout_ms(uint64_t now_ms) const;
+
+    void subscribe(const std::string &topic, int qos);
+    void publish(const std::string &topic, const std::string &payload, int qos, bool retain);
+
+    // QoS 1 messages waiting for a PUBACK, and those dropped for MQTT_MAX_INFLIGHT
+    size_t inflight() const { return INFLIGHT.size(); }
+    unsigned long dropped() const { return DROPPED; }
+
+  private:
+    enum { STATE_IDLE, STATE_TCP_CONNECTING, STATE_MQTT_CONNECTING, STATE_CONNECTED };
+
+    struct Pending {
+        std::string TOPIC;
+        std::string PAYLOAD;
+        bool        RETAIN;
+    };
+
+    void send_packet(uint8_t header, const std::string &body);
+    void send_connect();
+    void send_publish(uint16_t id, const Pending &msg, int qos, bool dup);
+    bool handle_packet(uint8_t header, const std::string &body);
+    bool fail(const char *why);
+    bool resolve();
+    uint16_t next_id();
+
+    Options        OPTS;
+    struct sockaddr_storage ADDR;                       // Broker, once resolved
+    socklen_t      ADDR_LEN;                            // 0 until then
+    int            FD;
+    int            STATE;
+    std::string    IN;
+    std::string    OUT;
+    uint16_t       PACKET_ID;
+    uint64_t       LAST_SENT_MS;
+    uint64_t       LAST_RECV_MS;
+    uint64_t       NOW_MS;
+    bool           PING_OUTSTANDING;
+    unsigned long  DROPPED;
+    unsigned long  DROPPED_REPORTED;                    // Logged once per outage, counted on reconnect
+
+    std::map<uint16_t, Pending> INFLIGHT;               // QoS 1 publishes awaiting PUBACK
+    std::vector<std::pair<std::string, int> > SUBS;     // Re-sent on every connect
+
+    MessageHandler MESSAGE_HANDLER;
+    ConnectHandler CONNECT_HANDLER;
+};
+
+#endif
@@ -0,0 +1,140 @@
+/*  registry.cpp - Tasmota device registry, see registry.h
+*/
+#include "registry.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+// String value of "key" in a flat JSON object, empty if it's missing or not a string
+static std::string json_string(const std::string &json, const std::string &key) {
+    size_t at = json.find("\"" + key + "\"");
+    if (at == std::string::npos) {
+        return std::string();
+    }
+    at = json.find_first_not_of(" \t\r\n", at + key.size() + 2);
+    if ((at == std::string::npos) || (json[at] != ':')) {
+        return std::string();
+    }
+    at = json.find_first_not_of(" \t\r\n", at + 1);
+    if ((at == std::string::npos) || (json[at] != '"')) {
+        return std::string();
+    }
+    std::string value;
+    for (at++; (at < json.size()) && (json[at] != '"'); at++) {
+        if ((json[at] == '\\') && ((at + 1) < json.size())) {
+            at++;
+        }
+        value += json[at];
+    }
+    return value;
+}
+
+// Fields are whitespace separated, so none may be empty or contain any
+static std::string field(const std::string &s) {
+    return s.empty() ? std::string("-") : s;
+}
+
+DeviceRegistry::DeviceRegistry(const std::vector<std::string> &stations) : STATIONS(stations) {
+    seed();
+}
+
+void DeviceRegistry::seed() {
+    DEVICES.clear();
+    for (size_t i = 0; i < STATIONS.size(); i++) {
+        Device &d = DEVICES[STATIONS[i]];
+        d.TOPIC = STATIONS[i];
+        d.STATION = STATIONS[i];
+    }
+}
+
+bool DeviceRegistry::load(const std::string &path) {
+    std::ifstream in(path.c_str());
+    if (!in) {
+        struct stat st;
+        seed();
+        return (stat(path.c_str(), &st) != 0) && (errno == ENOENT);
+    }
+    DEVICES.clear();
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        Device d;
+        if (!(fields >> d.TOPIC) || (d.TOPIC[0] == '#')) {
+            continue;
+        }
+        fields >> d.STATION >> d.MAC;
+        std::getline(fields >> std::ws, d.NAME);
+        d.STATION = (d.STATION == "-") ? std::string() : d.STATION;
+        d.MAC = (d.MAC == "-") ? std::string() : d.MAC;
+        d.NAME = (d.NAME == "-") ? std::string() : d.NAME;
+        DEVICES[d.TOPIC] = d;
+    }
+    if (in.bad()) {
+        seed();     // Opened but unreadable, e.g. a directory
+        return false;
+    }
+    return true;
+}
+
+bool DeviceRegistry::save(const std::string &path) const {
+    std::string tmp = path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "w");
+    if (!f) {
+        return false;
+    }
+    fprintf(f, "# Vacuum router devices, from Tasmota discovery.  Set a station, or - for none, and restart.\n");
+    fprintf(f, "# topic\tstation\tmac\tname\n");
+    for (std::map<std::string, Device>::const_iterator it = DEVICES.begin(); it != DEVICES.end(); ++it) {
+        const Device &d = it->second;
+        fprintf(f, "%s\t%s\t%s\t%s\n", d.TOPIC.c_str(), field(d.STATION).c_str(), field(d.MAC).c_str(),
+                field(d.NAME).c_str());
+    }
+    // A power cut leaves either the old file or the new one, never half of one
+    bool ok = (fflush(f) == 0) && (fsync(fileno(f)) == 0);
+    ok = (fclose(f) == 0) && ok;
+    return ok && (rename(tmp.c_str(), path.c_str()) == 0);
+}
+
+bool DeviceRegistry::discovered(const std::string &mac, const std::string &payload) {
+    std::string topic = json_string(payload, "t");
+    std::string name = json_string(payload, "dn");
+    if (mac.empty() || topic.empty() || (topic.find_first_of(" \t/+#") != std::string::npos)) {
+        return false;   // Empty payload (device removed) or nothing we could route on
+    }
+    Device d;
+    d.TOPIC = topic;
+    d.MAC = mac;
+    d.NAME = name;
+    // Same device under a new topic keeps its station
+    for (std::map<std::string, Device>::iterator it = DEVICES.begin(); it != DEVICES.end(); ++it) {
+        if (it->second.MAC == mac) {
+            d.STATION = it->second.STATION;
+            if ((it->first == topic) && (it->second.NAME == name)) {
+                return false;
+            }
+            DEVICES.erase(it);
+            break;
+        }
+    }
+    std::map<std::string, Device>::iterator known = DEVICES.find(topic);
+    if (known != DEVICES.end()) {
+        if (d.STATION.empty()) {
+            d.STATION = known->second.STATION;  // Filled in by hand, or seeded, before it was discovered
+        }
+    } else if (d.STATION.empty() && (std::find(STATIONS.begin(), STATIONS.end(), topic) != STATIONS.end())) {
+        d.STATION = topic;
+    }
+    DEVICES[topic] = d;
+    return true;
+}
+
+std::string DeviceRegistry::station(const std::string &topic) const {
+    std::map<std::string, Device>::const_iterator it = DEVICES.find(topic);
+    return (it != DEVICES.end()) ? it->second.STATION : std::string();
+}
@@ -0,0 +1,52 @@
+/*  registry.h - Which Tasmota device is at which station, kept on disk
+
+                Built from Tasmota discovery (tasmota/discovery/<mac>/config, retained by the broker) so a
+                plug renamed or swapped for another shows up without editing the bridge.  Each device is
+                known by its MAC, and has the topic it reports on (stat/<topic>/POWER) and the station the
+                arm serves it at.  A new device whose topic is a station name gets that station, any
+                other gets none until one is set in the file, which is plain text for that:
+
+                  # topic       station     mac             name
+                  cnc           cnc         A4CF12C3D2E1    CNC router
+
+                Loaded whole at start, so routing is a map lookup from the first event.  Saved, by a
+                write to a temporary file and a rename, only when discovery changed something.
+*/
+#ifndef VACROUTER_REGISTRY_H
+#define VACROUTER_REGISTRY_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+class DeviceRegistry {
+  public:
+    struct Device {
+        std::string TOPIC;
+        std::string STATION;    // Empty for a device that doesn't move the arm, e.g. the vacuum
+        std::string MAC;        // Empty for an entry from the file not yet seen in discovery
+        std::string NAME;
+    };
+
+    // stations are the names a newly found topic may match
+    explicit DeviceRegistry(const std::vector<std::string> &stations);
+
+    // False if the file exists but couldn't be read.  A missing file leaves one device per station.
+    bool load(const std::string &path);
+    bool save(const std::string &path) const;
+
+    // A tasmota/discovery/<mac>/config payload.  True if the table changed and should be saved.
+    bool discovered(const std::string &mac, const std::string &payload);
+
+    // Station for stat/<topic>/..., empty if none
+    std::string station(const std::string &topic) const;
+    size_t size() const { return DEVICES.size(); }
+
+  private:
+    void seed();
+
+    std::vector<std::string>      STATIONS;
+    std::map<std::string, Device> DEVICES;     // By topic
+};
+
+#endif
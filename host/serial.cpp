@@ -0,0 +1,227 @@
+/*  serial.cpp - Arduino serial port for the vacrouter host daemons, see serial.h
+*/
+#include "serial.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+static uint64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+bool SerialPort::open_port(const std::string &path, bool hupcl) {
+    close_port();
+    FD = open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (FD < 0) {
+        return false;
+    }
+    // stty cs8 115200 ignbrk -brkint -icrnl -imaxbel -opost -onlcr -isig -icanon -iexten -echo ... -ixon -crtscts
+    struct termios tio;
+    if (tcgetattr(FD, &tio) == 0) {
+        cfmakeraw(&tio);
+        tio.c_iflag |= IGNBRK;
+        tio.c_iflag &= ~(IXON | IXOFF | IXANY);
+        tio.c_cflag |= CLOCAL | CREAD | CS8;
+        tio.c_cflag &= ~(CRTSCTS | PARENB | CSTOPB);
+        if (!hupcl) {
+            tio.c_cflag &= ~HUPCL;
+        }
+        tio.c_cc[VMIN] = 1;
+        tio.c_cc[VTIME] = 0;
+        cfsetispeed(&tio, B115200);
+        cfsetospeed(&tio, B115200);
+        tcsetattr(FD, TCSANOW, &tio);
+    }
+    PARTIAL.clear();
+    OUT.clear();
+    frame_rx_reset(&RX);
+    CREDIT_STATE = CREDIT_OFF;
+    UNTAKEN.clear();
+    HELD.clear();
+    return true;
+}
+
+void SerialPort::close_port() {
+    if (FD >= 0) {
+        close(FD);
+    }
+    FD = -1;
+}
+
+bool SerialPort::read_lines(std::vector<std::string> &lines, std::vector<FRAME> *frames) {
+    if (FD < 0) {
+        return false;
+    }
+    char buf[256];
+    for (;;) {
+        ssize_t n = read(FD, buf, sizeof(buf));
+        if (n == 0) {
+            close_port();   // Hangup, the USB device went away
+            return false;
+        }
+        if (n < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            close_port();
+            return false;
+        }
+        for (ssize_t i = 0; i < n; i++) {
+            char c = buf[i];
+            // A frame can only start where a line would, FRAME_SYNC never appears in text
+            if (PARTIAL.empty() && (frame_rx_busy(&RX) || ((uint8_t)c == FRAME_SYNC))) {
+                uint8_t rx = frame_rx_byte(&RX, c);
+                if (rx == FRAME_RX_DONE) {
+                    if ((RX.DATA.OP == FRAME_OP_CREDIT) && (RX.DATA.LEN == 2)) {
+                        credit_report(RX.DATA.PAYLOAD[0], RX.DATA.PAYLOAD[1]);
+                    } else if (frames) {
+                        frames->push_back(RX.DATA);
+                    }
+                } else if (rx == FRAME_RX_BAD) {
+                    CRC_ERRORS++;
+                }
+                continue;
+            }
+            if (c == '\n') {
+                int free, taken;
+                if ((CREDIT_STATE != CREDIT_OFF) &&
+                    (sscanf(PARTIAL.c_str(), "CREDIT %d %d", &free, &taken) == 2)) {
+                    credit_report(free, taken);
+                } else if (!PARTIAL.empty()) {
+                    lines.push_back(PARTIAL);
+                }
+                PARTIAL.clear();
+            } else if ((c != '\r') && (c != '\t')) {
+                PARTIAL += c;
+            }
+        }
+    }
+    return true;
+}
+
+bool SerialPort::write_line(const std::string &line) {
+    return send(line + '\n', line == "MOVE STOP");
+}
+
+bool SerialPort::write_frame(uint8_t op, uint8_t seq, const uint8_t *payload, uint8_t len) {
+    uint8_t buf[FRAME_MAX_SIZE];
+    std::string bytes((const char *)buf, frame_encode(buf, op, seq, payload, len));
+    return send(bytes, (op == FRAME_OP_MOVE) && (len > 0) && (payload[0] == FRAME_MOVE_STOP));
+}
+
+bool SerialPort::send(const std::string &bytes, bool urgent) {
+    if (FD < 0) {
+        return false;
+    }
+    if (!urgent && (!HELD.empty() || !can_send())) {
+        HELD.push_back(bytes);
+        return true;
+    }
+    return transmit(bytes);
+}
+
+bool SerialPort::transmit(const std::string &bytes) {
+    OUT += bytes;
+    if (CREDIT_STATE != CREDIT_OFF) {
+        UNTAKEN.push_back(now_ms());    // The firmware counts every line and frame it reads, STOP and CREDIT too
+    }
+    return on_writable();
+}
+
+void SerialPort::start_credit() {
+    if (FD < 0) {
+        return;
+    }
+    CREDIT_STATE = CREDIT_ASKED;
+    CREDIT_ASKED_MS = now_ms();
+    transmit("CREDIT\n");
+}
+
+// Commands not yet taken by the firmware use up what it last reported free
+bool SerialPort::can_send() const {
+    if (CREDIT_STATE == CREDIT_OFF) {
+        return true;
+    }
+    return (CREDIT_STATE == CREDIT_ON) && ((CREDIT_FREE - (int)UNTAKEN.size()) > 0);
+}
+
+void SerialPort::credit_report(int free, int taken) {
+    if (CREDIT_STATE == CREDIT_ASKED) {
+        // We can't tell what the firmware had read before the first report, so count it all as read.  At
+        // most the CREDIT question is still on its way then, and it fits in the room kept for a STOP.
+        UNTAKEN.clear();
+    } else {
+        // Oldest first, the firmware reads in order.  Read more than we sent (noise, a line cut in two)
+        // means everything we sent has been read.
+        size_t read = (uint8_t)(taken - CREDIT_TAKEN);
+        UNTAKEN.erase(UNTAKEN.begin(), UNTAKEN.begin() + std::min(read, UNTAKEN.size()));
+    }
+    CREDIT_FREE = free;
+    CREDIT_TAKEN = (uint8_t)taken;
+    CREDIT_STATE = CREDIT_ON;
+    release();
+}
+
+void SerialPort::tick() {
+    uint64_t now = now_ms();
+    if ((CREDIT_STATE == CREDIT_ASKED) && (now - CREDIT_ASKED_MS >= CREDIT_ANSWER_MS)) {
+        CREDIT_STATE = CREDIT_OFF;      // Firmware without CREDIT, it ignored the question
+        UNTAKEN.clear();
+    }
+    // Lost, or two lines merged into one on the way, either way not coming
+    while (!UNTAKEN.empty() && (now - UNTAKEN.front() >= CREDIT_LOST_MS)) {
+        UNTAKEN.pop_front();
+        CREDIT_LOST++;
+    }
+    release();
+}
+
+int SerialPort::next_timeout_ms() const {
+    uint64_t due;
+    if (CREDIT_STATE == CREDIT_ASKED) {
+        due = CREDIT_ASKED_MS + CREDIT_ANSWER_MS;
+    } else if (!UNTAKEN.empty()) {
+        due = UNTAKEN.front() + CREDIT_LOST_MS;
+    } else {
+        return -1;
+    }
+    uint64_t now = now_ms();
+    return (due <= now) ? 0 : (int)(due - now);
+}
+
+void SerialPort::release() {
+    while ((FD >= 0) && !HELD.empty() && can_send()) {
+        transmit(HELD.front());
+        HELD.pop_front();
+    }
+}
+
+bool SerialPort::on_writable() {
+    while (!OUT.empty()) {
+        ssize_t n = write(FD, OUT.data(), OUT.size());
+        if (n < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                return true;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            close_port();
+            return false;
+        }
+        OUT.erase(0, n);
+    }
+    return true;
+}
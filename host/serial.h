@@ -0,0 +1,90 @@
+/*  serial.h - Arduino serial port for the vacrouter host daemons
+
+                Opens the Mega's USB CDC port with the same settings ardith.sh applied with stty
+                (115200 8N1, raw, no flow control), non-blocking, and splits what it reads into lines,
+                and binary frames (src/frame.h) when the firmware answers in those.  With hupcl false
+                DTR stays up when the port is closed, so reopening it doesn't reset the Mega.
+
+                Credit flow control (CREDITcommand in src/main.cpp) starts with start_credit(), and
+                has to be started again whenever the board resets.  From then on commands wait here
+                until the firmware has said it has room for them, so a burst can't overrun its 64 byte
+                RX buffer.  MOVE STOP is the exception, the firmware keeps room for one.  Every report
+                says how many lines and frames the firmware has read, and commands are counted off
+                against that, so a report lost or a line merged into another can't throw the count
+                off for good.  A command the firmware hasn't read within CREDIT_LOST_MS was lost on
+                the way and stops holding up the rest.  Firmware that doesn't answer CREDIT within
+                CREDIT_ANSWER_MS doesn't have it, and commands go straight out again.  Call tick()
+                when next_timeout_ms() says so for those two.
+*/
+#ifndef VACROUTER_SERIAL_H
+#define VACROUTER_SERIAL_H
+
+#include "../src/frame.h"
+
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+#define CREDIT_ANSWER_MS     1000    // Asked for credit and no report in this long, carry on without
+#define CREDIT_LOST_MS       1000    // Not read in this long, lost.  The firmware's longest delay() is 300 ms.
+
+class SerialPort {
+  public:
+    SerialPort() : FD(-1), CRC_ERRORS(0), CREDIT_STATE(CREDIT_OFF), CREDIT_FREE(0), CREDIT_TAKEN(0),
+                   CREDIT_ASKED_MS(0), CREDIT_LOST(0) {}
+    ~SerialPort() { close_port(); }
+
+    bool open_port(const std::string &path, bool hupcl = true);
+    void close_port();
+    int  fd() const { return FD; }
+    bool is_open() const { return FD >= 0; }
+
+    // Read what is available and append complete lines (CR/LF and tabs stripped, like ardith.sh)
+    // to lines, and complete frames to frames if given (frames failing their CRC are dropped and
+    // counted in crc_errors()).  Credit reports are used here, not handed on.  Returns false if the
+    // port went away.
+    bool read_lines(std::vector<std::string> &lines, std::vector<FRAME> *frames = 0);
+    unsigned long crc_errors() const { return CRC_ERRORS; }
+
+    // Queue a command line, LF terminated.  Returns false if the port went away.
+    bool write_line(const std::string &line);
+    bool write_frame(uint8_t op, uint8_t seq, const uint8_t *payload, uint8_t len);
+    bool wants_write() const { return !OUT.empty(); }
+    bool on_writable();
+
+    // Ask the firmware for its credit, and hold commands until it answers
+    void start_credit();
+    // A command written now goes straight out rather than waiting for credit
+    bool can_send() const;
+    size_t held() const { return HELD.size(); }
+    // Commands given up on as lost, see CREDIT_LOST_MS
+    unsigned long credit_lost() const { return CREDIT_LOST; }
+
+    // Give up on lost commands and unanswered credit requests, and send what that frees up
+    void tick();
+    int  next_timeout_ms() const;
+
+  private:
+    enum { CREDIT_OFF, CREDIT_ASKED, CREDIT_ON };
+
+    bool send(const std::string &bytes, bool urgent);
+    bool transmit(const std::string &bytes);
+    void credit_report(int free, int taken);
+    void release();
+
+    int         FD;
+    std::string PARTIAL;
+    std::string OUT;
+    FRAME_RX    RX;
+    unsigned long CRC_ERRORS;
+    int         CREDIT_STATE;
+    int         CREDIT_FREE;        // As last reported
+    uint8_t     CREDIT_TAKEN;       // Lines and frames the firmware has read, mod 256, as last reported
+    uint64_t    CREDIT_ASKED_MS;
+    unsigned long CREDIT_LOST;
+    std::deque<uint64_t> UNTAKEN;   // When each command the firmware hasn't read yet went out, oldest first
+    std::deque<std::string> HELD;   // Commands waiting for credit, in order
+};
+
+#endif
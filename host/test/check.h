@@ -0,0 +1,26 @@
+/*  check.h - Checks for the host unit tests, small enough to need no test framework
+
+                Each test is its own program: CHECK() what should hold, and return check_done() from
+                main() so make test stops on the first failing program.
+*/
+#ifndef VACROUTER_TEST_CHECK_H
+#define VACROUTER_TEST_CHECK_H
+
+#include <stdio.h>
+
+static int CHECK_FAILURES = 0;
+
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if (!(cond)) {                                                               \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            CHECK_FAILURES++;                                                        \
+        }                                                                            \
+    } while (0)
+
+static inline int check_done(const char *name) {
+    printf("%s %s\n", CHECK_FAILURES ? "FAIL" : "PASS", name);
+    return CHECK_FAILURES ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,68 @@
+/*  pty.h - A pseudo terminal standing in for the Mega in the host unit tests
+
+                SerialPort opens the slave end like any tty, the test reads what was sent from the
+                master end and writes the firmware's side back to it.
+*/
+#ifndef VACROUTER_TEST_PTY_H
+#define VACROUTER_TEST_PTY_H
+
+#include "../../src/frame.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+class FakeMega {
+  public:
+    FakeMega() : MASTER(posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK)) {
+        if ((MASTER < 0) || (grantpt(MASTER) != 0) || (unlockpt(MASTER) != 0)) {
+            perror("posix_openpt");
+            exit(1);
+        }
+        fcntl(MASTER, F_SETFD, FD_CLOEXEC);     // A daemon under test mustn't keep the Mega plugged in
+        frame_rx_reset(&RX);
+    }
+    ~FakeMega() { close(MASTER); }
+
+    std::string path() const { return ptsname(MASTER); }
+
+    // Everything sent to the Mega since last asked
+    std::string received() {
+        std::string bytes;
+        char buf[256];
+        ssize_t n;
+        while ((n = read(MASTER, buf, sizeof(buf))) > 0) {
+            bytes.append(buf, n);
+        }
+        return bytes;
+    }
+
+    // Frames sent to the Mega since last asked, anything else is dropped
+    std::vector<FRAME> frames() {
+        std::vector<FRAME> out;
+        std::string bytes = received();
+        for (size_t i = 0; i < bytes.size(); i++) {
+            if (frame_rx_byte(&RX, (uint8_t)bytes[i]) == FRAME_RX_DONE) {
+                out.push_back(RX.DATA);
+            }
+        }
+        return out;
+    }
+
+    void send(const std::string &bytes) {
+        if (write(MASTER, bytes.data(), bytes.size()) != (ssize_t)bytes.size()) {
+            perror("write");
+        }
+    }
+
+  private:
+    int      MASTER;
+    FRAME_RX RX;
+};
+
+#endif
@@ -0,0 +1,54 @@
+/*  test_frame.cpp - The shared frame codec (src/frame.h): a frame cut short on the wire is dropped
+*/
+#include "check.h"
+#include "../../src/frame.h"
+
+// Feed bytes, returns the last frame_rx_byte() result
+static uint8_t feed(FRAME_RX *rx, const uint8_t *buf, uint8_t len) {
+    uint8_t result = FRAME_RX_MORE;
+    for (uint8_t i = 0; i < len; i++) {
+        result = frame_rx_byte(rx, buf[i]);
+    }
+    return result;
+}
+
+int main() {
+    FRAME_RX rx;
+    frame_rx_reset(&rx);
+    uint8_t buf[FRAME_MAX_SIZE];
+    uint8_t target = FRAME_MOVE_CNC;
+    uint8_t len = frame_encode(buf, FRAME_OP_MOVE, 7, &target, 1);
+
+    // Whole frame, idle calls between bytes don't get in the way
+    {
+        CHECK(!frame_rx_idle(&rx, 0));
+        CHECK(feed(&rx, buf, 3) == FRAME_RX_MORE);
+        CHECK(!frame_rx_idle(&rx, 100));
+        CHECK(!frame_rx_idle(&rx, 100 + FRAME_RX_GAP_US - 1));
+        CHECK(feed(&rx, buf + 3, len - 3) == FRAME_RX_DONE);
+        CHECK((rx.DATA.OP == FRAME_OP_MOVE) && (rx.DATA.SEQ == 7) && (rx.DATA.PAYLOAD[0] == FRAME_MOVE_CNC));
+    }
+
+    // The receiver was away a long time with the rest of the frame waiting: quiet is timed from its return
+    {
+        CHECK(feed(&rx, buf, 2) == FRAME_RX_MORE);
+        CHECK(!frame_rx_idle(&rx, 5000));
+        CHECK(feed(&rx, buf + 2, 1) == FRAME_RX_MORE);
+        CHECK(!frame_rx_idle(&rx, 900000));
+        CHECK(feed(&rx, buf + 3, len - 3) == FRAME_RX_DONE);
+    }
+
+    // Cut short: dropped once quiet for FRAME_RX_GAP_US, then the text after it isn't swallowed
+    {
+        CHECK(feed(&rx, buf, 4) == FRAME_RX_MORE);
+        CHECK(!frame_rx_idle(&rx, 0xFFFFFF00u));       // micros() wrapping in the gap
+        CHECK(frame_rx_busy(&rx));
+        CHECK(frame_rx_idle(&rx, 0xFFFFFF00u + FRAME_RX_GAP_US));
+        CHECK(!frame_rx_busy(&rx));
+        CHECK(!frame_rx_idle(&rx, 0));
+        CHECK(feed(&rx, (const uint8_t *)"HOME\n", 5) == FRAME_RX_MORE);
+        CHECK(!frame_rx_busy(&rx));
+    }
+
+    return check_done("frame");
+}
@@ -0,0 +1,193 @@
+/*  test_framelink.cpp - FrameLink: encoding, the window, and what each ack does to a command
+*/
+#include "check.h"
+#include "pty.h"
+#include "../framelink.h"
+
+#include <string>
+#include <vector>
+
+static std::vector<std::string> ACKS;
+
+static FRAME ack(const FRAME &command, uint8_t result) {
+    FRAME frame;
+    frame.OP = FRAME_OP_ACK;
+    frame.SEQ = command.SEQ;
+    frame.LEN = 2;
+    frame.PAYLOAD[0] = command.OP;
+    frame.PAYLOAD[1] = result;
+    return frame;
+}
+
+static std::string acked(const std::string &command, uint8_t result) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%s=%d", command.c_str(), result);
+    return buf;
+}
+
+int main() {
+    // Text commands with a binary form, and ones without
+    {
+        uint8_t op, payload[FRAME_MAX_PAYLOAD], len;
+        CHECK(FrameLink::encode("HOME", &op, payload, &len) && (op == FRAME_OP_HOME) && (len == 0));
+        CHECK(FrameLink::encode("STATUS", &op, payload, &len) && (op == FRAME_OP_STATUS) && (len == 0));
+        CHECK(FrameLink::encode("STATS", &op, payload, &len) && (op == FRAME_OP_STATS) && (len == 0));
+        CHECK(FrameLink::encode("GOTO 3", &op, payload, &len) && (op == FRAME_OP_GOTO) && (len == 1) &&
+              (payload[0] == 3));
+        CHECK(FrameLink::encode("MOVE GOCNC", &op, payload, &len) && (op == FRAME_OP_MOVE) &&
+              (payload[0] == FRAME_MOVE_CNC));
+        CHECK(FrameLink::encode("MOVE STOP", &op, payload, &len) && (payload[0] == FRAME_MOVE_STOP));
+        CHECK(!FrameLink::encode("GOTO 0", &op, payload, &len));
+        CHECK(!FrameLink::encode("GOTO 256", &op, payload, &len));
+        CHECK(!FrameLink::encode("GOTO 2x", &op, payload, &len));
+        CHECK(!FrameLink::encode("MOVE SIDEWAYS", &op, payload, &len));
+        CHECK(!FrameLink::encode("LIST", &op, payload, &len));
+    }
+
+    FakeMega mega;
+    SerialPort port;
+    CHECK(port.open_port(mega.path()));
+    FrameLink link(port);
+    link.on_ack([](const std::string &command, uint8_t result) { ACKS.push_back(acked(command, result)); });
+    uint64_t now = 1000;
+
+    // No more than FRAME_WINDOW in flight, the rest go out in order as acks come in
+    {
+        CHECK(!link.send("LIST", now));
+        const char *commands[] = { "HOME", "GOTO 1", "GOTO 2", "GOTO 3", "GOTO 4" };
+        for (size_t i = 0; i < 5; i++) {
+            CHECK(link.send(commands[i], now));
+        }
+        std::vector<FRAME> sent = mega.frames();
+        CHECK(sent.size() == FRAME_WINDOW);
+        CHECK((sent[0].OP == FRAME_OP_HOME) && (sent[3].OP == FRAME_OP_GOTO) && (sent[3].PAYLOAD[0] == 3));
+
+        link.on_frame(ack(sent[1], FRAME_ACK_OK), now);
+        link.on_frame(ack(sent[1], FRAME_ACK_OK), now);             // Repeat ack, already done with
+        CHECK((ACKS.size() == 1) && (ACKS[0] == acked("GOTO 1", FRAME_ACK_OK)));
+        std::vector<FRAME> more = mega.frames();
+        CHECK((more.size() == 1) && (more[0].PAYLOAD[0] == 4));
+
+        // An ack for another op under the same SEQ isn't this command's
+        FRAME wrong = ack(sent[0], FRAME_ACK_OK);
+        wrong.PAYLOAD[0] = FRAME_OP_STATUS;
+        link.on_frame(wrong, now);
+        CHECK(ACKS.size() == 1);
+
+        link.on_frame(ack(sent[0], FRAME_ACK_OK), now);
+        link.on_frame(ack(sent[2], FRAME_ACK_ERROR), now);
+        link.on_frame(ack(sent[3], FRAME_ACK_OK), now);
+        link.on_frame(ack(more[0], FRAME_ACK_OK), now);
+        CHECK(ACKS.size() == 5);
+        CHECK(ACKS[2] == acked("GOTO 2", FRAME_ACK_ERROR));
+        CHECK(link.next_timeout_ms(now) == -1);
+        ACKS.clear();
+    }
+
+    // CRC: resent straight away under the same SEQ.  BUSY: resent after the timeout, without using a try.
+    {
+        CHECK(link.send("HOME", now));
+        FRAME home = mega.frames().at(0);
+        link.on_frame(ack(home, FRAME_ACK_CRC), now);
+        std::vector<FRAME> again = mega.frames();
+        CHECK((again.size() == 1) && (again[0].SEQ == home.SEQ));
+
+        for (int i = 0; i < LINK_MAX_TRIES + 2; i++) {
+            link.on_frame(ack(home, FRAME_ACK_BUSY), now);
+            CHECK(link.next_timeout_ms(now) == LINK_ACK_TIMEOUT_MS);
+            now += LINK_ACK_TIMEOUT_MS;
+            link.tick(now);
+            CHECK(mega.frames().size() == 1);
+        }
+        CHECK(ACKS.empty());
+        link.on_frame(ack(home, FRAME_ACK_OK), now);
+        CHECK((ACKS.size() == 1) && (ACKS[0] == acked("HOME", FRAME_ACK_OK)));
+        ACKS.clear();
+    }
+
+    // QUEUED: no resends while the firmware holds it, then the ack with its result
+    {
+        CHECK(link.send("GOTO 2", now));
+        FRAME go = mega.frames().at(0);
+        link.on_frame(ack(go, FRAME_ACK_QUEUED), now);
+        CHECK(link.next_timeout_ms(now) == -1);
+        now += 10 * LINK_ACK_TIMEOUT_MS;
+        link.tick(now);
+        CHECK(mega.frames().empty() && ACKS.empty());
+        link.on_frame(ack(go, FRAME_ACK_CANCELLED), now);
+        CHECK((ACKS.size() == 1) && (ACKS[0] == acked("GOTO 2", FRAME_ACK_CANCELLED)));
+        ACKS.clear();
+    }
+
+    // Never acked: sent LINK_MAX_TRIES times, then given up with LINK_NO_ACK
+    {
+        CHECK(link.send("STATUS", now));
+        int sends = (int)mega.frames().size();
+        for (int i = 0; i < LINK_MAX_TRIES + 2; i++) {
+            now += LINK_ACK_TIMEOUT_MS - 1;
+            link.tick(now);
+            sends += (int)mega.frames().size();
+            now += 1;
+            link.tick(now);
+            sends += (int)mega.frames().size();
+        }
+        CHECK(sends == LINK_MAX_TRIES);
+        CHECK((ACKS.size() == 1) && (ACKS[0] == acked("STATUS", LINK_NO_ACK)));
+        ACKS.clear();
+    }
+
+    // Position reports name the command that moved the arm, events are decoded as they come
+    {
+        std::string moved;
+        int pos = 0;
+        link.on_position([&](const std::string &command, int ppos, int cpos) {
+            moved = command;
+            pos = ppos * 100 + cpos;
+        });
+        uint16_t seq = 0;
+        int id = 0, arg = 0;
+        link.on_event([&](uint16_t s, uint8_t i, int a) {
+            seq = s;
+            id = i;
+            arg = a;
+        });
+        CHECK(link.send("MOVE GOCNC", now));
+        FRAME move = mega.frames().at(0);
+        link.on_frame(ack(move, FRAME_ACK_OK), now);
+
+        FRAME report;
+        report.OP = FRAME_OP_POS;
+        report.SEQ = move.SEQ;
+        report.LEN = 2;
+        report.PAYLOAD[0] = 3;
+        report.PAYLOAD[1] = 4;
+        link.on_frame(report, now);
+        CHECK((moved == "MOVE GOCNC") && (pos == 304));
+
+        FRAME event;
+        event.OP = FRAME_OP_EVENT;
+        event.SEQ = move.SEQ;
+        event.LEN = EVENT_PAYLOAD;
+        event.PAYLOAD[0] = EVENT_FAULT;
+        event.PAYLOAD[1] = 0x34;
+        event.PAYLOAD[2] = 0x12;
+        event.PAYLOAD[3] = 0xFE;
+        event.PAYLOAD[4] = 0xFF;
+        link.on_frame(event, now);
+        CHECK((seq == 0x1234) && (id == EVENT_FAULT) && (arg == -2));
+        ACKS.clear();
+    }
+
+    // A reopened port drops everything in flight or waiting
+    {
+        for (int i = 0; i < FRAME_WINDOW + 2; i++) {
+            CHECK(link.send("HOME", now));
+        }
+        link.reset();
+        CHECK(ACKS.size() == FRAME_WINDOW + 2);
+        CHECK(ACKS.back() == acked("HOME", LINK_NO_ACK));
+        CHECK(link.next_timeout_ms(now) == -1);
+    }
+
+    return check_done("framelink");
+}
@@ -0,0 +1,184 @@
+/*  test_mqtt.cpp - MqttClient's QoS 1 queue while the broker is away, against a fake broker on loopback
+*/
+#include "check.h"
+#include "../mqtt.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+struct Publish {
+    std::string TOPIC;
+    std::string PAYLOAD;
+    uint16_t    ID;
+    bool        DUP;
+    bool        RETAIN;
+};
+
+// Run the client's side of the loop until the broker has bytes waiting, then read them all
+static std::string pump(MqttClient &client, int broker) {
+    std::string bytes;
+    for (int i = 0; i < 50; i++) {
+        struct pollfd pfd[2] = { { client.fd(), (short)(POLLIN | (client.wants_write() ? POLLOUT : 0)), 0 },
+                                 { broker, POLLIN, 0 } };
+        if (poll(pfd, 2, 20) <= 0) {
+            if (!bytes.empty()) {
+                break;
+            }
+            continue;
+        }
+        if (pfd[0].revents & POLLOUT) {
+            client.on_writable();
+        }
+        if (pfd[0].revents & POLLIN) {
+            client.on_readable();
+        }
+        if (pfd[1].revents & POLLIN) {
+            char buf[4096];
+            ssize_t n = read(broker, buf, sizeof(buf));
+            if (n > 0) {
+                bytes.append(buf, n);
+            }
+        }
+    }
+    return bytes;
+}
+
+// Split what the client sent into packets, keeping the PUBLISHes
+static std::vector<Publish> publishes(const std::string &bytes, int *others) {
+    std::vector<Publish> out;
+    size_t at = 0;
+    while (at + 2 <= bytes.size()) {
+        uint8_t header = bytes[at++];
+        size_t len = 0;
+        size_t mult = 1;
+        uint8_t b;
+        do {
+            b = bytes[at++];
+            len += (b & 0x7F) * mult;
+            mult *= 128;
+        } while (b & 0x80);
+        std::string body = bytes.substr(at, len);
+        at += len;
+        if ((header & 0xF0) != 0x30) {
+            (*others)++;
+            continue;
+        }
+        Publish p;
+        size_t tlen = ((uint8_t)body[0] << 8) | (uint8_t)body[1];
+        p.TOPIC = body.substr(2, tlen);
+        p.ID = ((uint8_t)body[2 + tlen] << 8) | (uint8_t)body[3 + tlen];
+        p.PAYLOAD = body.substr(4 + tlen);
+        p.DUP = header & 0x08;
+        p.RETAIN = header & 0x01;
+        out.push_back(p);
+    }
+    return out;
+}
+
+static std::string number(int n) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%d", n);
+    return buf;
+}
+
+int main() {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    CHECK((bind(listener, (struct sockaddr *)&addr, addr_len) == 0) && (listen(listener, 1) == 0));
+    getsockname(listener, (struct sockaddr *)&addr, &addr_len);
+
+    MqttClient::Options opts;
+    opts.HOST = "127.0.0.1";
+    opts.PORT = ntohs(addr.sin_port);
+    opts.CLIENT_ID = "test";
+    MqttClient client(opts);
+
+    // Offline: a newer retained status replaces the one waiting, events pile up to MQTT_MAX_INFLIGHT
+    client.publish("status", "a", 1, true);
+    for (int i = 0; i < 10; i++) {
+        client.publish("event", number(i), 1, false);
+    }
+    client.publish("status", "b", 1, true);
+    CHECK((client.inflight() == 11) && (client.dropped() == 0));
+    for (int i = 10; i < 210; i++) {
+        client.publish("event", number(i), 1, false);
+    }
+    CHECK((client.inflight() == MQTT_MAX_INFLIGHT) && (client.dropped() == 111));
+    client.publish("status", "c", 1, true);
+    client.publish("event", "dropped", 0, false);      // QoS 0 never waits
+    CHECK((client.inflight() == MQTT_MAX_INFLIGHT) && (client.dropped() == 112));
+
+    // Connect: the newest events and the last status go out again, oldest first
+    {
+        CHECK(client.connect());
+        int broker = accept(listener, 0, 0);
+        CHECK(broker >= 0);
+        int others = 0;
+        pump(client, broker);                           // CONNECT
+        const char connack[] = { 0x20, 0x02, 0x00, 0x00 };
+        CHECK(write(broker, connack, sizeof(connack)) == sizeof(connack));
+        std::vector<Publish> sent = publishes(pump(client, broker), &others);
+        CHECK(client.connected() && (others == 0));
+        CHECK(sent.size() == MQTT_MAX_INFLIGHT);
+        int events = 0;
+        for (size_t i = 0; i < sent.size(); i++) {
+            CHECK(sent[i].DUP);
+            if (sent[i].TOPIC == "status") {
+                CHECK(sent[i].RETAIN && (sent[i].PAYLOAD == "c"));
+            } else {
+                CHECK(sent[i].PAYLOAD == number(111 + events));
+                events++;
+            }
+        }
+        CHECK(events == MQTT_MAX_INFLIGHT - 1);
+
+        // Acked, gone
+        std::string acks;
+        for (size_t i = 0; i < sent.size(); i++) {
+            const char puback[] = { 0x40, 0x02, (char)(sent[i].ID >> 8), (char)sent[i].ID };
+            acks.append(puback, sizeof(puback));
+        }
+        CHECK(write(broker, acks.data(), acks.size()) == (ssize_t)acks.size());
+        pump(client, broker);
+        CHECK(client.inflight() == 0);
+        close(broker);
+        client.disconnect();
+    }
+
+    // Packet ids wrap while offline: the oldest is still the one dropped
+    {
+        for (int i = 0; i < 65600; i++) {
+            client.publish("event", number(i), 1, false);
+        }
+        CHECK(client.inflight() == MQTT_MAX_INFLIGHT);
+        CHECK(client.connect());
+        int broker = accept(listener, 0, 0);
+        int others = 0;
+        pump(client, broker);
+        const char connack[] = { 0x20, 0x02, 0x00, 0x00 };
+        CHECK(write(broker, connack, sizeof(connack)) == sizeof(connack));
+        std::vector<Publish> sent = publishes(pump(client, broker), &others);
+        CHECK(sent.size() == MQTT_MAX_INFLIGHT);
+        bool newest = true;
+        for (size_t i = 0; i < sent.size(); i++) {
+            newest = newest && (atoi(sent[i].PAYLOAD.c_str()) >= 65600 - MQTT_MAX_INFLIGHT);
+        }
+        CHECK(newest);
+        close(broker);
+    }
+
+    close(listener);
+    return check_done("mqtt");
+}
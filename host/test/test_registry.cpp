@@ -0,0 +1,100 @@
+/*  test_registry.cpp - DeviceRegistry: loading, saving, and what Tasmota discovery changes
+*/
+#include "check.h"
+#include "../registry.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+static void write_file(const std::string &path, const char *text) {
+    std::ofstream out(path.c_str());
+    out << text;
+}
+
+int main() {
+    char dir[] = "/tmp/test_registry.XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string path = std::string(dir) + "/devices.txt";
+    std::vector<std::string> stations;
+    stations.push_back("cnc");
+    stations.push_back("chopsaw");
+
+    // A missing file is fine and leaves one device per station, an unreadable one isn't
+    {
+        DeviceRegistry reg(stations);
+        CHECK(reg.load(path));
+        CHECK(reg.size() == 2);
+        CHECK(reg.station("cnc") == "cnc");
+        CHECK(reg.station("lathe").empty());
+        CHECK(!reg.load(dir));
+        CHECK(reg.size() == 2);
+    }
+
+    // Comments and blank lines skipped, "-" is empty, the name keeps its spaces
+    {
+        write_file(path, "# topic station mac name\n"
+                         "\n"
+                         "router-plug\tcnc\tA4CF12C3D2E1\tCNC router\n"
+                         "vac  -  -  -\n"
+                         "saw chopsaw\n");
+        DeviceRegistry reg(stations);
+        CHECK(reg.load(path));
+        CHECK(reg.size() == 3);
+        CHECK(reg.station("router-plug") == "cnc");
+        CHECK(reg.station("vac").empty());
+        CHECK(reg.station("saw") == "chopsaw");
+        CHECK(reg.station("cnc").empty());      // The file replaces the seeded stations
+    }
+
+    // Discovery: a station name gets that station, anything else none, repeats change nothing
+    {
+        DeviceRegistry reg(stations);
+        CHECK(reg.discovered("A1", "{\"ip\":\"10.0.0.5\",\"dn\":\"Chop saw\",\"t\":\"chopsaw\"}"));
+        CHECK(reg.station("chopsaw") == "chopsaw");
+        CHECK(!reg.discovered("A1", "{\"dn\":\"Chop saw\",\"t\":\"chopsaw\"}"));
+        CHECK(reg.discovered("B2", "{\"dn\" : \"Shop \\\"vac\\\"\", \"t\" : \"vac\"}"));
+        CHECK(reg.station("vac").empty());
+        CHECK(reg.size() == 3);
+
+        // Renamed, it keeps its station and the old topic goes
+        CHECK(reg.discovered("A1", "{\"dn\":\"Chop saw\",\"t\":\"saw\"}"));
+        CHECK(reg.station("saw") == "chopsaw");
+        CHECK(reg.station("chopsaw").empty());
+        CHECK(reg.size() == 3);
+
+        // Removed devices and topics that can't be routed on are ignored
+        CHECK(!reg.discovered("C3", ""));
+        CHECK(!reg.discovered("C3", "{\"t\":\"a/b\"}"));
+        CHECK(!reg.discovered("C3", "{\"t\":42}"));
+        CHECK(!reg.discovered("", "{\"t\":\"lathe\"}"));
+        CHECK(reg.size() == 3);
+
+        // Saved and loaded back the same, quoted name and all
+        CHECK(reg.save(path));
+        CHECK(access((path + ".tmp").c_str(), F_OK) != 0);
+        DeviceRegistry again(stations);
+        CHECK(again.load(path));
+        CHECK(again.size() == 3);
+        CHECK(again.station("saw") == "chopsaw");
+        CHECK(again.station("vac").empty());
+        CHECK(again.station("cnc") == "cnc");
+
+        // A station filled in by hand survives the device turning up in discovery
+        write_file(path, "lathe\tcnc\t-\t-\n");
+        CHECK(again.load(path));
+        CHECK(again.discovered("D4", "{\"dn\":\"Lathe\",\"t\":\"lathe\"}"));
+        CHECK(again.station("lathe") == "cnc");
+    }
+
+    unlink(path.c_str());
+    rmdir(dir);
+    return check_done("registry");
+}
@@ -0,0 +1,120 @@
+/*  test_serial.cpp - SerialPort credit flow control, including lines lost on the way and no answer at all
+*/
+#include "check.h"
+#include "pty.h"
+#include "../serial.h"
+
+#include <poll.h>
+
+#include <string>
+#include <vector>
+
+// Read what the fake Mega sent, as the daemons do when the port polls readable
+static std::vector<std::string> pump(SerialPort &port) {
+    std::vector<std::string> lines;
+    struct pollfd pfd = { port.fd(), POLLIN, 0 };
+    if (poll(&pfd, 1, 200) > 0) {
+        port.read_lines(lines);
+    }
+    return lines;
+}
+
+// Sleep until the port says it has something to give up on, then let it
+static void wait_for_tick(SerialPort &port) {
+    int wait = port.next_timeout_ms();
+    CHECK(wait > 0);
+    poll(0, 0, wait + 5);
+    CHECK(port.next_timeout_ms() <= 0);
+    port.tick();
+}
+
+int main() {
+    FakeMega mega;
+    SerialPort port;
+    CHECK(port.open_port(mega.path()));
+
+    // Without credit everything goes straight out, and CREDIT lines are just lines
+    {
+        CHECK(port.can_send() && (port.next_timeout_ms() == -1));
+        CHECK(port.write_line("HOME"));
+        CHECK(mega.received() == "HOME\n");
+        mega.send("CREDIT 1 1\r\n");
+        std::vector<std::string> lines = pump(port);
+        CHECK((lines.size() == 1) && (lines[0] == "CREDIT 1 1"));
+    }
+
+    // Held until the first report, then only as many as it has room for
+    {
+        port.start_credit();
+        CHECK(mega.received() == "CREDIT\n");
+        CHECK(!port.can_send());
+        CHECK(port.write_line("GOTO 1"));
+        CHECK(port.write_line("GOTO 2"));
+        CHECK((port.held() == 2) && mega.received().empty());
+        mega.send("CREDIT 1 7\r\n");
+        CHECK(pump(port).empty());
+        CHECK(mega.received() == "GOTO 1\n");
+        CHECK((port.held() == 1) && !port.can_send());
+
+        // MOVE STOP never waits
+        CHECK(port.write_line("MOVE STOP"));
+        CHECK(mega.received() == "MOVE STOP\n");
+
+        // Both read, GOTO 2 goes
+        mega.send("CREDIT 1 9\r\n");
+        pump(port);
+        CHECK(mega.received() == "GOTO 2\n");
+        CHECK(port.held() == 0);
+    }
+
+    // GOTO 2 lost on the way: the firmware never counts it, the next command goes once it is given up on
+    {
+        CHECK(port.write_line("GOTO 3"));
+        CHECK((port.held() == 1) && (port.credit_lost() == 0));
+        wait_for_tick(port);
+        CHECK(port.credit_lost() == 1);
+        CHECK(mega.received() == "GOTO 3\n");
+        CHECK(port.held() == 0);
+    }
+
+    // A later report still counts from what the firmware has read: GOTO 3 and a line of noise
+    {
+        CHECK(port.write_line("GOTO 4"));
+        CHECK(port.held() == 1);
+        mega.send("CREDIT 1 11\r\n");
+        pump(port);
+        CHECK(mega.received() == "GOTO 4\n");
+
+        // And as a frame, no room left in the queue this time
+        uint8_t buf[FRAME_MAX_SIZE];
+        uint8_t payload[2] = { 0, 12 };
+        mega.send(std::string((const char *)buf, frame_encode(buf, FRAME_OP_CREDIT, 0, payload, 2)));
+        std::vector<FRAME> frames;
+        std::vector<std::string> lines;
+        struct pollfd pfd = { port.fd(), POLLIN, 0 };
+        poll(&pfd, 1, 200);
+        port.read_lines(lines, &frames);
+        CHECK(lines.empty() && frames.empty());
+        CHECK(!port.can_send());
+        CHECK(port.next_timeout_ms() == -1);     // Nothing unread, it is waiting for room, not a lost line
+        CHECK(port.write_line("GOTO 5"));
+        CHECK(port.held() == 1);
+    }
+
+    // Firmware that doesn't know CREDIT: after CREDIT_ANSWER_MS commands go straight out again
+    {
+        CHECK(port.open_port(mega.path()));
+        mega.received();
+        port.start_credit();
+        CHECK(port.write_line("HOME"));
+        CHECK(port.held() == 1);
+        CHECK(mega.received() == "CREDIT\n");
+        wait_for_tick(port);
+        CHECK(mega.received() == "HOME\n");
+        CHECK(port.can_send() && (port.held() == 0));
+        mega.send("CREDIT 1 1\r\n");
+        CHECK(pump(port).size() == 1);
+    }
+
+    return check_done("serial");
+}
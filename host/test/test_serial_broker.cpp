@@ -0,0 +1,212 @@
+/*  test_serial_broker.cpp - vacrouter-serial against a pty standing in for the Mega, and two clients
+
+                Runs the real daemon (./vacrouter-serial, make test builds it first) with its console
+                behind a symlink in a scratch directory, so the Mega can be unplugged and plugged back
+                in by closing the pty and pointing the link at a new one.
+*/
+#include "check.h"
+#include "pty.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include <string>
+#include <vector>
+
+static uint64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// One connection to the broker's socket, read a line at a time
+class Client {
+  public:
+    explicit Client(const std::string &path) : FD(-1) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        // The daemon may still be starting
+        for (int i = 0; (i < 200) && (FD < 0); i++) {
+            FD = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (connect(FD, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+                close(FD);
+                FD = -1;
+                poll(0, 0, 10);
+            }
+        }
+        CHECK(FD >= 0);
+    }
+    ~Client() { close(FD); }
+
+    void send(const std::string &line) {
+        std::string bytes = line + "\n";
+        CHECK(write(FD, bytes.data(), bytes.size()) == (ssize_t)bytes.size());
+    }
+
+    // Lines up to and including last, or all that came within ms if it never did
+    std::vector<std::string> until(const std::string &last, int ms = 1000) {
+        std::vector<std::string> lines;
+        uint64_t end = now_ms() + ms;
+        for (;;) {
+            size_t eol;
+            while ((eol = IN.find('\n')) != std::string::npos) {
+                lines.push_back(IN.substr(0, eol));
+                IN.erase(0, eol + 1);
+                if (lines.back() == last) {
+                    return lines;
+                }
+            }
+            uint64_t now = now_ms();
+            struct pollfd pfd = { FD, POLLIN, 0 };
+            if ((now >= end) || (poll(&pfd, 1, (int)(end - now)) <= 0)) {
+                return lines;
+            }
+            char buf[512];
+            ssize_t n = read(FD, buf, sizeof(buf));
+            if (n <= 0) {
+                return lines;
+            }
+            IN.append(buf, n);
+        }
+    }
+
+  private:
+    int         FD;
+    std::string IN;
+};
+
+// What the Mega was sent within ms
+static std::string wait_received(FakeMega &mega, int ms = 500) {
+    std::string bytes;
+    uint64_t end = now_ms() + ms;
+    while (bytes.empty() && (now_ms() < end)) {
+        poll(0, 0, 10);
+        bytes = mega.received();
+    }
+    poll(0, 0, 20);
+    return bytes + mega.received();
+}
+
+static bool has(const std::vector<std::string> &lines, const std::string &line) {
+    for (size_t i = 0; i < lines.size(); i++) {
+        if (lines[i] == line) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main() {
+    char dir[] = "/tmp/vacr-broker-XXXXXX";
+    CHECK(mkdtemp(dir) != 0);
+    std::string console = std::string(dir) + "/ttyACM0";
+    std::string sock = std::string(dir) + "/sock";
+    FakeMega *mega = new FakeMega;
+    CHECK(symlink(mega->path().c_str(), console.c_str()) == 0);
+
+    pid_t daemon = fork();
+    if (daemon == 0) {
+        execl("./vacrouter-serial", "vacrouter-serial", "--console", console.c_str(), "--socket", sock.c_str(),
+              "--reply-ms", "100", "--quiet", (char *)0);
+        perror("./vacrouter-serial");
+        _exit(1);
+    }
+
+    Client watcher(sock);
+    Client first(sock);
+    Client second(sock);
+    watcher.send("SUB");
+    std::vector<std::string> lines = watcher.until("PORT UP");
+    CHECK(has(lines, "OK SUB") && has(lines, "PORT UP"));
+    CHECK(wait_received(*mega) == "CREDIT\n");
+
+    // Held until the firmware reports credit
+    {
+        first.send("STATUS");
+        CHECK(wait_received(*mega, 200).empty());
+        mega->send("CREDIT 1 1\r\n");
+        CHECK(wait_received(*mega) == "STATUS\n");
+    }
+
+    // Paired by the echo: what the arm said before it isn't the reply, what it says after is
+    {
+        mega->send("EV 4 2 1\r\nSTATUS\r\nSTATUS HOMING: 5 STEP: 0\r\n");
+        lines = first.until("DONE");
+        CHECK((lines.size() == 3) && (lines[0] == "ACK STATUS") && (lines[1] == "REPLY STATUS HOMING: 5 STEP: 0") &&
+              (lines[2] == "DONE"));
+        lines = watcher.until("LINE STATUS HOMING: 5 STEP: 0");
+        CHECK((lines.size() == 3) && (lines[0] == "LINE EV 4 2 1") && (lines[1] == "LINE STATUS"));
+        mega->send("CREDIT 2 2\r\n");
+    }
+
+    // The scripts' client: --send prints the answer through DONE and exits 0
+    {
+        std::string cmd = "./vacrouter-serial --socket " + sock + " --send STATS";
+        FILE *client = popen(cmd.c_str(), "r");
+        CHECK(wait_received(*mega) == "STATS\n");
+        mega->send("STATS\r\nSTATS UP_S: 1\r\n");
+        std::string out;
+        char buf[256];
+        while (fgets(buf, sizeof(buf), client)) {
+            out += buf;
+        }
+        CHECK(pclose(client) == 0);
+        CHECK(out == "ACK STATS\nREPLY STATS UP_S: 1\nDONE\n");
+        mega->send("CREDIT 2 3\r\n");
+    }
+
+    // One command on the wire at a time, the second client's waits for the first's DONE
+    {
+        first.send("GOTO 1");
+        poll(0, 0, 50);
+        second.send("GOTO 2");
+        CHECK(wait_received(*mega) == "GOTO 1\n");
+        CHECK(wait_received(*mega, 200).empty());
+        mega->send("GOTO 1\r\nOK PPOS: 2 CPOS: 1\r\n");
+        lines = first.until("DONE");
+        CHECK((lines.size() == 3) && (lines[1] == "REPLY OK PPOS: 2 CPOS: 1"));
+        CHECK(wait_received(*mega) == "GOTO 2\n");
+        CHECK(second.until("DONE", 200).empty());
+    }
+
+    // The port drops: the command on the wire and the one queued behind it both fail
+    {
+        first.send("HOME");
+        poll(0, 0, 50);
+        delete mega;
+        CHECK(has(second.until("ERR port closed"), "ERR port closed"));
+        CHECK(has(first.until("ERR port closed"), "ERR port closed"));
+        CHECK(has(watcher.until("PORT DOWN"), "PORT DOWN"));
+        first.send("STATUS");
+        CHECK(has(first.until("ERR port closed"), "ERR port closed"));
+    }
+
+    // The node comes back: reopened at once, well before the 1 s retry, and credit asked for again
+    {
+        unlink(console.c_str());
+        poll(0, 0, 100);
+        mega = new FakeMega;
+        uint64_t back = now_ms();
+        CHECK(symlink(mega->path().c_str(), console.c_str()) == 0);
+        CHECK(has(watcher.until("PORT UP"), "PORT UP"));
+        CHECK(now_ms() - back < 500);
+        CHECK(wait_received(*mega) == "CREDIT\n");
+    }
+
+    kill(daemon, SIGTERM);
+    int status = 0;
+    CHECK((waitpid(daemon, &status, 0) == daemon) && WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+    delete mega;
+    unlink(console.c_str());
+    rmdir(dir);
+    return check_done("serial_broker");
+}
@@ -0,0 +1,89 @@
+/*  test_timer_wheel.cpp - TimerWheel: due times, cancelling, and due order across turns and jumps
+*/
+#include "check.h"
+#include "../timer_wheel.h"
+
+#include <string>
+
+int main() {
+    std::string ran;
+
+    // Not before it is due, once when it is, and then gone
+    {
+        TimerWheel wheel(10, 8);
+        TimerWheel::TimerId id = wheel.schedule(1000, 250, [&]() { ran += "a"; });
+        CHECK(wheel.pending(id));
+        CHECK(wheel.next_timeout_ms(1000) == 250);
+        wheel.advance(1249);
+        CHECK(ran.empty());
+        wheel.advance(1250);
+        CHECK(ran == "a");
+        CHECK(!wheel.pending(id) && (wheel.size() == 0));
+        CHECK(!wheel.cancel(id));
+        CHECK(wheel.next_timeout_ms(1300) == -1);
+        wheel.advance(5000);
+        CHECK(ran == "a");
+    }
+
+    // A timer several turns away shares a bucket with nearer ones but only runs when due
+    {
+        ran.clear();
+        TimerWheel wheel(10, 4);                // 40 ms a turn
+        wheel.schedule(0, 100, [&]() { ran += "far"; });
+        wheel.schedule(0, 20, [&]() { ran += "near"; });
+        wheel.advance(20);
+        wheel.advance(60);
+        CHECK(ran == "near");
+        wheel.advance(100);
+        CHECK(ran == "nearfar");
+    }
+
+    // Cancelled timers never run, and cancelling twice says so
+    {
+        ran.clear();
+        TimerWheel wheel(10, 8);
+        TimerWheel::TimerId id = wheel.schedule(0, 50, [&]() { ran += "x"; });
+        wheel.schedule(0, 60, [&]() { ran += "y"; });
+        CHECK(wheel.cancel(id));
+        CHECK(!wheel.cancel(id));
+        CHECK(wheel.next_timeout_ms(0) == 60);
+        wheel.advance(100);
+        CHECK(ran == "y");
+    }
+
+    // After a jump of many turns everything due runs, in due order, not bucket order
+    {
+        ran.clear();
+        TimerWheel wheel(10, 8);                // 80 ms a turn
+        wheel.schedule(0, 5000, [&]() { ran += "c"; });
+        wheel.schedule(0, 130, [&]() { ran += "b"; });
+        wheel.schedule(0, 20, [&]() { ran += "a"; });
+        wheel.schedule(0, 20000, [&]() { ran += "later"; });
+        CHECK(wheel.next_timeout_ms(10000) == 0);
+        wheel.advance(10000);
+        CHECK(ran == "abc");
+        CHECK(wheel.size() == 1);
+        CHECK(wheel.next_timeout_ms(10000) == 10000);
+    }
+
+    // A callback may cancel one due in the same advance(), and what it schedules runs next time
+    {
+        ran.clear();
+        TimerWheel wheel(10, 8);
+        TimerWheel::TimerId second = 0;
+        wheel.schedule(0, 10, [&]() {
+            ran += "1";
+            wheel.cancel(second);
+            wheel.schedule(30, 0, [&]() { ran += "3"; });
+        });
+        second = wheel.schedule(0, 20, [&]() { ran += "2"; });
+        wheel.advance(30);
+        CHECK(ran == "1");
+        CHECK(wheel.next_timeout_ms(30) == 0);
+        wheel.advance(30);
+        CHECK(ran == "13");
+        CHECK(wheel.size() == 0);
+    }
+
+    return check_done("timer_wheel");
+}
@@ -0,0 +1,79 @@
+/*  timer_wheel.cpp - Cancellable one-shot timers, see timer_wheel.h
+*/
+#include "timer_wheel.h"
+
+#include <map>
+
+TimerWheel::TimerWheel(uint32_t tick_ms, size_t slots)
+    : TICK_MS(tick_ms ? tick_ms : 1), SLOTS(slots ? slots : 1), SWEPT_MS(0), NEXT_ID(0) {}
+
+TimerWheel::TimerId TimerWheel::schedule(uint64_t now_ms, uint32_t delay_ms, Callback callback) {
+    do {
+        NEXT_ID++;
+    } while ((NEXT_ID == 0) || WHERE.count(NEXT_ID));
+    if (WHERE.empty() || (now_ms < SWEPT_MS)) {
+        SWEPT_MS = now_ms - (now_ms % TICK_MS);     // Nothing pending before now, skip the idle buckets
+    }
+    Timer timer;
+    timer.ID = NEXT_ID;
+    timer.DUE_MS = now_ms + delay_ms;
+    timer.CALLBACK = callback;
+    size_t slot = slot_of(timer.DUE_MS);
+    WHERE[timer.ID] = std::make_pair(slot, SLOTS[slot].insert(SLOTS[slot].end(), timer));
+    return timer.ID;
+}
+
+bool TimerWheel::cancel(TimerId id) {
+    Index::iterator it = WHERE.find(id);
+    if (it == WHERE.end()) {
+        return false;
+    }
+    SLOTS[it->second.first].erase(it->second.second);
+    WHERE.erase(it);
+    return true;
+}
+
+void TimerWheel::advance(uint64_t now_ms) {
+    // At most one turn of the wheel covers every bucket, later turns would only find the same timers
+    uint64_t end = now_ms - (now_ms % TICK_MS);
+    if (end >= SWEPT_MS + (uint64_t)TICK_MS * SLOTS.size()) {
+        SWEPT_MS = end - (uint64_t)TICK_MS * (SLOTS.size() - 1);
+    }
+    // Everything due from every bucket first: after a jump the buckets aren't in due order, and a
+    // callback can schedule or cancel without upsetting the walk
+    std::multimap<uint64_t, TimerId> due;
+    while (!WHERE.empty() && (SWEPT_MS <= end)) {
+        Slot &slot = SLOTS[slot_of(SWEPT_MS)];
+        for (Slot::iterator it = slot.begin(); it != slot.end(); ++it) {
+            if (it->DUE_MS <= now_ms) {
+                due.insert(std::make_pair(it->DUE_MS, it->ID));
+            }
+        }
+        if (SWEPT_MS == end) {
+            break;
+        }
+        SWEPT_MS += TICK_MS;
+    }
+    for (std::multimap<uint64_t, TimerId>::iterator it = due.begin(); it != due.end(); ++it) {
+        Index::iterator where = WHERE.find(it->second);
+        if (where == WHERE.end()) {
+            continue;   // Cancelled by a callback that ran before it
+        }
+        Callback callback = where->second.second->CALLBACK;
+        SLOTS[where->second.first].erase(where->second.second);
+        WHERE.erase(where);
+        callback();
+    }
+}
+
+int TimerWheel::next_timeout_ms(uint64_t now_ms) const {
+    int timeout = -1;
+    for (Index::const_iterator it = WHERE.begin(); it != WHERE.end(); ++it) {
+        uint64_t due = it->second.second->DUE_MS;
+        int wait = (due <= now_ms) ? 0 : (int)(due - now_ms);
+        if ((timeout < 0) || (wait < timeout)) {
+            timeout = wait;
+        }
+    }
+    return timeout;
+}
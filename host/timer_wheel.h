@@ -0,0 +1,63 @@
+/*  timer_wheel.h - Cancellable one-shot timers for the vacrouter host daemons
+
+                A hashed timer wheel: SLOTS buckets of TICK_MS each, a timer going in the bucket its
+                due time falls in, however many turns of the wheel away that is.  Scheduling and
+                cancelling are O(1) on average (a hash lookup and a list splice).  advance() only looks
+                at the buckets the clock moved through, one turn's worth at most however far it jumped,
+                and runs what is due in due order.  next_timeout_ms() looks at every pending timer,
+                which is fine for the handful a bridge keeps.
+                Like the rest of the host code it runs in the owner's event loop: call advance() when
+                next_timeout_ms() says something is due, callbacks run from inside it.  A timer a
+                callback schedules to be due already runs on the next advance(), one it cancels doesn't
+                run at all.
+*/
+#ifndef VACROUTER_TIMER_WHEEL_H
+#define VACROUTER_TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+class TimerWheel {
+  public:
+    typedef uint32_t TimerId;               // 0 is never a timer, use it for "none pending"
+    typedef std::function<void()> Callback;
+
+    TimerWheel(uint32_t tick_ms, size_t slots);
+
+    // Run callback delay_ms after now_ms
+    TimerId schedule(uint64_t now_ms, uint32_t delay_ms, Callback callback);
+
+    // False if it already ran or was cancelled
+    bool cancel(TimerId id);
+    bool pending(TimerId id) const { return WHERE.count(id) != 0; }
+    size_t size() const { return WHERE.size(); }
+
+    // Run every timer due by now_ms, in due order
+    void advance(uint64_t now_ms);
+
+    // Milliseconds until the next timer is due, -1 for none
+    int next_timeout_ms(uint64_t now_ms) const;
+
+  private:
+    struct Timer {
+        TimerId  ID;
+        uint64_t DUE_MS;
+        Callback CALLBACK;
+    };
+    typedef std::list<Timer> Slot;
+    typedef std::unordered_map<TimerId, std::pair<size_t, Slot::iterator> > Index;
+
+    size_t slot_of(uint64_t ms) const { return (size_t)((ms / TICK_MS) % SLOTS.size()); }
+
+    uint32_t          TICK_MS;
+    std::vector<Slot> SLOTS;
+    Index             WHERE;
+    uint64_t          SWEPT_MS;     // advance() has run everything due before this tick
+    TimerId           NEXT_ID;
+};
+
+#endif
@@ -0,0 +1,252 @@
+/*  trace2chrome.cpp - Convert the firmware's TRACE DUMP to Chrome trace JSON
+
+                Reads a dump (src/trace.h) and writes JSON for chrome://tracing or ui.perfetto.dev.  The
+                motor, homing, sensor and command events each get their own track.  Relay on to relay off
+                is a slice on the motor track.  Each homing seek is a slice on the homing track.  Edges,
+                commands and move results are instant events.
+
+                Anything before "TRACE" on a line is ignored, so the bridge's log or the simulator's
+                output can be fed in as they are.  Event times are worked out back from the header's
+                NOW_US, which also copes with micros() wrapping.  They are placed on host time (µs since
+                the epoch) when the input has the bridge's "HOST_US: <us>" log line after the header, or
+                with --host-us.  Otherwise they stay in firmware micros().
+
+    Usage:      trace2chrome [--host-us US] < dump.txt > trace.json
+
+    Capture:    mosquitto_pub -t cmnd/vacrouter/TRACE -m DUMP
+                grep -E 'TRACE|HOST_US' bridge.log | tail -n 80 | trace2chrome > trace.json
+*/
+#include "../src/trace.h"
+#include "../src/edge_queue.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Tracks, as Chrome trace thread IDs
+#define TRACK_MOTOR     1
+#define TRACK_HOMING    2
+#define TRACK_SENSOR    3
+#define TRACK_COMMANDS  4
+
+struct Event {
+    uint32_t    US;
+    int         ID;
+    int         ARG;
+    std::string TEXT;       // Command name for TRACE_COMMAND
+};
+
+// HS_* in src/main.cpp
+static const char *home_step_name(int step) {
+    switch (step) {
+        case 1:  return "SWEEP_LEFT";
+        case 2:  return "FIND_FIRST";
+        case 3:  return "VERIFY_LEFT";
+        case 4:  return "VERIFY_RIGHT";
+        default: return "STEP";
+    }
+}
+
+static std::string json_escape(const std::string &s) {
+    std::string out;
+    for (size_t i = 0; i < s.size(); i++) {
+        if ((s[i] == '"') || (s[i] == '\\')) {
+            out += '\\';
+        }
+        out += s[i];
+    }
+    return out;
+}
+
+class ChromeTrace {
+  public:
+    ChromeTrace() : FIRST(true) {
+        printf("{\"traceEvents\":[\n");
+        track_name(TRACK_MOTOR, "motor");
+        track_name(TRACK_HOMING, "homing");
+        track_name(TRACK_SENSOR, "sensor");
+        track_name(TRACK_COMMANDS, "commands");
+    }
+
+    ~ChromeTrace() { printf("\n],\"displayTimeUnit\":\"ms\"}\n"); }
+
+    // ph is B (begin), E (end) or i (instant)
+    void event(const char *ph, int track, long long ts, const std::string &name, int arg) {
+        separator();
+        printf("{\"ph\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"name\":\"%s\",\"args\":{\"arg\":%d}%s}", ph, track,
+               ts, json_escape(name).c_str(), arg, (ph[0] == 'i') ? ",\"s\":\"t\"" : "");
+    }
+
+  private:
+    void separator() {
+        if (!FIRST) {
+            printf(",\n");
+        }
+        FIRST = false;
+    }
+
+    void track_name(int track, const char *name) {
+        separator();
+        printf("{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"%s\"}}", track, name);
+    }
+
+    bool FIRST;
+};
+
+static void convert(const std::vector<Event> &events, uint32_t now_us, long long base_us) {
+    ChromeTrace out;
+    bool motor_on = false;
+    bool home_on = false;
+    char name[48];
+
+    for (size_t i = 0; i < events.size(); i++) {
+        const Event &e = events[i];
+        long long ts = base_us - (long long)(uint32_t)(now_us - e.US);
+        switch (e.ID) {
+            case TRACE_MOTOR_RIGHT:
+            case TRACE_MOTOR_LEFT:
+                if (motor_on) {
+                    out.event("E", TRACK_MOTOR, ts, "", 0);
+                }
+                snprintf(name, sizeof(name), "%s from %d", (e.ID == TRACE_MOTOR_RIGHT) ? "RIGHT" : "LEFT", e.ARG);
+                out.event("B", TRACK_MOTOR, ts, name, e.ARG);
+                motor_on = true;
+                break;
+
+            case TRACE_MOTOR_STOP:
+                if (motor_on) {
+                    out.event("E", TRACK_MOTOR, ts, "", e.ARG);
+                    motor_on = false;
+                }
+                snprintf(name, sizeof(name), "STOP source %d", e.ARG);
+                out.event("i", TRACK_MOTOR, ts, name, e.ARG);
+                break;
+
+            case TRACE_SENSOR: {
+                int flags = e.ARG >> 1;
+                const char *what = (e.ARG & 1) ? "off flag" : "on flag";
+                if (flags & EDGE_STOPPED) {
+                    what = "on flag, STOP";
+                    if (motor_on) {
+                        out.event("E", TRACK_MOTOR, ts, "", 0);     // The ISR cut the relays
+                        motor_on = false;
+                    }
+                } else if (flags & EDGE_PASSED) {
+                    what = "on flag, PASS";
+                } else if (flags & EDGE_BOUNCE) {
+                    what = "bounce";
+                }
+                out.event("i", TRACK_SENSOR, ts, what, e.ARG);
+                break;
+            }
+
+            case TRACE_MOVE_END:
+                out.event("i", TRACK_MOTOR, ts, (e.ARG == 3) ? "ARRIVED" : "TIMEOUT", e.ARG);   // MOTION_ARRIVED
+                break;
+
+            case TRACE_HOME_STEP:
+                if (home_on) {
+                    out.event("E", TRACK_HOMING, ts, "", 0);
+                }
+                out.event("B", TRACK_HOMING, ts, home_step_name(e.ARG), e.ARG);
+                home_on = true;
+                break;
+
+            case TRACE_HOME_DONE:
+                if (home_on) {
+                    out.event("E", TRACK_HOMING, ts, "", 0);
+                    home_on = false;
+                }
+                snprintf(name, sizeof(name), (e.ARG < 0) ? "HOMING FAILED" : "HOMED at %d", e.ARG);
+                out.event("i", TRACK_HOMING, ts, name, e.ARG);
+                break;
+
+            case TRACE_COMMAND:
+                out.event("i", TRACK_COMMANDS, ts, e.TEXT.empty() ? std::string("command") : e.TEXT, e.ARG);
+                break;
+
+            case TRACE_FRAME:
+                snprintf(name, sizeof(name), "FRAME op %d seq %d", e.ARG & 0xFF, (e.ARG >> 8) & 0xFF);
+                out.event("i", TRACK_COMMANDS, ts, name, e.ARG);
+                break;
+
+            case TRACE_REDIRECT:
+                snprintf(name, sizeof(name), "REDIRECT to %d", e.ARG);
+                out.event("i", TRACK_MOTOR, ts, name, e.ARG);
+                break;
+
+            default:
+                snprintf(name, sizeof(name), "event %d", e.ID);
+                out.event("i", TRACK_COMMANDS, ts, name, e.ARG);
+                break;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    long long host_us = -1;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if ((arg == "--host-us") && ((i + 1) < argc)) {
+            host_us = atoll(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--host-us US] < dump.txt > trace.json\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector<Event> events;
+    bool in_dump = false;
+    bool found = false;
+    uint32_t now_us = 0;
+    long long logged_us = -1;
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        size_t at = line.find("HOST_US: ");
+        if (in_dump && (at != std::string::npos)) {
+            logged_us = atoll(line.c_str() + at + 9);
+            continue;
+        }
+        at = line.find("TRACE DUMP NOW_US: ");
+        if (at != std::string::npos) {
+            // A later dump replaces an earlier one in the same input
+            events.clear();
+            now_us = strtoul(line.c_str() + at + 19, 0, 10);
+            logged_us = -1;
+            in_dump = found = true;
+            continue;
+        }
+        if (!in_dump) {
+            continue;
+        }
+        if (line.find("TRACE END") != std::string::npos) {
+            in_dump = false;
+            continue;
+        }
+        at = line.find("TRACE ");
+        Event e;
+        char text[32] = "";
+        unsigned long us;
+        if ((at == std::string::npos) ||
+            (sscanf(line.c_str() + at + 6, "%lu %d %d %31[^\n]", &us, &e.ID, &e.ARG, text) < 3)) {
+            continue;
+        }
+        e.US = (uint32_t)us;
+        e.TEXT = text;
+        events.push_back(e);
+    }
+    if (!found) {
+        fprintf(stderr, "%s: no TRACE DUMP header in the input\n", argv[0]);
+        return 1;
+    }
+    if (host_us < 0) {
+        host_us = (logged_us >= 0) ? logged_us : (long long)now_us;
+    }
+    convert(events, now_us, host_us);
+    fprintf(stderr, "%s: %zu events\n", argv[0], events.size());
+    return 0;
+}
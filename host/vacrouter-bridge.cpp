@@ -0,0 +1,765 @@
+/*  vacrouter-bridge.cpp - MQTT to Arduino bridge for the SmartShop Vacuum Router
+
+                Replaces vacrouter-mqtt.sh (and ardith.sh's job of holding the port open).  One process
+                keeps a single persistent MQTT session (QoS 1, clean session off) and the Arduino serial
+                port open, and waits on both in one epoll loop, so a stat/<tool>/POWER event is routed
+                the moment it arrives instead of whenever the next mosquitto_sub happens to be running.
+
+                Routing follows the script, with the tools arbitrated (arbiter.h) rather than each event
+                acted on alone, and each device's station looked up in the registry (registry.h) that
+                Tasmota discovery keeps up to date in --registry:
+                  stat/<topic>/POWER ON       MOVE GO<station> if the policy picks it, vacuum ON with the
+                                              first tool running
+                  stat/<topic>/POWER OFF      MOVE to the next running tool, if any.  --vac-delay seconds
+                                              later, once no tool is running or clearing, vacuum OFF and
+                                              MOVE GOCHOPSAW.
+                  tasmota/discovery/+/config  registry updated, and saved if anything changed
+                  positions, events, STATUS       stat/vacrouter/STATUS, see below
+                  events from the arm (event.h)   published to stat/vacrouter/EVENT as "<seq> <name> <arg>",
+                                                  a gap in the sequence logged and answered with STATUS
+                  every --stats-interval seconds  STATS, the reply published to stat/vacrouter/STATS as JSON
+                  cmnd/vacrouter/TRACE DUMP|CLEAR TRACE DUMP or CLEAR, the dump lands in this log for trace2chrome
+
+                stat/vacrouter/STATUS is one retained JSON object, published only when something in it
+                changed and at most once per pass of the event loop:
+                  {"STATE":"OK","POSITION":2,"TARGET":-1,"VACUUM":"ON","TOOL":"cnc"}
+                STATE is INIT, OK, MOVING, HOMING, UNKNOWN (position lost) or FAULT.  It is also the
+                last will, {"STATE":"OFFLINE"}, and is set to that on a clean shutdown too.
+
+                With --binary, commands go to the arm as frames (src/frame.h) with sequence numbers and
+                CRC, are resent until acked, and positions come back as frames instead of text.
+                Either way, from the arm's first line (or its reset banner) on, commands are sent only
+                as fast as the firmware hands out credit for them, see serial.h.
+
+    Usage:      vacrouter-bridge [--broker HOST] [--port N] [--console TTY] [--client-id ID]
+                                 [--vac-delay SECONDS] [--stats-interval SECONDS] [--priority STATION,..]
+                                 [--registry FILE] [--binary] [--quiet]
+                vacrouter-bridge --replay FILE [--vac-delay SECONDS] [--priority STATION,..] [--registry FILE]
+
+                --priority cnc,workbench serves the CNC over the workbench when both run, stations not
+                listed come after in the order their tools turned ON.  Without it the last tool ON wins.
+
+    Testing:    Against a local broker and a pty standing in for the Mega:
+                  mosquitto -p 1883 &
+                  socat -d -d pty,raw,echo=0,link=/tmp/vacr-arduino pty,raw,echo=0,link=/tmp/vacr-host &
+                  ./vacrouter-bridge --broker localhost --console /tmp/vacr-host &
+                  cat /tmp/vacr-arduino &                      # Commands the bridge sends to the arm
+                  echo "OK PPOS: 1 CPOS: 2" > /tmp/vacr-arduino
+                  echo "CREDIT 2 1" > /tmp/vacr-arduino        # Answer the bridge's CREDIT, or it holds HOME
+                  mosquitto_pub -t stat/cnc/POWER -m ON
+                  mosquitto_sub -v -t 'stat/vacrouter/#' -t 'cmnd/vacuum/#'
+
+                --replay runs a recorded event log through the arbiter on a simulated clock, no broker or
+                port needed, and prints what the bridge would have done.  One "<ms> <topic> <payload>"
+                per line, # comments, as recorded with:
+                  mosquitto_sub -v -t 'stat/+/POWER' | while read l; do echo "$(date +%s%3N) $l"; done
+                test/replay holds recorded sequences with the output they must give, make test runs them.
+*/
+#include "arbiter.h"
+#include "framelink.h"
+#include "mqtt.h"
+#include "registry.h"
+#include "serial.h"
+#include "timer_wheel.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// TIMINGS
+#define MQTT_RETRY_MS       2000    // Between broker reconnect attempts
+#define SERIAL_RETRY_MS     1000    // Between attempts to reopen the Arduino port
+#define TIMER_TICK_MS       100     // Timer wheel resolution...
+#define TIMER_SLOTS         64      // ...and buckets, one turn is 6.4 s
+
+#define PARK_TOOL           "chopsaw"   // Where the arm waits with the vacuum off
+#define REGISTRY_FILE       "/sdcard/vacrouter-devices.txt"
+
+// Stations a discovered topic of the same name is routed to.  Others are set in the registry file.
+static const char *STATION_TOPICS[] = { "cnc", "chopsaw", "workbench" };
+
+// MQTT topics, no leading slash
+#define TOPIC_POWER         "stat/+/POWER"              // Match all devices that report POWER state
+#define TOPIC_DISCOVERY     "tasmota/discovery/+/config"    // Retained, one per Tasmota device
+#define VAC_POWER_CMD       "cmnd/vacuum/POWER"
+#define VACR_STATUS_TOPIC   "stat/vacrouter/STATUS"     // Arm and vacuum state as retained JSON, also the will
+#define VACR_OFFLINE        "{\"STATE\":\"OFFLINE\"}"
+#define VACR_STATS_TOPIC    "stat/vacrouter/STATS"      // Arm's STATS counters, as JSON
+#define VACR_EVENT_TOPIC    "stat/vacrouter/EVENT"      // Arm's state change events, as they happen
+#define VACR_TRACE_CMD      "cmnd/vacrouter/TRACE"      // DUMP or CLEAR the arm's event trace
+
+static bool DEBUG = true;
+static volatile sig_atomic_t STOP_REQUESTED = 0;
+
+// arg1 = function name, arg2.. = printf style message, same format as the script's LOG
+static void LOG(const char *func, const char *fmt, ...) {
+    if (!DEBUG) {
+        return;
+    }
+    char when[64];
+    time_t now = time(0);
+    strftime(when, sizeof(when), "%a %b %e %H:%M:%S %Z %Y", localtime(&now));
+    printf("%s %s: ", when, func);
+    va_list ap;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n");
+    fflush(stdout);
+}
+
+// Wall clock, for lining a trace dump up with everything else logged on the host
+static uint64_t epoch_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static std::vector<std::string> split(const std::string &s, char sep) {
+    std::vector<std::string> parts;
+    std::string part;
+    std::istringstream in(s);
+    while (std::getline(in, part, sep)) {
+        parts.push_back(part);
+    }
+    return parts;
+}
+
+static std::vector<std::string> station_topics() {
+    size_t count = sizeof(STATION_TOPICS) / sizeof(STATION_TOPICS[0]);
+    return std::vector<std::string>(STATION_TOPICS, STATION_TOPICS + count);
+}
+
+static std::string station_command(const std::string &tool) {
+    std::string command = "MOVE GO";
+    for (size_t i = 0; i < tool.size(); i++) {
+        command += (char)toupper(tool[i]);
+    }
+    return command;
+}
+
+struct Config {
+    std::string BROKER;
+    int         PORT;
+    std::string CONSOLE;
+    std::string CLIENT_ID;
+    int         VAC_DELAY;      // Seconds to leave the vacuum on to clear the line
+    int         STATS_INTERVAL; // Seconds between STATS polls, 0 for none
+    bool        BINARY;         // Talk to the arm in frames rather than text lines
+    std::vector<std::string> PRIORITY;  // Stations first to last, empty for last ON wins
+    std::string REGISTRY;       // Device registry file
+
+    Config() : BROKER("192.168.2.1"), PORT(1883), CONSOLE("/dev/ttyACM0"), CLIENT_ID("vacrouter"), VAC_DELAY(2),
+               STATS_INTERVAL(300), BINARY(false), REGISTRY(REGISTRY_FILE) {}
+};
+
+class Bridge {
+  public:
+    explicit Bridge(const Config &cfg);
+    int run();
+
+  private:
+    void watch(int &registered, int fd, bool want_write);
+    void open_serial();
+    void handle_mqtt(const std::string &topic, const std::string &payload);
+    void handle_serial(const std::string &line);
+    void arm_position(int cpos);
+    void arm_status(int homing, int motion, int cpos);
+    void publish_status(bool force);
+    void publish_stats(const std::string &line);
+    void handle_event(uint16_t seq, uint8_t id, int arg);
+    void send_command(const std::string &command);
+    void tool_power(const std::string &device, const std::string &station, const std::string &state);
+    void device_discovered(const std::string &mac, const std::string &payload);
+    void run_timers();
+    int  next_timeout();
+
+    Config          CFG;
+    MqttClient      MQTT;
+    SerialPort      SERIAL;
+    FrameLink       LINK;
+    int             EPOLL_FD;
+    int             MQTT_WATCHED;
+    int             SERIAL_WATCHED;
+    uint64_t        NOW;
+    uint64_t        MQTT_RETRY_AT;
+    uint64_t        SERIAL_RETRY_AT;
+    TimerWheel      TIMERS;
+    ToolArbiter     ARBITER;
+    DeviceRegistry  DEVICES;
+    uint64_t        STATS_AT;           // Next STATS poll
+    bool            SEND_HOME;          // Home the arm on the first line after the port opens
+    bool            EVENT_SEEN;         // EVENT_SEQ holds the last event since the port opened
+    uint16_t        EVENT_SEQ;
+    unsigned long   EVENTS_MISSED;
+    unsigned long   CREDIT_LOST;        // SERIAL.credit_lost() as last logged
+    std::string     ARM_STATE;          // STATE in VACR_STATUS_TOPIC
+    int             ARM_POSITION;
+    int             ARM_TARGET;         // Station the arm is heading for, -1 when it isn't moving
+    bool            VACUUM_ON;
+    std::string     STATUS_PUBLISHED;   // Last payload sent, empty to send it again regardless
+};
+
+static MqttClient::Options mqtt_options(const Config &cfg) {
+    MqttClient::Options opts;
+    opts.HOST = cfg.BROKER;
+    opts.PORT = cfg.PORT;
+    opts.CLIENT_ID = cfg.CLIENT_ID;
+    opts.KEEPALIVE = 30;
+    opts.CLEAN_SESSION = false;     // Broker queues QoS 1 events for us across a reconnect
+    opts.WILL_TOPIC = VACR_STATUS_TOPIC;
+    opts.WILL_PAYLOAD = VACR_OFFLINE;
+    opts.WILL_QOS = 1;
+    opts.WILL_RETAIN = true;
+    return opts;
+}
+
+Bridge::Bridge(const Config &cfg)
+    : CFG(cfg), MQTT(mqtt_options(cfg)), LINK(SERIAL), EPOLL_FD(-1), MQTT_WATCHED(-1), SERIAL_WATCHED(-1), NOW(0),
+      MQTT_RETRY_AT(0), SERIAL_RETRY_AT(0), TIMERS(TIMER_TICK_MS, TIMER_SLOTS),
+      ARBITER(TIMERS, (uint32_t)cfg.VAC_DELAY * 1000, PARK_TOOL, cfg.PRIORITY), DEVICES(station_topics()),
+      STATS_AT(0), SEND_HOME(true),
+      EVENT_SEEN(false), EVENT_SEQ(0), EVENTS_MISSED(0), CREDIT_LOST(0), ARM_STATE("INIT"),
+      ARM_POSITION(-1), ARM_TARGET(-1), VACUUM_ON(false) {
+    MQTT.on_message([this](const std::string &topic, const std::string &payload, bool) {
+        handle_mqtt(topic, payload);
+    });
+    MQTT.on_connect([this](bool session_present) {
+        LOG("MQTT", "Connected to %s:%d%s", CFG.BROKER.c_str(), CFG.PORT, session_present ? ", session resumed" : "");
+        // The broker may have put the will in its place while we were away
+        STATUS_PUBLISHED.clear();
+    });
+    if (!DEVICES.load(CFG.REGISTRY)) {
+        LOG("INIT", "Can't read %s, routing by topic name until discovery saves it", CFG.REGISTRY.c_str());
+    }
+    LOG("INIT", "%d devices in %s", (int)DEVICES.size(), CFG.REGISTRY.c_str());
+    MQTT.subscribe(TOPIC_POWER, 1);
+    MQTT.subscribe(TOPIC_DISCOVERY, 1);
+    MQTT.subscribe(VACR_TRACE_CMD, 1);
+    ARBITER.on_vacuum([this](bool on) {
+        LOG("vacuum_POWER", "Vacuum %s, %d tool(s) holding it", on ? "ON" : "OFF", ARBITER.refs());
+        MQTT.publish(VAC_POWER_CMD, on ? "ON" : "OFF", 1, false);
+        VACUUM_ON = on;
+    });
+    ARBITER.on_serve([this](const std::string &tool) {
+        send_command(station_command(tool));
+    });
+    LINK.on_ack([](const std::string &command, uint8_t result) {
+        if (result == LINK_NO_ACK) {
+            LOG("SERIAL", "No ack from Arduino for %s, gave up", command.c_str());
+        } else if (result != FRAME_ACK_OK) {
+            LOG("SERIAL", "Arduino refused %s, result %d", command.c_str(), result);
+        }
+    });
+    LINK.on_position([this](const std::string &command, int ppos, int cpos) {
+        LOG("SERIAL", "OK PPOS: %d CPOS: %d (%s)", ppos, cpos, command.c_str());
+        arm_position(cpos);
+    });
+    LINK.on_event([this](uint16_t seq, uint8_t id, int arg) {
+        handle_event(seq, id, arg);
+    });
+    LINK.on_status([this](int homing, int step, int motion, int ppos, int cpos) {
+        LOG("SERIAL", "STATUS HOMING: %d STEP: %d MOTION: %d PPOS: %d CPOS: %d", homing, step, motion, ppos, cpos);
+        arm_status(homing, motion, cpos);
+    });
+}
+
+// Keep the epoll registration for one source in step with its current fd and write interest
+void Bridge::watch(int &registered, int fd, bool want_write) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = want_write ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    ev.data.fd = fd;
+    if ((registered >= 0) && (registered != fd)) {
+        epoll_ctl(EPOLL_FD, EPOLL_CTL_DEL, registered, 0);   // May already be gone with the closed fd
+        registered = -1;
+    }
+    if (fd < 0) {
+        return;
+    }
+    // A reconnect can hand back the same fd number, which closing removed from the set
+    if ((registered == fd) && (epoll_ctl(EPOLL_FD, EPOLL_CTL_MOD, fd, &ev) == 0)) {
+        return;
+    }
+    if (epoll_ctl(EPOLL_FD, EPOLL_CTL_ADD, fd, &ev) == 0) {
+        registered = fd;
+    }
+}
+
+void Bridge::open_serial() {
+    if (SERIAL.open_port(CFG.CONSOLE)) {
+        LOG("SERIAL", "Opened %s", CFG.CONSOLE.c_str());
+        LINK.reset();
+        SEND_HOME = true;
+        EVENT_SEEN = false;
+    } else {
+        SERIAL_RETRY_AT = NOW + SERIAL_RETRY_MS;
+    }
+}
+
+void Bridge::send_command(const std::string &command) {
+    if (!SERIAL.is_open()) {
+        LOG("SERIAL", "Arduino port is not open, dropped: %s", command.c_str());
+        return;
+    }
+    if (CFG.BINARY && LINK.send(command, NOW)) {
+        LOG("SERIAL", "Sent %s command to Arduino as a frame", command.c_str());
+        return;
+    }
+    if (!SERIAL.write_line(command)) {
+        LOG("SERIAL", "Arduino port is not open, dropped: %s", command.c_str());
+        return;
+    }
+    if (SERIAL.held()) {
+        LOG("SERIAL", "Holding %s command until the Arduino has room for it", command.c_str());
+        return;
+    }
+    LOG("SERIAL", "Sent %s command to Arduino", command.c_str());
+}
+
+void Bridge::handle_serial(const std::string &line) {
+    uint64_t received_us = epoch_us();
+    LOG("SERIAL", "%s", line.c_str());
+    if (line.compare(0, 19, "TRACE DUMP NOW_US: ") == 0) {
+        LOG("TRACE", "Dump header received at HOST_US: %llu", (unsigned long long)received_us);
+    }
+    // Home on the reset banner, or on the first line if we opened the port on a board that was already up.
+    // Either way the firmware isn't reporting credit yet, ask it to.
+    if (SEND_HOME || (line.compare(0, 4, "Vacr") == 0)) {
+        SEND_HOME = false;
+        SERIAL.start_credit();
+        send_command("HOME");
+    }
+    if (line.compare(0, 7, "OK PPOS") == 0) {
+        //0   1     2  3    4
+        //OK PPOS: -1 CPOS: 2
+        std::vector<std::string> fields = split(line, ' ');
+        if (fields.size() >= 5) {
+            arm_position(atoi(fields[4].c_str()));
+        }
+    }
+    if (line.compare(0, 15, "STATUS HOMING: ") == 0) {
+        //0      1        2 3     4 5       6 7     8  9     10
+        //STATUS HOMING: 5 STEP: 0 MOTION: 0 PPOS: 1 CPOS: 2
+        std::vector<std::string> fields = split(line, ' ');
+        if (fields.size() >= 11) {
+            arm_status(atoi(fields[2].c_str()), atoi(fields[6].c_str()), atoi(fields[10].c_str()));
+        }
+    }
+    if (line.compare(0, 11, "STATS UP_S:") == 0) {
+        publish_stats(line);
+    }
+    if (line.compare(0, 3, "EV ") == 0) {
+        //0  1   2  3
+        //EV 12  3  2
+        std::vector<std::string> fields = split(line, ' ');
+        if (fields.size() >= 4) {
+            handle_event((uint16_t)atoi(fields[1].c_str()), (uint8_t)atoi(fields[2].c_str()), atoi(fields[3].c_str()));
+        }
+    }
+}
+
+void Bridge::handle_event(uint16_t seq, uint8_t id, int arg) {
+    uint16_t missed = (uint16_t)(seq - EVENT_SEQ - 1);
+    if (EVENT_SEEN && missed && (seq != 1)) {
+        // Lost on the wire or while the port was reopened.  STATUS says where things stand now.
+        EVENTS_MISSED += missed;
+        LOG("EVENT", "Missed %u event(s) before %u, %lu in all, asking for STATUS", missed, seq, EVENTS_MISSED);
+        send_command("STATUS");
+    }
+    EVENT_SEEN = true;
+    EVENT_SEQ = seq;
+    switch (id) {
+        case EVENT_MOVE:
+            ARM_STATE = "MOVING";
+            ARM_TARGET = arg;
+            break;
+        case EVENT_HOME_STEP:
+            ARM_STATE = "HOMING";
+            ARM_TARGET = -1;
+            break;
+        case EVENT_ARRIVED:
+        case EVENT_TIMEOUT:
+        case EVENT_HOMED:
+            arm_position(arg);
+            break;
+        case EVENT_ABORT:
+            arm_position(-1);
+            break;
+        case EVENT_FAULT:
+            LOG("EVENT", "Arm reported fault %d", arg);
+            ARM_STATE = "FAULT";
+            ARM_TARGET = -1;
+            break;
+        default:
+            break;
+    }
+    char payload[40];
+    snprintf(payload, sizeof(payload), "%u %s %d", seq, event_name(id), arg);
+    MQTT.publish(VACR_EVENT_TOPIC, payload, 1, false);
+}
+
+// STATS KEY: 1 HIST: 0,2,1 ...  ->  {"KEY":1,"HIST":[0,2,1],...}
+void Bridge::publish_stats(const std::string &line) {
+    std::vector<std::string> fields = split(line, ' ');
+    std::string json = "{";
+    for (size_t i = 1; (i + 1) < fields.size(); i += 2) {
+        const std::string &key = fields[i];
+        if ((key.size() < 2) || (key[key.size() - 1] != ':')) {
+            LOG("STATS", "Unexpected field %s, not published", key.c_str());
+            return;
+        }
+        if (json.size() > 1) {
+            json += ",";
+        }
+        json += "\"" + key.substr(0, key.size() - 1) + "\":";
+        const std::string &value = fields[i + 1];
+        json += (value.find(',') != std::string::npos) ? "[" + value + "]" : value;
+    }
+    json += "}";
+    MQTT.publish(VACR_STATS_TOPIC, json, 1, false);
+}
+
+// The arm stopped, at cpos or -1 for lost
+void Bridge::arm_position(int cpos) {
+    ARM_POSITION = cpos;
+    ARM_TARGET = -1;
+    ARM_STATE = (cpos > 0) ? "OK" : "UNKNOWN";
+}
+
+// From a STATUS reply, after a gap in the events
+void Bridge::arm_status(int homing, int motion, int cpos) {
+    ARM_POSITION = cpos;
+    if ((homing >= 1) && (homing < 5)) {
+        ARM_STATE = "HOMING";
+    } else if (motion != 0) {
+        ARM_STATE = "MOVING";       // Target unknown, the next event fills it in
+    } else {
+        arm_position(cpos);
+    }
+}
+
+void Bridge::publish_status(bool force) {
+    if (!MQTT.connected()) {
+        return;     // Only the latest matters, on_connect sends it
+    }
+    char json[160];
+    snprintf(json, sizeof(json), "{\"STATE\":\"%s\",\"POSITION\":%d,\"TARGET\":%d,\"VACUUM\":\"%s\",\"TOOL\":\"%s\"}",
+             ARM_STATE.c_str(), ARM_POSITION, ARM_TARGET, VACUUM_ON ? "ON" : "OFF", ARBITER.serving().c_str());
+    if (!force && (STATUS_PUBLISHED == json)) {
+        return;
+    }
+    MQTT.publish(VACR_STATUS_TOPIC, json, 1, true);
+    STATUS_PUBLISHED = json;
+}
+
+void Bridge::tool_power(const std::string &device, const std::string &station, const std::string &state) {
+    if ((state != "ON") && (state != "OFF")) {
+        LOG("tool_power", "Invalid message (not ON or OFF) from %s: %s", device.c_str(), state.c_str());
+        return;
+    }
+    if ((state == "OFF") && ARBITER.running(device)) {
+        LOG("vacuum_POWER", "Clearing %s vacuum line for %d seconds", device.c_str(), CFG.VAC_DELAY);
+    }
+    ARBITER.power(device, station, state == "ON", NOW);
+}
+
+void Bridge::device_discovered(const std::string &mac, const std::string &payload) {
+    if (!DEVICES.discovered(mac, payload)) {
+        return;     // The broker hands every retained config over again on each connect
+    }
+    LOG("DISCOVERY", "Device %s changed, %d devices", mac.c_str(), (int)DEVICES.size());
+    if (!DEVICES.save(CFG.REGISTRY)) {
+        LOG("DISCOVERY", "Can't save %s: %s", CFG.REGISTRY.c_str(), strerror(errno));
+    }
+}
+
+void Bridge::handle_mqtt(const std::string &topic, const std::string &payload) {
+    std::vector<std::string> parts = split(topic, '/');
+    if (parts.size() < 3) {
+        return;
+    }
+    const std::string &device = parts[1];
+    const std::string &device_var = parts[2];
+    LOG("MON_TOPIC", "%s %s", topic.c_str(), payload.c_str());
+    if (topic == VACR_TRACE_CMD) {
+        if ((payload == "DUMP") || (payload == "CLEAR")) {
+            send_command("TRACE " + payload);
+        } else {
+            LOG("MON_TOPIC", "Invalid message (not DUMP or CLEAR) for %s: %s", topic.c_str(), payload.c_str());
+        }
+        return;
+    }
+    if ((parts.size() == 4) && (parts[0] == "tasmota") && (parts[1] == "discovery") && (parts[3] == "config")) {
+        device_discovered(parts[2], payload);
+        return;
+    }
+    std::string station = DEVICES.station(device);
+    if (!station.empty()) {
+        if (device_var == "POWER") {
+            tool_power(device, station, payload);
+        }
+    } else if (device != "vacuum") {
+        LOG("MON_TOPIC", "CASE: %s %s has no rules, fell through to wildcard.", topic.c_str(), payload.c_str());
+    }
+}
+
+void Bridge::run_timers() {
+    TIMERS.advance(NOW);
+    if (CFG.STATS_INTERVAL && SERIAL.is_open() && (NOW >= STATS_AT)) {
+        // A frame in --binary mode, so the firmware keeps reporting in frames.  The reply is text either way.
+        if (STATS_AT) {
+            send_command("STATS");
+        }
+        STATS_AT = NOW + (uint64_t)CFG.STATS_INTERVAL * 1000;
+    }
+    if (MQTT.idle() && (NOW >= MQTT_RETRY_AT)) {
+        if (!MQTT.connect()) {
+            MQTT_RETRY_AT = NOW + MQTT_RETRY_MS;
+        }
+    }
+    if (!SERIAL.is_open() && (NOW >= SERIAL_RETRY_AT)) {
+        open_serial();
+    }
+    if (!MQTT.tick(NOW)) {
+        MQTT_RETRY_AT = NOW + MQTT_RETRY_MS;
+    }
+    SERIAL.tick();
+    if (SERIAL.credit_lost() != CREDIT_LOST) {
+        LOG("SERIAL", "%lu command(s) never reached the Arduino, %lu in all", SERIAL.credit_lost() - CREDIT_LOST,
+            SERIAL.credit_lost());
+        CREDIT_LOST = SERIAL.credit_lost();
+    }
+    LINK.tick(NOW);
+}
+
+int Bridge::next_timeout() {
+    uint64_t due = NOW + 60000;
+    int mqtt = MQTT.next_timeout_ms(NOW);
+    if (mqtt >= 0) {
+        due = std::min(due, NOW + mqtt);
+    }
+    int link = LINK.next_timeout_ms(NOW);
+    if (link >= 0) {
+        due = std::min(due, NOW + link);
+    }
+    int serial = SERIAL.next_timeout_ms();
+    if (serial >= 0) {
+        due = std::min(due, NOW + serial);
+    }
+    int timers = TIMERS.next_timeout_ms(NOW);
+    if (timers >= 0) {
+        due = std::min(due, NOW + timers);
+    }
+    if (CFG.STATS_INTERVAL && SERIAL.is_open()) {
+        due = std::min(due, STATS_AT);
+    }
+    if (MQTT.idle()) {
+        due = std::min(due, MQTT_RETRY_AT);
+    }
+    if (!SERIAL.is_open()) {
+        due = std::min(due, SERIAL_RETRY_AT);
+    }
+    return (due <= NOW) ? 0 : (int)(due - NOW);
+}
+
+int Bridge::run() {
+    EPOLL_FD = epoll_create1(0);
+    if (EPOLL_FD < 0) {
+        perror("epoll_create1");
+        return 1;
+    }
+    LOG("INIT", "*** Vacrouter bridge v2.0 ***");
+    NOW = now_ms();
+    open_serial();
+
+    while (!STOP_REQUESTED) {
+        NOW = now_ms();
+        run_timers();
+        publish_status(false);
+        watch(MQTT_WATCHED, MQTT.fd(), MQTT.wants_write());
+        watch(SERIAL_WATCHED, SERIAL.fd(), SERIAL.wants_write());
+
+        struct epoll_event events[4];
+        int n = epoll_wait(EPOLL_FD, events, 4, next_timeout());
+        if ((n < 0) && (errno != EINTR)) {
+            perror("epoll_wait");
+            return 1;
+        }
+        NOW = now_ms();
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            bool readable = events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR);
+            bool writable = events[i].events & EPOLLOUT;
+            if (fd == MQTT.fd()) {
+                MQTT.tick(NOW);
+                if ((writable && !MQTT.on_writable()) || (readable && !MQTT.on_readable())) {
+                    LOG("MQTT", "Lost broker connection, retrying");
+                    MQTT_RETRY_AT = NOW + MQTT_RETRY_MS;
+                }
+            } else if (fd == SERIAL.fd()) {
+                std::vector<std::string> lines;
+                std::vector<FRAME> frames;
+                bool ok = SERIAL.read_lines(lines, &frames) && (!writable || SERIAL.on_writable());
+                for (size_t l = 0; l < lines.size(); l++) {
+                    handle_serial(lines[l]);
+                }
+                for (size_t f = 0; f < frames.size(); f++) {
+                    LINK.on_frame(frames[f], NOW);
+                }
+                if (!ok) {
+                    LOG("SERIAL", "Lost %s, reopening", CFG.CONSOLE.c_str());
+                    SERIAL_RETRY_AT = NOW + SERIAL_RETRY_MS;
+                }
+            }
+        }
+    }
+    LOG("INIT", "Shutting down");
+    if (MQTT.connected()) {
+        MQTT.publish(VACR_STATUS_TOPIC, VACR_OFFLINE, 1, true);    // A clean disconnect doesn't send the will
+    }
+    MQTT.disconnect();
+    SERIAL.close_port();
+    close(EPOLL_FD);
+    return 0;
+}
+
+static void on_signal(int sig) {
+    (void)sig;
+    STOP_REQUESTED = 1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--broker HOST] [--port N] [--console TTY] [--client-id ID]\n"
+                    "          [--vac-delay SECONDS] [--stats-interval SECONDS] [--priority STATION,..]\n"
+                    "          [--registry FILE] [--binary] [--quiet]\n"
+                    "       %s --replay FILE [--vac-delay SECONDS] [--priority STATION,..] [--registry FILE]\n",
+            prog, prog);
+}
+
+// Run a recorded POWER event log through the arbiter, printing "<ms> <action>" from the first event
+static int replay(const Config &cfg, const std::string &path) {
+    std::ifstream in(path.c_str());
+    if (!in) {
+        fprintf(stderr, "Can't read %s\n", path.c_str());
+        return 1;
+    }
+    // No registry to hand is fine here, the seeded one routes each station's own topic
+    DeviceRegistry devices(station_topics());
+    if (!devices.load(cfg.REGISTRY)) {
+        fprintf(stderr, "Can't read %s, using the station names as topics\n", cfg.REGISTRY.c_str());
+    }
+    TimerWheel timers(TIMER_TICK_MS, TIMER_SLOTS);
+    ToolArbiter arbiter(timers, (uint32_t)cfg.VAC_DELAY * 1000, PARK_TOOL, cfg.PRIORITY);
+    uint64_t start = 0;
+    uint64_t now = 0;
+    arbiter.on_vacuum([&](bool on) {
+        printf("%llu VACUUM %s\n", (unsigned long long)(now - start), on ? "ON" : "OFF");
+    });
+    arbiter.on_serve([&](const std::string &tool) {
+        printf("%llu %s\n", (unsigned long long)(now - start), station_command(tool).c_str());
+    });
+
+    std::string line;
+    int line_no = 0;
+    bool first = true;
+    while (std::getline(in, line)) {
+        line_no++;
+        std::vector<std::string> fields = split(line, ' ');
+        if (fields.empty() || fields[0].empty() || (fields[0][0] == '#')) {
+            continue;
+        }
+        std::vector<std::string> parts = (fields.size() == 3) ? split(fields[1], '/') : std::vector<std::string>();
+        if ((parts.size() != 3) || (parts[2] != "POWER") || ((fields[2] != "ON") && (fields[2] != "OFF"))) {
+            fprintf(stderr, "%s:%d: expected <ms> stat/<tool>/POWER ON|OFF\n", path.c_str(), line_no);
+            return 1;
+        }
+        uint64_t at = strtoull(fields[0].c_str(), 0, 10);
+        if (first) {
+            start = now = at;
+            first = false;
+        }
+        // Everything due before the event happens first, as it would have live
+        while ((now < at) && timers.size()) {
+            int wait = timers.next_timeout_ms(now);
+            now = ((wait < 0) || (now + wait > at)) ? at : now + wait;
+            timers.advance(now);
+        }
+        now = std::max(now, at);
+        std::string station = devices.station(parts[1]);
+        if (!station.empty()) {
+            arbiter.power(parts[1], station, fields[2] == "ON", now);
+        }
+    }
+    while (timers.size()) {
+        now += std::max(timers.next_timeout_ms(now), 0);
+        timers.advance(now);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    Config cfg;
+    std::string replay_file;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = (i + 1) < argc;
+        if ((arg == "--broker") && has_value) {
+            cfg.BROKER = argv[++i];
+        } else if ((arg == "--port") && has_value) {
+            cfg.PORT = atoi(argv[++i]);
+        } else if ((arg == "--console") && has_value) {
+            cfg.CONSOLE = argv[++i];
+        } else if ((arg == "--client-id") && has_value) {
+            cfg.CLIENT_ID = argv[++i];
+        } else if ((arg == "--vac-delay") && has_value) {
+            cfg.VAC_DELAY = atoi(argv[++i]);
+        } else if ((arg == "--stats-interval") && has_value) {
+            cfg.STATS_INTERVAL = atoi(argv[++i]);
+        } else if ((arg == "--priority") && has_value) {
+            cfg.PRIORITY = split(argv[++i], ',');
+        } else if ((arg == "--registry") && has_value) {
+            cfg.REGISTRY = argv[++i];
+        } else if ((arg == "--replay") && has_value) {
+            replay_file = argv[++i];
+        } else if (arg == "--binary") {
+            cfg.BINARY = true;
+        } else if (arg == "--quiet") {
+            DEBUG = false;
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (!replay_file.empty()) {
+        return replay(cfg, replay_file);
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, 0);
+    sigaction(SIGTERM, &sa, 0);
+    signal(SIGPIPE, SIG_IGN);
+
+    Bridge bridge(cfg);
+    return bridge.run();
+}
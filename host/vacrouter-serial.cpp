@@ -0,0 +1,660 @@
+/*  vacrouter-serial.cpp - Serial port broker for the Vacuum Router, one owner for the Mega's port
+
+                Replaces ardith.sh holding the port open while scripts write to it with echo, which let
+                two writers interleave, paired no answer with its command and never noticed the USB CDC
+                device going away.  This daemon owns the port: it sets it up once (as the stty line did,
+                and with HUPCL off so closing or reopening it doesn't reset the Mega), takes command
+                lines from any number of local clients on a Unix socket, and sends them to the arm one
+                at a time.
+
+                Client protocol, one line each way:
+                  SUB                 every line from the arm from now on, as "LINE <text>", binary
+                                      frames as "FRAME <op> <seq> <payload bytes>", and "PORT UP" or
+                                      "PORT DOWN" when the port comes and goes.  Answered "OK SUB".
+                  <anything else>     a command for the arm, queued behind other clients' commands.
+                                      The firmware echoes each command line as it reads it, so the
+                                      client gets "ACK <command>" when the echo arrives, "REPLY <text>"
+                                      for each line in the next --reply-ms after that, then "DONE".
+                                      "ERR <reason>" instead if the port is down, closes, or the echo
+                                      doesn't come within ECHO_TIMEOUT_MS.
+                Lines in a reply window go to subscribers as well, so a client watching positions and
+                events sees everything whoever asked for it.
+
+                The shell scripts can't open a Unix socket themselves, so the same binary is their client:
+                --send COMMAND prints the answer lines through DONE (exit 0) or ERR (exit 1), and --sub
+                prints every line a subscriber gets until the daemon goes away (exit 1).
+
+                The port's directory is watched with inotify, so a Mega that re-enumerates is reopened
+                the moment its device node (or a udev symlink to it) reappears, not on the next retry.
+                Commands still queued when the port closes fail rather than run on a board that has
+                just reset.  Commands also wait for the firmware's credit (serial.h), asked for when the
+                port opens and again when the reset banner shows the board restarted.
+
+    Usage:      vacrouter-serial [--console TTY] [--socket PATH] [--reply-ms MS] [--quiet]
+                vacrouter-serial [--socket PATH] --send COMMAND | --sub
+
+    Testing:    make test runs test/test_serial_broker, which checks the pairing, SUB, the credit hold,
+                the port dropping and coming back against a pty pair.  By hand, with socat:
+                  socat -d -d pty,raw,echo=0,link=/tmp/vacr-arduino pty,raw,echo=0,link=/tmp/vacr-host &
+                  ./vacrouter-serial --console /tmp/vacr-host --socket /tmp/vacr.sock &
+                  socat - UNIX-CONNECT:/tmp/vacr.sock          # Type SUB, or a command like STATUS
+                  cat /tmp/vacr-arduino                         # What the arm would be sent
+                  echo "CREDIT 1 1" > /tmp/vacr-arduino         # Credit for one command
+                  echo "STATUS" > /tmp/vacr-arduino             # Answer as the arm, starting with the echo
+                Kill and restart the first socat to see the port go down and come straight back.
+*/
+#include "serial.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+// TIMINGS
+#define SERIAL_RETRY_MS     1000    // Reopen attempts when inotify has nothing to say, e.g. a permission fix
+#define ECHO_TIMEOUT_MS     1000    // The firmware echoes a command as soon as it reads it
+#define REPLY_WINDOW_MS     150     // Default --reply-ms, STATUS and STATS answer well inside this
+
+#define CLIENT_MAX_LINE     256     // Longer and the client is sent ERR and dropped
+#define CLIENT_MAX_OUT      65536   // A subscriber this far behind is dropped rather than buffered forever
+
+static bool DEBUG = true;
+static volatile sig_atomic_t STOP_REQUESTED = 0;
+
+// arg1 = function name, arg2.. = printf style message, the same format as the bridge's log
+static void LOG(const char *func, const char *fmt, ...) {
+    if (!DEBUG) {
+        return;
+    }
+    char when[64];
+    time_t now = time(0);
+    strftime(when, sizeof(when), "%a %b %e %H:%M:%S %Z %Y", localtime(&now));
+    printf("%s %s: ", when, func);
+    va_list ap;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n");
+    fflush(stdout);
+}
+
+static uint64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+struct Config {
+    std::string CONSOLE;
+    std::string SOCKET;
+    int         REPLY_MS;
+
+    Config() : CONSOLE("/dev/ttyACM0"), SOCKET("/tmp/vacrouter-serial.sock"), REPLY_MS(REPLY_WINDOW_MS) {}
+};
+
+class Broker {
+  public:
+    explicit Broker(const Config &cfg);
+    int run();
+
+  private:
+    struct Client {
+        std::string IN;
+        std::string OUT;
+        bool        SUBSCRIBED;
+
+        Client() : SUBSCRIBED(false) {}
+    };
+
+    struct Request {
+        int         CLIENT;     // -1 once the client has gone, the command still runs
+        std::string COMMAND;
+    };
+
+    enum { IDLE, WAIT_ECHO, WAIT_REPLY };
+
+    bool listen_socket();
+    void watch_console();
+    void open_serial();
+    void serial_lost();
+    void accept_clients();
+    void client_readable(int fd);
+    void client_writable(int fd);
+    void client_close(int fd);
+    void client_line(int fd, const std::string &line);
+    void send(int fd, const std::string &line);
+    void broadcast(const std::string &line);
+    void port_line(const std::string &line);
+    void port_frame(const FRAME &frame);
+    void finish(const char *error);
+    void run_queue();
+    int  next_timeout();
+    void epoll_set(int fd, uint32_t events, bool add);
+
+    Config          CFG;
+    SerialPort      SERIAL;
+    int             EPOLL_FD;
+    int             LISTEN_FD;
+    int             INOTIFY_FD;
+    int             SERIAL_WATCHED;
+    bool            SERIAL_WANTS_WRITE;
+    std::string     CONSOLE_NAME;       // basename of CFG.CONSOLE, for matching inotify events
+    uint64_t        NOW;
+    uint64_t        SERIAL_RETRY_AT;
+    std::map<int, Client> CLIENTS;
+    std::deque<Request>   QUEUE;        // Front is the command in progress when STATE isn't IDLE
+    int             STATE;
+    uint64_t        DEADLINE;           // End of the echo wait or reply window
+};
+
+Broker::Broker(const Config &cfg)
+    : CFG(cfg), EPOLL_FD(-1), LISTEN_FD(-1), INOTIFY_FD(-1), SERIAL_WATCHED(-1), SERIAL_WANTS_WRITE(false), NOW(0),
+      SERIAL_RETRY_AT(0), STATE(IDLE), DEADLINE(0) {
+    std::string path = CFG.CONSOLE;
+    CONSOLE_NAME = basename(&path[0]);
+}
+
+void Broker::epoll_set(int fd, uint32_t events, bool add) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+    epoll_ctl(EPOLL_FD, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev);
+}
+
+bool Broker::listen_socket() {
+    LISTEN_FD = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (LISTEN_FD < 0) {
+        perror("socket");
+        return false;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (CFG.SOCKET.size() >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", CFG.SOCKET.c_str());
+        return false;
+    }
+    strcpy(addr.sun_path, CFG.SOCKET.c_str());
+    unlink(addr.sun_path);      // Left behind by a daemon that didn't shut down cleanly
+    if ((bind(LISTEN_FD, (struct sockaddr *)&addr, sizeof(addr)) < 0) || (listen(LISTEN_FD, 8) < 0)) {
+        perror(CFG.SOCKET.c_str());
+        return false;
+    }
+    chmod(addr.sun_path, 0660);
+    epoll_set(LISTEN_FD, EPOLLIN, true);
+    return true;
+}
+
+// Watch the directory, not the node: the node is gone while the Mega is away
+void Broker::watch_console() {
+    std::string path = CFG.CONSOLE;
+    std::string dir = dirname(&path[0]);
+    INOTIFY_FD = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if ((INOTIFY_FD < 0) || (inotify_add_watch(INOTIFY_FD, dir.c_str(), IN_CREATE | IN_ATTRIB | IN_MOVED_TO) < 0)) {
+        LOG("SERIAL", "Can't watch %s (%s), retrying every %d ms instead", dir.c_str(), strerror(errno),
+            SERIAL_RETRY_MS);
+        if (INOTIFY_FD >= 0) {
+            close(INOTIFY_FD);
+            INOTIFY_FD = -1;
+        }
+        return;
+    }
+    epoll_set(INOTIFY_FD, EPOLLIN, true);
+}
+
+void Broker::open_serial() {
+    if (!SERIAL.open_port(CFG.CONSOLE, false)) {
+        SERIAL_RETRY_AT = NOW + SERIAL_RETRY_MS;
+        return;
+    }
+    LOG("SERIAL", "Opened %s", CFG.CONSOLE.c_str());
+    SERIAL_WATCHED = SERIAL.fd();
+    SERIAL_WANTS_WRITE = false;
+    epoll_set(SERIAL_WATCHED, EPOLLIN, true);
+    SERIAL.start_credit();      // Lost if the board is still in its bootloader, then the banner asks again
+    broadcast("PORT UP");
+}
+
+void Broker::serial_lost() {
+    LOG("SERIAL", "Lost %s, waiting for it to come back", CFG.CONSOLE.c_str());
+    SERIAL.close_port();    // Closing the fd took it out of the epoll set
+    SERIAL_WATCHED = -1;
+    SERIAL_RETRY_AT = NOW + SERIAL_RETRY_MS;
+    if (STATE != IDLE) {
+        finish("port closed");
+    }
+    // Whatever a client queued for the board that went away shouldn't run on the one that comes back
+    while (!QUEUE.empty()) {
+        if (QUEUE.front().CLIENT >= 0) {
+            send(QUEUE.front().CLIENT, "ERR port closed");
+        }
+        QUEUE.pop_front();
+    }
+    broadcast("PORT DOWN");
+}
+
+void Broker::accept_clients() {
+    for (;;) {
+        int fd = accept4(LISTEN_FD, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        CLIENTS[fd] = Client();
+        epoll_set(fd, EPOLLIN, true);
+    }
+}
+
+void Broker::client_close(int fd) {
+    close(fd);
+    CLIENTS.erase(fd);
+    // Queued commands go with the client, the one already on the wire finishes unheard
+    for (std::deque<Request>::iterator it = QUEUE.begin(); it != QUEUE.end();) {
+        if (it->CLIENT != fd) {
+            ++it;
+        } else if ((it == QUEUE.begin()) && (STATE != IDLE)) {
+            it->CLIENT = -1;
+            ++it;
+        } else {
+            it = QUEUE.erase(it);
+        }
+    }
+}
+
+void Broker::client_readable(int fd) {
+    char buf[512];
+    for (;;) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n == 0) {
+            client_close(fd);
+            return;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                client_close(fd);
+            }
+            return;
+        }
+        CLIENTS[fd].IN.append(buf, n);
+        std::string &in = CLIENTS[fd].IN;
+        size_t eol;
+        while ((eol = in.find('\n')) != std::string::npos) {
+            std::string line = in.substr(0, eol);
+            in.erase(0, eol + 1);
+            line.erase(std::remove(line.begin(), line.end(), '\r'), line.end());
+            client_line(fd, line);
+            if (!CLIENTS.count(fd)) {
+                return;
+            }
+        }
+        if (in.size() > CLIENT_MAX_LINE) {
+            send(fd, "ERR line too long");
+            client_close(fd);
+            return;
+        }
+    }
+}
+
+void Broker::client_line(int fd, const std::string &line) {
+    if (line.empty()) {
+        return;
+    }
+    if (line == "SUB") {
+        CLIENTS[fd].SUBSCRIBED = true;
+        send(fd, "OK SUB");
+        send(fd, SERIAL.is_open() ? "PORT UP" : "PORT DOWN");
+        return;
+    }
+    if (!SERIAL.is_open()) {
+        send(fd, "ERR port closed");
+        return;
+    }
+    Request request;
+    request.CLIENT = fd;
+    request.COMMAND = line;
+    QUEUE.push_back(request);
+}
+
+void Broker::send(int fd, const std::string &line) {
+    std::map<int, Client>::iterator it = CLIENTS.find(fd);
+    if (it == CLIENTS.end()) {
+        return;
+    }
+    std::string &out = it->second.OUT;
+    bool was_empty = out.empty();
+    out += line;
+    out += '\n';
+    if (out.size() > CLIENT_MAX_OUT) {
+        LOG("CLIENT", "Client %d isn't reading, dropped", fd);
+        client_close(fd);
+        return;
+    }
+    if (was_empty) {
+        epoll_set(fd, EPOLLIN | EPOLLOUT, false);
+    }
+}
+
+void Broker::client_writable(int fd) {
+    std::string &out = CLIENTS[fd].OUT;
+    while (!out.empty()) {
+        ssize_t n = write(fd, out.data(), out.size());
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                client_close(fd);
+            }
+            return;
+        }
+        out.erase(0, n);
+    }
+    epoll_set(fd, EPOLLIN, false);
+}
+
+void Broker::broadcast(const std::string &line) {
+    std::vector<int> subscribers;
+    for (std::map<int, Client>::iterator it = CLIENTS.begin(); it != CLIENTS.end(); ++it) {
+        if (it->second.SUBSCRIBED) {
+            subscribers.push_back(it->first);
+        }
+    }
+    for (size_t i = 0; i < subscribers.size(); i++) {
+        send(subscribers[i], line);     // May drop a slow one, hence the copy
+    }
+}
+
+void Broker::port_line(const std::string &line) {
+    broadcast("LINE " + line);
+    if (line.compare(0, 4, "Vacr") == 0) {
+        SERIAL.start_credit();  // Reset banner, the firmware has forgotten it was asked
+    }
+    if (QUEUE.empty() || (STATE == IDLE)) {
+        return;
+    }
+    Request &request = QUEUE.front();
+    if (STATE == WAIT_ECHO) {
+        if (line != request.COMMAND) {
+            return;     // Something the arm was already saying
+        }
+        send(request.CLIENT, "ACK " + request.COMMAND);
+        STATE = WAIT_REPLY;
+        DEADLINE = NOW + CFG.REPLY_MS;
+        return;
+    }
+    send(request.CLIENT, "REPLY " + line);
+    DEADLINE = NOW + CFG.REPLY_MS;      // Multi-line answers (TRACE DUMP) keep the window open
+}
+
+void Broker::port_frame(const FRAME &frame) {
+    char line[16 + 4 * FRAME_MAX_PAYLOAD];
+    int n = snprintf(line, sizeof(line), "FRAME %u %u", frame.OP, frame.SEQ);
+    for (uint8_t i = 0; i < frame.LEN; i++) {
+        n += snprintf(line + n, sizeof(line) - n, " %u", frame.PAYLOAD[i]);
+    }
+    broadcast(line);
+}
+
+// The command in progress is over, error is 0 for DONE
+void Broker::finish(const char *error) {
+    Request &request = QUEUE.front();
+    if (error) {
+        LOG("SERIAL", "%s: %s", request.COMMAND.c_str(), error);
+        send(request.CLIENT, std::string("ERR ") + error);
+    } else {
+        send(request.CLIENT, "DONE");
+    }
+    QUEUE.pop_front();
+    STATE = IDLE;
+}
+
+void Broker::run_queue() {
+    if ((STATE == WAIT_ECHO) && (NOW >= DEADLINE)) {
+        finish("no echo");
+    } else if ((STATE == WAIT_REPLY) && (NOW >= DEADLINE)) {
+        finish(0);
+    }
+    // Held for credit here, not in the port, so the echo timeout starts when the command goes out
+    if ((STATE != IDLE) || QUEUE.empty() || !SERIAL.is_open() ||
+        (!SERIAL.can_send() && (QUEUE.front().COMMAND != "MOVE STOP"))) {
+        return;
+    }
+    LOG("SERIAL", "Sent %s command to Arduino", QUEUE.front().COMMAND.c_str());
+    if (!SERIAL.write_line(QUEUE.front().COMMAND)) {
+        serial_lost();
+        return;
+    }
+    STATE = WAIT_ECHO;
+    DEADLINE = NOW + ECHO_TIMEOUT_MS;
+}
+
+int Broker::next_timeout() {
+    uint64_t due = NOW + 60000;
+    if (STATE != IDLE) {
+        due = std::min(due, DEADLINE);
+    } else if (!QUEUE.empty() && SERIAL.is_open() && SERIAL.can_send()) {
+        due = NOW;
+    }
+    if (!SERIAL.is_open()) {
+        due = std::min(due, SERIAL_RETRY_AT);
+    } else if (SERIAL.next_timeout_ms() >= 0) {
+        due = std::min(due, NOW + SERIAL.next_timeout_ms());
+    }
+    return (due <= NOW) ? 0 : (int)(due - NOW);
+}
+
+int Broker::run() {
+    EPOLL_FD = epoll_create1(EPOLL_CLOEXEC);
+    if ((EPOLL_FD < 0) || !listen_socket()) {
+        return 1;
+    }
+    LOG("INIT", "*** Vacrouter serial broker, %s on %s ***", CFG.CONSOLE.c_str(), CFG.SOCKET.c_str());
+    watch_console();
+    NOW = now_ms();
+    open_serial();
+
+    while (!STOP_REQUESTED) {
+        NOW = now_ms();
+        if (!SERIAL.is_open() && (NOW >= SERIAL_RETRY_AT)) {
+            open_serial();
+        }
+        SERIAL.tick();
+        run_queue();
+        if (SERIAL.is_open() && (SERIAL.wants_write() != SERIAL_WANTS_WRITE)) {
+            SERIAL_WANTS_WRITE = SERIAL.wants_write();
+            epoll_set(SERIAL_WATCHED, SERIAL_WANTS_WRITE ? (EPOLLIN | EPOLLOUT) : EPOLLIN, false);
+        }
+
+        struct epoll_event events[16];
+        int n = epoll_wait(EPOLL_FD, events, 16, next_timeout());
+        if ((n < 0) && (errno != EINTR)) {
+            perror("epoll_wait");
+            return 1;
+        }
+        NOW = now_ms();
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == LISTEN_FD) {
+                accept_clients();
+            } else if (fd == INOTIFY_FD) {
+                char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+                ssize_t len;
+                bool ours = false;
+                while ((len = read(INOTIFY_FD, buf, sizeof(buf))) > 0) {
+                    for (char *p = buf; p < buf + len;) {
+                        struct inotify_event *ev = (struct inotify_event *)p;
+                        ours |= (ev->len > 0) && (CONSOLE_NAME == ev->name);
+                        p += sizeof(struct inotify_event) + ev->len;
+                    }
+                }
+                if (ours && !SERIAL.is_open()) {
+                    open_serial();      // udev may not have set permissions yet, IN_ATTRIB brings us back
+                }
+            } else if ((fd == SERIAL_WATCHED) && SERIAL.is_open()) {
+                std::vector<std::string> lines;
+                std::vector<FRAME> frames;
+                bool ok = SERIAL.read_lines(lines, &frames);
+                if (ok && (events[i].events & EPOLLOUT)) {
+                    ok = SERIAL.on_writable();
+                }
+                for (size_t l = 0; l < lines.size(); l++) {
+                    port_line(lines[l]);
+                }
+                for (size_t f = 0; f < frames.size(); f++) {
+                    port_frame(frames[f]);
+                }
+                if (!ok || (events[i].events & (EPOLLHUP | EPOLLERR))) {
+                    serial_lost();
+                }
+            } else if (CLIENTS.count(fd)) {
+                if (events[i].events & EPOLLOUT) {
+                    client_writable(fd);
+                }
+                if (CLIENTS.count(fd) && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                    client_readable(fd);
+                }
+            }
+        }
+    }
+    LOG("INIT", "Shutting down");
+    for (std::map<int, Client>::iterator it = CLIENTS.begin(); it != CLIENTS.end(); ++it) {
+        close(it->first);
+    }
+    SERIAL.close_port();
+    close(LISTEN_FD);
+    unlink(CFG.SOCKET.c_str());
+    close(EPOLL_FD);
+    return 0;
+}
+
+// Client side, for the scripts.  Blocking is fine here, there is nothing else to do.
+static int client_connect(const std::string &path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if ((fd < 0) || (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)) {
+        perror(path.c_str());
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+// Send one line, then print what comes back until a line done() accepts.  Exit status 0 if it said so.
+static int client_run(const Config &cfg, const std::string &line, bool (*done)(const std::string &, bool *)) {
+    int fd = client_connect(cfg.SOCKET);
+    if (fd < 0) {
+        return 1;
+    }
+    std::string out = line + "\n";
+    if (write(fd, out.data(), out.size()) != (ssize_t)out.size()) {
+        perror("write");
+        close(fd);
+        return 1;
+    }
+    std::string in;
+    char buf[512];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        in.append(buf, n);
+        size_t eol;
+        while ((eol = in.find('\n')) != std::string::npos) {
+            std::string reply = in.substr(0, eol);
+            in.erase(0, eol + 1);
+            printf("%s\n", reply.c_str());
+            fflush(stdout);
+            bool ok;
+            if (done(reply, &ok)) {
+                close(fd);
+                return ok ? 0 : 1;
+            }
+        }
+    }
+    close(fd);
+    return 1;       // The daemon went away
+}
+
+static bool send_done(const std::string &reply, bool *ok) {
+    *ok = (reply == "DONE");
+    return *ok || (reply.compare(0, 4, "ERR ") == 0);
+}
+
+static bool sub_done(const std::string &, bool *) {
+    return false;
+}
+
+static void on_signal(int sig) {
+    (void)sig;
+    STOP_REQUESTED = 1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--console TTY] [--socket PATH] [--reply-ms MS] [--quiet]\n"
+                    "       %s [--socket PATH] --send COMMAND | --sub\n", prog, prog);
+}
+
+int main(int argc, char **argv) {
+    Config cfg;
+    std::string send_command;
+    bool sub = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = (i + 1) < argc;
+        if ((arg == "--console") && has_value) {
+            cfg.CONSOLE = argv[++i];
+        } else if ((arg == "--socket") && has_value) {
+            cfg.SOCKET = argv[++i];
+        } else if ((arg == "--reply-ms") && has_value) {
+            cfg.REPLY_MS = atoi(argv[++i]);
+        } else if (arg == "--quiet") {
+            DEBUG = false;
+        } else if ((arg == "--send") && has_value) {
+            send_command = argv[++i];
+        } else if (arg == "--sub") {
+            sub = true;
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (!send_command.empty()) {
+        return client_run(cfg, send_command, send_done);
+    }
+    if (sub) {
+        return client_run(cfg, "SUB", sub_done);
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, 0);
+    sigaction(SIGTERM, &sa, 0);
+    signal(SIGPIPE, SIG_IGN);
+
+    Broker broker(cfg);
+    return broker.run();
+}
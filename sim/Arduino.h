@@ -0,0 +1,139 @@
+/*  Arduino.h - Thin host-side HAL so src/main.cpp builds for the [env:native] simulator
+
+                Only the parts of the Arduino core the vacrouter firmware actually uses are provided.
+                Time is virtual: millis()/micros() read the simulator clock and delay() advances it,
+                stepping the simulated rail (see sim.h) and firing the attached pin-change ISR on sensor edges.
+*/
+#ifndef VACROUTER_SIM_ARDUINO_H
+#define VACROUTER_SIM_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string>
+
+typedef bool    boolean;
+typedef uint8_t byte;
+
+#define HIGH          1
+#define LOW           0
+
+#define INPUT         0
+#define OUTPUT        1
+#define INPUT_PULLUP  2
+
+#define CHANGE        1
+#define FALLING       2
+#define RISING        3
+
+#define DEC           10
+#define HEX           16
+
+#define NOT_AN_INTERRUPT -1
+
+// Time
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+// GPIO
+void pinMode(uint8_t pin, uint8_t mode);
+int  digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t val);
+void analogWrite(uint8_t pin, int val);
+
+// Interrupts
+int  digitalPinToInterrupt(uint8_t pin);
+void attachInterrupt(uint8_t interruptNum, void (*isr)(), int mode);
+void detachInterrupt(uint8_t interruptNum);
+void noInterrupts();
+void interrupts();
+
+// Program memory, flash and RAM are one address space here
+#define PROGMEM
+#define PSTR(s)                    (s)
+#define pgm_read_byte(addr)        (*(const uint8_t *)(addr))
+#define pgm_read_word(addr)        (*(const uint16_t *)(addr))
+#define memcpy_P(dest, src, n)     memcpy((dest), (src), (n))
+#define strncmp_P(a, b, n)         strncmp((a), (b), (n))
+#define strncpy_P(d, s, n)         strncpy((d), (s), (n))
+#define strcpy_P(d, s)             strcpy((d), (s))
+#define strcat_P(d, s)             strcat((d), (s))
+
+// avr-libc's stdlib extras
+static inline char *ltoa(long value, char *buf, int radix) {
+    snprintf(buf, 12, (radix == 16) ? "%lx" : "%ld", value);
+    return buf;
+}
+
+// Minimal Arduino String over std::string
+class String {
+  public:
+    String() {}
+    String(const char *s) : str(s ? s : "") {}
+    String(const std::string &s) : str(s) {}
+    String(char c) : str(1, c) {}
+    String(int v) : str(std::to_string(v)) {}
+    String(long v) : str(std::to_string(v)) {}
+    String(unsigned long v) : str(std::to_string(v)) {}
+
+    const char *c_str() const { return str.c_str(); }
+    unsigned int length() const { return str.length(); }
+    char operator[](unsigned int i) const { return str[i]; }
+
+    String &operator=(const char *s) { str = s ? s : ""; return *this; }
+    String &operator+=(const String &s) { str += s.str; return *this; }
+    String &operator+=(const char *s) { str += s; return *this; }
+    String &operator+=(char c) { str += c; return *this; }
+
+    friend String operator+(const String &a, const String &b) { return String(a.str + b.str); }
+    friend String operator+(const String &a, const char *b) { return String(a.str + b); }
+    friend String operator+(const String &a, char c) { return String(a.str + c); }
+
+    bool operator==(const String &o) const { return str == o.str; }
+    bool operator==(const char *s) const { return s && str == s; }
+    bool operator!=(const String &o) const { return str != o.str; }
+    bool operator!=(const char *s) const { return !(*this == s); }
+
+  private:
+    std::string str;
+};
+
+#define SERIAL_TX_BUFFER_SIZE 64    // As the AVR core's HardwareSerial.h sets them on the Mega
+#define SERIAL_RX_BUFFER_SIZE 64
+
+// Serial, writes go to the simulator console, reads come from injected command lines
+class HardwareSerial {
+  public:
+    void begin(unsigned long baud);
+    int  available();
+    int  read();
+    int  peek();
+    int  availableForWrite();
+    void flush();
+
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *buf, size_t len);
+    size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+
+    size_t print(const char *s) { return write(s); }
+    size_t print(const String &s) { return write(s.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char v, int base = DEC) { return print((unsigned long)v, base); }
+    size_t print(int v, int base = DEC) { return print((long)v, base); }
+    size_t print(unsigned int v, int base = DEC) { return print((unsigned long)v, base); }
+    size_t print(long v, int base = DEC);
+    size_t print(unsigned long v, int base = DEC);
+    size_t print(double v, int digits = 2);
+
+    size_t println() { return write("\r\n"); }
+    template <typename T> size_t println(T v) { size_t n = print(v); return n + println(); }
+    template <typename T> size_t println(T v, int fmt) { size_t n = print(v, fmt); return n + println(); }
+};
+
+extern HardwareSerial Serial;
+
+#endif
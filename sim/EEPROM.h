@@ -0,0 +1,49 @@
+/*  EEPROM.h - The Arduino EEPROM library for the native simulator
+
+                4 KB like the Mega 2560, erased (0xFF) at sim_init().  Each byte actually written takes
+                the 3.3 ms of virtual time the AVR's EEPROM spends on it, and the next read or write
+                waits for that as it does on the AVR, so a save in the wrong place shows up as a stalled
+                loop() in the sim too.  eeprom_is_ready() is avr-libc's, for writing without waiting.
+*/
+#ifndef VACROUTER_SIM_EEPROM_H
+#define VACROUTER_SIM_EEPROM_H
+
+#include <stdint.h>
+
+#define SIM_EEPROM_SIZE     4096
+
+uint8_t sim_eeprom_read(int idx);
+void    sim_eeprom_write(int idx, uint8_t val);
+bool    sim_eeprom_ready();
+
+#define eeprom_is_ready()   sim_eeprom_ready()
+
+struct EEPROMClass {
+    uint8_t read(int idx) { return sim_eeprom_read(idx); }
+    void write(int idx, uint8_t val) { sim_eeprom_write(idx, val); }
+    void update(int idx, uint8_t val) {
+        if (read(idx) != val) {
+            write(idx, val);
+        }
+    }
+    uint16_t length() { return SIM_EEPROM_SIZE; }
+
+    template <typename T> T &get(int idx, T &t) {
+        uint8_t *p = (uint8_t *)&t;
+        for (unsigned i = 0; i < sizeof(T); i++) {
+            p[i] = read(idx + i);
+        }
+        return t;
+    }
+    template <typename T> const T &put(int idx, const T &t) {
+        const uint8_t *p = (const uint8_t *)&t;
+        for (unsigned i = 0; i < sizeof(T); i++) {
+            update(idx + i, p[i]);
+        }
+        return t;
+    }
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
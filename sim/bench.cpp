@@ -0,0 +1,283 @@
+/*  bench.cpp - Homing time benchmark for the native simulator ([env:bench])
+
+                Sweeps the arm's start position across the whole rail, runs HOME from each one against
+                the simulated actuator, and reports homing time, travel and how often the position the
+                firmware settled on disagrees with where the arm really is.  Each run is forked so the
+                firmware starts from a clean set of globals, exactly as it would after a reset.
+
+                Homing is timed from the HOME command to the first "OK PPOS" report, which is the
+                move to the default station (or the unhomed report on failure).  Exits non-zero when
+                the mean or p99 time exceeds its limit, or any start position is misclassified or left
+                unhomed, so a change that makes homing slower or less reliable fails the build.
+                Runs are also counted by how the sweep went, from the firmware's events: the flags it
+                drove through, and whether it stopped on station 1's or had to back up onto it.
+
+    Usage:      program [--step MM] [--max-mean MS] [--max-p99 MS] [--verbose]
+                        [--speed MM_S] [--coast MM] [--flag MM] [--spacing MM] [--margin MM] [--stations N]
+*/
+#ifdef SIM_BENCH
+
+#include "Arduino.h"
+#include "sim.h"
+#include "../src/edge_queue.h"
+#include "../src/event.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+// Limits, override from platformio.ini build_flags or the command line
+#ifndef BENCH_MAX_MEAN_MS
+#define BENCH_MAX_MEAN_MS   0   // 0 = no limit
+#endif
+#ifndef BENCH_MAX_P99_MS
+#define BENCH_MAX_P99_MS    0
+#endif
+
+#define BENCH_RUN_LIMIT_MS  120000
+
+typedef struct {
+    double START;
+    int    DONE;          // Homing finished with a position report
+    int    CPOS;          // Position the firmware reported
+    int    ACTUAL;        // Station the arm is really on, 0 if between flags
+    double TIME_MS;
+    double TRAVEL_MM;
+    int    PASSED;        // Flags the sweep drove through
+    int    STEPS;         // Homing seeks, 1 when the sweep stopped on station 1's flag
+} BENCH_RUN;
+
+// Start regions: AA on station 1's flag, XA left of it, ABA between 1 and 2 nearer 1, ... CX right of station 3
+static std::string region_name(double pos) {
+    const SIM_CFG *cfg = sim_config();
+    int on = sim_station_at(pos);
+    if (on) {
+        return std::string(2, (char)('A' + on - 1));
+    }
+    if (pos < sim_station_pos(1)) {
+        return "XA";
+    }
+    if (pos > sim_station_pos(cfg->STATIONS)) {
+        return std::string(1, (char)('A' + cfg->STATIONS - 1)) + "X";
+    }
+    int left = 1;
+    while (sim_station_pos(left + 1) < pos) {
+        left++;
+    }
+    char l = 'A' + left - 1;
+    char r = l + 1;
+    char nearer = ((pos - sim_station_pos(left)) <= (sim_station_pos(left + 1) - pos)) ? l : r;
+    return std::string(1, l) + r + nearer;
+}
+
+static void run_one(const SIM_CFG *base, double start, BENCH_RUN *run) {
+    SIM_CFG cfg = *base;
+    cfg.START = start;
+    memset(run, 0, sizeof(*run));
+    run->START = start;
+    run->CPOS = -1;
+
+    sim_init(&cfg);
+    sim_serial_keep_lines(true);
+    setup();
+    std::string line;
+    while (sim_serial_take_line(&line)) {
+        // Discard the boot banner
+    }
+    sim_serial_inject("HOME");
+    uint64_t start_us = sim_now_us();
+
+    while ((sim_now_us() - start_us) < ((uint64_t)BENCH_RUN_LIMIT_MS * 1000)) {
+        loop();
+        sim_advance_us(cfg.LOOP_COST_US);
+        while (sim_serial_take_line(&line)) {
+            unsigned seq, id;
+            int arg;
+            if (sscanf(line.c_str(), "EV %u %u %d", &seq, &id, &arg) == 3) {
+                run->PASSED += (id == EVENT_SENSOR) && (arg & (EDGE_PASSED << 1));
+                run->STEPS += (id == EVENT_HOME_STEP);
+            }
+            size_t at = line.find("CPOS: ");
+            if ((line.compare(0, 7, "OK PPOS") == 0) && (at != std::string::npos)) {
+                run->DONE = 1;
+                run->CPOS = atoi(line.c_str() + at + 6);
+            }
+        }
+        if (run->DONE) {
+            break;
+        }
+    }
+    run->TIME_MS = (sim_now_us() - start_us) / 1000.0;
+    while (sim_motor_running()) {
+        sim_advance_us(1000);   // Let the arm coast to rest before judging where it is
+    }
+    run->ACTUAL = sim_station_at(sim_position());
+    run->TRAVEL_MM = sim_odometer();
+}
+
+// Fork per run so every HOME starts from freshly initialised firmware globals
+static bool run_isolated(const SIM_CFG *cfg, double start, BENCH_RUN *run) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return false;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        run_one(cfg, start, run);
+        ssize_t n = write(fds[1], run, sizeof(*run));
+        _exit(n == (ssize_t)sizeof(*run) ? 0 : 1);
+    }
+    close(fds[1]);
+    ssize_t n = read(fds[0], run, sizeof(*run));
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return (n == (ssize_t)sizeof(*run)) && WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+}
+
+static double percentile(std::vector<double> v, double pct) {
+    if (v.empty()) {
+        return 0;
+    }
+    std::sort(v.begin(), v.end());
+    size_t rank = (size_t)((pct / 100.0) * v.size() + 0.999999);   // Nearest rank
+    if (rank < 1) {
+        rank = 1;
+    }
+    return v[std::min(rank, v.size()) - 1];
+}
+
+static double mean(const std::vector<double> &v) {
+    double sum = 0;
+    for (double x : v) {
+        sum += x;
+    }
+    return v.empty() ? 0 : sum / v.size();
+}
+
+int main(int argc, char **argv) {
+    SIM_CFG cfg;
+    sim_default_config(&cfg);
+    double step = 1.0;
+    double max_mean = BENCH_MAX_MEAN_MS;
+    double max_p99 = BENCH_MAX_P99_MS;
+    bool verbose = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = (i + 1) < argc;
+        if ((arg == "--step") && has_value) {
+            step = atof(argv[++i]);
+        } else if ((arg == "--max-mean") && has_value) {
+            max_mean = atof(argv[++i]);
+        } else if ((arg == "--max-p99") && has_value) {
+            max_p99 = atof(argv[++i]);
+        } else if ((arg == "--speed") && has_value) {
+            cfg.SPEED = atof(argv[++i]);
+        } else if ((arg == "--coast") && has_value) {
+            cfg.COAST = atof(argv[++i]);
+        } else if ((arg == "--flag") && has_value) {
+            cfg.FLAG_WIDTH = atof(argv[++i]);
+        } else if ((arg == "--spacing") && has_value) {
+            cfg.SPACING = atof(argv[++i]);
+        } else if ((arg == "--margin") && has_value) {
+            cfg.MARGIN = atof(argv[++i]);
+        } else if ((arg == "--stations") && has_value) {
+            cfg.STATIONS = atoi(argv[++i]);   // Must match STATION_NAMES the firmware was built with
+        } else if (arg == "--verbose") {
+            verbose = true;
+        } else {
+            fprintf(stderr, "Usage: %s [--step MM] [--max-mean MS] [--max-p99 MS] [--verbose]\n"
+                            "          [--speed MM_S] [--coast MM] [--flag MM] [--spacing MM] [--margin MM] [--stations N]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (step <= 0) {
+        step = 1.0;
+    }
+
+    sim_init(&cfg);   // For the geometry helpers
+    double length = sim_rail_length();
+    std::vector<double> times;
+    std::vector<double> travels;
+    std::map<std::string, std::vector<double> > by_region;
+    std::map<std::string, int> by_sweep;
+    int unhomed = 0;
+    int wrong = 0;
+    int crashed = 0;
+
+    for (double start = 0; start <= length + 1e-9; start += step) {
+        BENCH_RUN run;
+        if (!run_isolated(&cfg, start, &run)) {
+            crashed++;
+            printf("BENCH: start %6.1f mm  run failed\n", start);
+            continue;
+        }
+        std::string region = region_name(start);
+        bool ok = run.DONE && (run.CPOS > 0) && (run.CPOS == run.ACTUAL);
+        if (!run.DONE || (run.CPOS <= 0)) {
+            unhomed++;
+        } else if (!ok) {
+            wrong++;
+        }
+        times.push_back(run.TIME_MS);
+        travels.push_back(run.TRAVEL_MM);
+        by_region[region].push_back(run.TIME_MS);
+        char sweep[32];
+        snprintf(sweep, sizeof(sweep), "%d %s", run.PASSED, (run.STEPS > 1) ? "back" : "flag");
+        by_sweep[sweep]++;
+        if (verbose || !ok) {
+            printf("BENCH: start %6.1f mm %-3s  %8.1f ms  %6.1f mm  SWEEP %-7s CPOS %2d  actual %d%s\n",
+                   start, region.c_str(), run.TIME_MS, run.TRAVEL_MM, sweep, run.CPOS, run.ACTUAL,
+                   ok ? "" : "  << MISCLASSIFIED");
+        }
+    }
+
+    printf("\nBENCH: %zu start positions over %.0f mm (step %.1f mm), speed %.0f mm/s, %d stations\n",
+           times.size(), length, step, cfg.SPEED, cfg.STATIONS);
+    printf("BENCH: homing time   min %8.1f  mean %8.1f  p99 %8.1f  max %8.1f ms\n",
+           percentile(times, 0), mean(times), percentile(times, 99), percentile(times, 100));
+    printf("BENCH: travel        min %8.1f  mean %8.1f  p99 %8.1f  max %8.1f mm\n",
+           percentile(travels, 0), mean(travels), percentile(travels, 99), percentile(travels, 100));
+    printf("BENCH: misclassified %d, unhomed %d, failed runs %d (%.2f%% of runs)\n", wrong, unhomed, crashed,
+           times.empty() ? 0.0 : (100.0 * (wrong + unhomed) / times.size()));
+    printf("\nBENCH: %-6s %5s %9s %9s %9s\n", "START", "RUNS", "MIN ms", "MEAN ms", "MAX ms");
+    for (auto &r : by_region) {
+        printf("BENCH: %-6s %5zu %9.1f %9.1f %9.1f\n", r.first.c_str(), r.second.size(),
+               percentile(r.second, 0), mean(r.second), percentile(r.second, 100));
+    }
+    printf("\nBENCH: %-6s %-4s %5s\n", "PASSED", "END", "RUNS");
+    for (auto &t : by_sweep) {
+        printf("BENCH: %-11s %5d\n", t.first.c_str(), t.second);
+    }
+
+    int result = 0;
+    if ((max_mean > 0) && (mean(times) > max_mean)) {
+        printf("BENCH: FAIL mean homing time %.1f ms exceeds limit %.1f ms\n", mean(times), max_mean);
+        result = 1;
+    }
+    if ((max_p99 > 0) && (percentile(times, 99) > max_p99)) {
+        printf("BENCH: FAIL p99 homing time %.1f ms exceeds limit %.1f ms\n", percentile(times, 99), max_p99);
+        result = 1;
+    }
+    if ((wrong + unhomed + crashed) > 0) {
+        printf("BENCH: FAIL %d start positions misclassified or left unhomed\n", wrong + unhomed + crashed);
+        result = 1;
+    }
+    if (result == 0) {
+        printf("BENCH: PASS\n");
+    }
+    return result;
+}
+
+#endif
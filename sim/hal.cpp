@@ -0,0 +1,492 @@
+/*  hal.cpp - Arduino HAL and rail model for the native simulator
+
+                The relays, sensor and serial port are modelled closely enough that the firmware's
+                timing behaviour (bypass windows, safety cutoffs, ISR stops, coast past a flag,
+                blocking on a full TX buffer, RX overruns) shows up the same way it does on the arm.
+*/
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "sim.h"
+#include "../src/frame.h"
+
+#include <stdio.h>
+#include <math.h>
+#include <deque>
+
+// Must match the PIN defines in src/main.cpp
+#define SIM_PIN_PROX_SENSOR   3
+#define SIM_PIN_MOTOR_FWD     4
+#define SIM_PIN_MOTOR_REV     5
+#define SIM_PINS              70   // Mega 2560 digital pin count
+
+// Physics step, small against the 50 ms debounce and the shortest bypass window
+#define SIM_STEP_US           100
+
+// Time the AVR spends programming one EEPROM byte, in the background until the next access
+#define SIM_EEPROM_WRITE_US   3300
+
+// Serial at 115200 8N1 moves one byte every ~87 us, buffers match the AVR core
+#define SIM_BYTE_US           87
+
+HardwareSerial Serial;
+EEPROMClass EEPROM;
+
+static SIM_CFG CFG;
+
+static uint64_t NOW_US = 0;
+static double   POS = 0;
+static double   ODOMETER = 0;
+static int      DIRECTION = 0;       // +1 right, -1 left, 0 stopped (relay state)
+static int      COAST_DIR = 0;
+static double   COAST_LEFT = 0;
+
+static uint8_t  PIN_MODE[SIM_PINS];
+static uint8_t  PIN_OUT[SIM_PINS];
+static int      SENSOR_LEVEL = HIGH;
+
+static void   (*ISR_FN)() = 0;
+static int      ISR_MODE = CHANGE;
+static bool     ISR_ENABLED = true;
+static bool     IN_ISR = false;
+static bool     ISR_PENDING = false;
+
+static std::deque<char> RX_WIRE;     // Bytes still "on the wire" from the host
+static std::deque<char> RX_BUF;      // Bytes in the firmware's receive buffer
+static uint64_t RX_NEXT_US = 0;
+static uint64_t TX_PENDING = 0;      // Bytes waiting in the firmware's transmit buffer
+static uint64_t TX_DRAIN_US = 0;
+
+static bool     ECHO = false;
+static bool     KEEP = false;
+static std::string TX_LINE;
+static std::deque<std::string> TX_LINES;
+static FRAME_RX TX_FRAME;            // Binary frames in the output are shown as one "FRAME ..." line each
+
+static uint8_t  EEPROM_DATA[SIM_EEPROM_SIZE];
+static uint64_t EEPROM_READY_US = 0;  // When the byte being programmed is done
+
+void sim_default_config(SIM_CFG *cfg) {
+    cfg->SPEED        = 50.0;   // ~1.8 s per hop, matches the 2000 ms SAFETY_CUTOFF + SENSOR_FALLOFF budget
+    cfg->COAST        = 2.0;
+    cfg->FLAG_WIDTH   = 12.0;
+    cfg->SPACING      = 90.0;
+    cfg->MARGIN       = 30.0;
+    cfg->STATIONS     = 3;
+    cfg->START        = cfg->MARGIN + cfg->SPACING;   // On the middle station
+    cfg->LOOP_COST_US = 20;
+}
+
+const SIM_CFG *sim_config() {
+    return &CFG;
+}
+
+double sim_rail_length() {
+    return (2 * CFG.MARGIN) + ((CFG.STATIONS - 1) * CFG.SPACING);
+}
+
+double sim_station_pos(int station) {
+    return CFG.MARGIN + ((station - 1) * CFG.SPACING);
+}
+
+int sim_station_at(double pos) {
+    for (int i = 1; i <= CFG.STATIONS; i++) {
+        if (fabs(pos - sim_station_pos(i)) <= (CFG.FLAG_WIDTH / 2)) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+int sim_nearest_station(double pos) {
+    int best = 1;
+    for (int i = 2; i <= CFG.STATIONS; i++) {
+        if (fabs(pos - sim_station_pos(i)) < fabs(pos - sim_station_pos(best))) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+double sim_position()      { return POS; }
+double sim_odometer()      { return ODOMETER; }
+uint64_t sim_now_us()      { return NOW_US; }
+bool sim_motor_running()   { return (DIRECTION != 0) || (COAST_LEFT > 0); }
+
+static void fire_isr() {
+    if (!ISR_FN) {
+        return;
+    }
+    if (IN_ISR || !ISR_ENABLED) {
+        ISR_PENDING = true;   // Latched like the AVR INTFn flag, delivered once re-enabled
+        return;
+    }
+    do {
+        ISR_PENDING = false;
+        IN_ISR = true;
+        ISR_FN();
+        IN_ISR = false;
+    } while (ISR_PENDING && ISR_ENABLED);
+}
+
+static void relay_update() {
+    bool fwd = (PIN_MODE[SIM_PIN_MOTOR_FWD] == OUTPUT) && (PIN_OUT[SIM_PIN_MOTOR_FWD] == LOW);
+    bool rev = (PIN_MODE[SIM_PIN_MOTOR_REV] == OUTPUT) && (PIN_OUT[SIM_PIN_MOTOR_REV] == LOW);
+    int dir = (fwd && !rev) ? 1 : ((rev && !fwd) ? -1 : 0);
+    if ((dir == 0) && (DIRECTION != 0)) {
+        COAST_DIR = DIRECTION;
+        COAST_LEFT = CFG.COAST;
+    } else if (dir != 0) {
+        COAST_LEFT = 0;
+    }
+    DIRECTION = dir;
+}
+
+static void sensor_update() {
+    int level = sim_station_at(POS) ? LOW : HIGH;
+    if (level == SENSOR_LEVEL) {
+        return;
+    }
+    SENSOR_LEVEL = level;
+    if ((ISR_MODE == CHANGE) || ((ISR_MODE == FALLING) && (level == LOW)) || ((ISR_MODE == RISING) && (level == HIGH))) {
+        fire_isr();
+    }
+}
+
+static void serial_update() {
+    while (!RX_WIRE.empty() && (RX_NEXT_US <= NOW_US)) {
+        if (RX_BUF.size() < (SERIAL_RX_BUFFER_SIZE - 1)) {
+            RX_BUF.push_back(RX_WIRE.front());
+        }   // else: overrun, the byte is lost just like on the Mega
+        RX_WIRE.pop_front();
+        RX_NEXT_US += SIM_BYTE_US;
+    }
+    while ((TX_PENDING > 0) && (TX_DRAIN_US + SIM_BYTE_US <= NOW_US)) {
+        TX_PENDING--;
+        TX_DRAIN_US += SIM_BYTE_US;
+    }
+    if (TX_PENDING == 0) {
+        TX_DRAIN_US = NOW_US;
+    }
+}
+
+void sim_advance_us(uint64_t us) {
+    uint64_t end = NOW_US + us;
+    while (NOW_US < end) {
+        uint64_t step = ((end - NOW_US) < SIM_STEP_US) ? (end - NOW_US) : SIM_STEP_US;
+        NOW_US += step;
+        double dt = step / 1e6;
+        double dx = 0;
+        if (DIRECTION != 0) {
+            dx = DIRECTION * CFG.SPEED * dt;
+        } else if (COAST_LEFT > 0) {
+            double d = CFG.SPEED * dt;
+            if (d > COAST_LEFT) {
+                d = COAST_LEFT;
+            }
+            COAST_LEFT -= d;
+            dx = COAST_DIR * d;
+        }
+        if (dx != 0) {
+            double next = POS + dx;
+            if (next < 0) {
+                next = 0;     // Actuator end stop
+            }
+            if (next > sim_rail_length()) {
+                next = sim_rail_length();
+            }
+            ODOMETER += fabs(next - POS);
+            POS = next;
+            sensor_update();
+        }
+        serial_update();
+    }
+}
+
+void sim_init(const SIM_CFG *cfg) {
+    CFG = *cfg;
+    NOW_US = 0;
+    POS = CFG.START;
+    ODOMETER = 0;
+    DIRECTION = COAST_DIR = 0;
+    COAST_LEFT = 0;
+    memset(PIN_MODE, INPUT, sizeof(PIN_MODE));
+    memset(PIN_OUT, LOW, sizeof(PIN_OUT));
+    SENSOR_LEVEL = sim_station_at(POS) ? LOW : HIGH;
+    memset(EEPROM_DATA, 0xFF, sizeof(EEPROM_DATA));
+    ISR_FN = 0;
+    ISR_ENABLED = true;
+    IN_ISR = ISR_PENDING = false;
+    RX_WIRE.clear();
+    RX_BUF.clear();
+    RX_NEXT_US = 0;
+    TX_PENDING = 0;
+    TX_DRAIN_US = 0;
+    TX_LINE.clear();
+    TX_LINES.clear();
+    frame_rx_reset(&TX_FRAME);
+}
+
+// TIME
+unsigned long millis() {
+    return (unsigned long)(NOW_US / 1000);
+}
+
+unsigned long micros() {
+    return (unsigned long)NOW_US;
+}
+
+void delay(unsigned long ms) {
+    sim_advance_us((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+    sim_advance_us(us);
+}
+
+// EEPROM, out of range addresses read as erased and ignore writes.  Like avr-libc, any access first waits
+// for the byte being programmed, and a write returns as soon as it has started.
+bool sim_eeprom_ready() {
+    return NOW_US >= EEPROM_READY_US;
+}
+
+static void eeprom_busy_wait() {
+    if (!sim_eeprom_ready()) {
+        sim_advance_us(EEPROM_READY_US - NOW_US);
+    }
+}
+
+uint8_t sim_eeprom_read(int idx) {
+    eeprom_busy_wait();
+    return ((idx >= 0) && (idx < SIM_EEPROM_SIZE)) ? EEPROM_DATA[idx] : 0xFF;
+}
+
+void sim_eeprom_write(int idx, uint8_t val) {
+    eeprom_busy_wait();
+    EEPROM_READY_US = NOW_US + SIM_EEPROM_WRITE_US;
+    if ((idx >= 0) && (idx < SIM_EEPROM_SIZE)) {
+        EEPROM_DATA[idx] = val;
+    }
+}
+
+bool sim_eeprom_load(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+    size_t n = fread(EEPROM_DATA, 1, sizeof(EEPROM_DATA), f);
+    fclose(f);
+    return n == sizeof(EEPROM_DATA);
+}
+
+bool sim_eeprom_save(const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        return false;
+    }
+    size_t n = fwrite(EEPROM_DATA, 1, sizeof(EEPROM_DATA), f);
+    return (fclose(f) == 0) && (n == sizeof(EEPROM_DATA));
+}
+
+// GPIO
+void pinMode(uint8_t pin, uint8_t mode) {
+    if (pin >= SIM_PINS) {
+        return;
+    }
+    PIN_MODE[pin] = mode;
+    if (mode == INPUT_PULLUP) {
+        PIN_OUT[pin] = HIGH;
+    }
+}
+
+int digitalRead(uint8_t pin) {
+    if (pin == SIM_PIN_PROX_SENSOR) {
+        return SENSOR_LEVEL;
+    }
+    if (pin >= SIM_PINS) {
+        return LOW;
+    }
+    if (PIN_MODE[pin] == INPUT_PULLUP) {
+        return HIGH;    // Buttons are never pressed in the simulator
+    }
+    return PIN_OUT[pin];
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+    if (pin >= SIM_PINS) {
+        return;
+    }
+    PIN_OUT[pin] = val ? HIGH : LOW;
+    if ((pin == SIM_PIN_MOTOR_FWD) || (pin == SIM_PIN_MOTOR_REV)) {
+        relay_update();
+    }
+}
+
+void analogWrite(uint8_t pin, int val) {
+    digitalWrite(pin, val > 127 ? HIGH : LOW);
+}
+
+// INTERRUPTS
+int digitalPinToInterrupt(uint8_t pin) {
+    return (pin == SIM_PIN_PROX_SENSOR) ? 1 : NOT_AN_INTERRUPT;
+}
+
+void attachInterrupt(uint8_t interruptNum, void (*isr)(), int mode) {
+    (void)interruptNum;
+    ISR_FN = isr;
+    ISR_MODE = mode;
+}
+
+void detachInterrupt(uint8_t interruptNum) {
+    (void)interruptNum;
+    ISR_FN = 0;
+}
+
+void noInterrupts() {
+    ISR_ENABLED = false;
+}
+
+void interrupts() {
+    ISR_ENABLED = true;
+    if (ISR_PENDING && !IN_ISR) {
+        fire_isr();
+    }
+}
+
+// SERIAL
+void HardwareSerial::begin(unsigned long baud) {
+    (void)baud;
+}
+
+int HardwareSerial::available() {
+    return RX_BUF.size();
+}
+
+int HardwareSerial::read() {
+    if (RX_BUF.empty()) {
+        return -1;
+    }
+    char c = RX_BUF.front();
+    RX_BUF.pop_front();
+    return (uint8_t)c;
+}
+
+int HardwareSerial::peek() {
+    return RX_BUF.empty() ? -1 : (uint8_t)RX_BUF.front();
+}
+
+int HardwareSerial::availableForWrite() {
+    return (SERIAL_TX_BUFFER_SIZE - 1) - TX_PENDING;
+}
+
+void HardwareSerial::flush() {
+    while (TX_PENDING > 0) {
+        sim_advance_us(SIM_BYTE_US);
+    }
+}
+
+static void tx_line_done() {
+    if (!TX_LINE.empty() && (TX_LINE.back() == '\r')) {
+        TX_LINE.pop_back();
+    }
+    if (ECHO) {
+        printf("[%10.3f] %s\n", NOW_US / 1000.0, TX_LINE.c_str());
+    }
+    if (KEEP) {
+        TX_LINES.push_back(TX_LINE);
+    }
+    TX_LINE.clear();
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+    // A full transmit buffer blocks the caller until the UART drains a byte
+    while (TX_PENDING >= (SERIAL_TX_BUFFER_SIZE - 1)) {
+        sim_advance_us(SIM_BYTE_US);
+    }
+    if (TX_PENDING == 0) {
+        TX_DRAIN_US = NOW_US;
+    }
+    TX_PENDING++;
+    if (TX_LINE.empty() && (frame_rx_busy(&TX_FRAME) || (c == FRAME_SYNC))) {
+        uint8_t rx = frame_rx_byte(&TX_FRAME, c);
+        if (rx != FRAME_RX_MORE) {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "FRAME%s %u %u", (rx == FRAME_RX_BAD) ? " BADCRC" : "",
+                     TX_FRAME.DATA.OP, TX_FRAME.DATA.SEQ);
+            TX_LINE = buf;
+            for (uint8_t i = 0; i < TX_FRAME.DATA.LEN; i++) {
+                TX_LINE += " " + std::to_string((int8_t)TX_FRAME.DATA.PAYLOAD[i]);
+            }
+            tx_line_done();
+        }
+    } else if (c == '\n') {
+        tx_line_done();
+    } else {
+        TX_LINE += (char)c;
+    }
+    return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        write(buf[i]);
+    }
+    return len;
+}
+
+size_t HardwareSerial::print(long v, int base) {
+    char buf[24];
+    if (base == HEX) {
+        snprintf(buf, sizeof(buf), "%lX", (unsigned long)v);
+    } else {
+        snprintf(buf, sizeof(buf), "%ld", v);
+    }
+    return write(buf);
+}
+
+size_t HardwareSerial::print(unsigned long v, int base) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), (base == HEX) ? "%lX" : "%lu", v);
+    return write(buf);
+}
+
+size_t HardwareSerial::print(double v, int digits) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.*f", digits, v);
+    return write(buf);
+}
+
+void sim_serial_inject(const char *line) {
+    if (RX_WIRE.empty() && (RX_NEXT_US < NOW_US)) {
+        RX_NEXT_US = NOW_US;
+    }
+    for (const char *p = line; *p; p++) {
+        RX_WIRE.push_back(*p);
+    }
+    RX_WIRE.push_back('\n');
+}
+
+void sim_serial_inject_bytes(const uint8_t *buf, size_t len) {
+    if (RX_WIRE.empty() && (RX_NEXT_US < NOW_US)) {
+        RX_NEXT_US = NOW_US;
+    }
+    for (size_t i = 0; i < len; i++) {
+        RX_WIRE.push_back((char)buf[i]);
+    }
+}
+
+void sim_serial_echo(bool on) {
+    ECHO = on;
+}
+
+void sim_serial_keep_lines(bool on) {
+    KEEP = on;
+}
+
+bool sim_serial_take_line(std::string *line) {
+    if (TX_LINES.empty()) {
+        return false;
+    }
+    *line = TX_LINES.front();
+    TX_LINES.pop_front();
+    return true;
+}
@@ -0,0 +1,59 @@
+/*  sim.h - Virtual linear actuator, proximity sensor and serial console for the native build
+
+                Positions are in mm along the rail, 0 at the left end stop, increasing to the RIGHT
+                (PIN_MOTOR_FWD).  Stations (outlets) are evenly spaced, each carrying a sensor flag
+                that pulls PIN_PROX_SENSOR LOW while the arm is over it.  The relays are LOW trigger,
+                like the real board.  Everything runs against a virtual microsecond clock.
+*/
+#ifndef VACROUTER_SIM_H
+#define VACROUTER_SIM_H
+
+#include <stdint.h>
+#include <string>
+
+typedef struct {
+    double SPEED;           // Actuator travel speed, mm/s
+    double COAST;           // Distance the arm keeps travelling after the relay drops out, mm
+    double FLAG_WIDTH;      // Width of each sensor flag, mm
+    double SPACING;         // Distance between station centres, mm
+    double MARGIN;          // Travel beyond the outer stations before the actuator end stop, mm
+    int    STATIONS;        // Number of stations on the rail
+    double START;           // Initial arm position, mm
+    uint32_t LOOP_COST_US;  // Virtual time charged for each pass through loop()
+} SIM_CFG;
+
+void   sim_default_config(SIM_CFG *cfg);
+void   sim_init(const SIM_CFG *cfg);
+const SIM_CFG *sim_config();
+
+// Rail geometry helpers
+double sim_rail_length();
+double sim_station_pos(int station);          // 1-based, left to right
+int    sim_station_at(double pos);            // Station whose flag covers pos, 0 if none
+int    sim_nearest_station(double pos);
+
+// Observed state
+double   sim_position();
+double   sim_odometer();                      // Total distance travelled, mm
+uint64_t sim_now_us();
+bool     sim_motor_running();
+
+// Advance the virtual clock, stepping the rail and delivering interrupts
+void sim_advance_us(uint64_t us);
+
+// EEPROM image, so learned state survives from one run (power cycle) to the next
+bool sim_eeprom_load(const char *path);      // False if the file is missing, EEPROM is left erased
+bool sim_eeprom_save(const char *path);
+
+// Serial console
+void sim_serial_inject(const char *line);     // Queue a command line for the firmware (CR appended)
+void sim_serial_inject_bytes(const uint8_t *buf, size_t len);   // Queue raw bytes, e.g. a binary frame
+void sim_serial_echo(bool on);                // Copy firmware output to stdout, prefixed with virtual time
+bool sim_serial_take_line(std::string *line); // Pop the next complete line the firmware printed
+void sim_serial_keep_lines(bool on);          // Retain printed lines for sim_serial_take_line()
+
+// The firmware entry points from src/main.cpp
+void setup();
+void loop();
+
+#endif
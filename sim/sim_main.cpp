@@ -0,0 +1,169 @@
+/*  sim_main.cpp - Command line runner for the native simulator ([env:native])
+
+                Runs setup()/loop() from src/main.cpp against the virtual rail and prints the firmware's
+                serial output prefixed with virtual time in ms.  Commands are sent at virtual times given
+                with --at, or read from stdin as "<ms> <command>" lines with --stdin.
+
+    Usage:      program [options]
+                  --start MM            Initial arm position in mm (default: on station 2)
+                  --start-station N     Initial arm position on station N
+                  --speed MM_S          Actuator speed
+                  --coast MM            Coast distance after the relay drops out
+                  --flag MM             Sensor flag width
+                  --spacing MM          Distance between stations
+                  --margin MM           Travel beyond the outer stations
+                  --stations N          Number of stations
+                  --at MS COMMAND       Send COMMAND at virtual time MS (repeatable).  "FRAME OP SEQ [BYTE]..."
+                                        sends a binary frame instead (src/frame.h), e.g. "FRAME 2 7 13"
+                  --stdin               Read "<ms> <command>" lines from stdin
+                  --until MS            Stop after MS of virtual time (default 30000)
+                  --eeprom FILE         Load EEPROM from FILE (if it exists) and save it back at the end, so
+                                        a second run starts like the board after a power cycle
+                  --rail                Print arm position and sensor changes
+*/
+#ifndef SIM_BENCH
+
+#include "Arduino.h"
+#include "sim.h"
+#include "../src/frame.h"
+
+#include <stdio.h>
+#include <map>
+#include <sstream>
+#include <string>
+#include <iostream>
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--start MM | --start-station N] [--speed MM_S] [--coast MM] [--flag MM]\n"
+                    "          [--spacing MM] [--margin MM] [--stations N] [--at MS COMMAND]... [--stdin]\n"
+                    "          [--until MS] [--eeprom FILE] [--rail]\n", prog);
+}
+
+static void send_command(const std::string &command) {
+    if (command.compare(0, 6, "FRAME ") != 0) {
+        sim_serial_inject(command.c_str());
+        return;
+    }
+    std::istringstream in(command.substr(6));
+    unsigned op = 0;
+    unsigned seq = 0;
+    unsigned value;
+    uint8_t payload[FRAME_MAX_PAYLOAD];
+    uint8_t len = 0;
+    in >> op >> seq;
+    while ((len < FRAME_MAX_PAYLOAD) && (in >> value)) {
+        payload[len++] = (uint8_t)value;
+    }
+    uint8_t buf[FRAME_MAX_SIZE];
+    sim_serial_inject_bytes(buf, frame_encode(buf, (uint8_t)op, (uint8_t)seq, payload, len));
+}
+
+int main(int argc, char **argv) {
+    SIM_CFG cfg;
+    sim_default_config(&cfg);
+    std::multimap<unsigned long, std::string> script;
+    unsigned long until = 30000;
+    bool rail = false;
+    bool from_stdin = false;
+    int start_station = 0;
+    bool start_set = false;
+    const char *eeprom = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = (i + 1) < argc;
+        if ((arg == "--start") && has_value) {
+            cfg.START = atof(argv[++i]);
+            start_set = true;
+        } else if ((arg == "--start-station") && has_value) {
+            start_station = atoi(argv[++i]);
+        } else if ((arg == "--speed") && has_value) {
+            cfg.SPEED = atof(argv[++i]);
+        } else if ((arg == "--coast") && has_value) {
+            cfg.COAST = atof(argv[++i]);
+        } else if ((arg == "--flag") && has_value) {
+            cfg.FLAG_WIDTH = atof(argv[++i]);
+        } else if ((arg == "--spacing") && has_value) {
+            cfg.SPACING = atof(argv[++i]);
+        } else if ((arg == "--margin") && has_value) {
+            cfg.MARGIN = atof(argv[++i]);
+        } else if ((arg == "--stations") && has_value) {
+            cfg.STATIONS = atoi(argv[++i]);
+        } else if ((arg == "--at") && ((i + 2) < argc)) {
+            unsigned long at = strtoul(argv[i + 1], 0, 10);
+            script.insert(std::make_pair(at, std::string(argv[i + 2])));
+            i += 2;
+        } else if ((arg == "--until") && has_value) {
+            until = strtoul(argv[++i], 0, 10);
+        } else if ((arg == "--eeprom") && has_value) {
+            eeprom = argv[++i];
+        } else if (arg == "--stdin") {
+            from_stdin = true;
+        } else if (arg == "--rail") {
+            rail = true;
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    // Geometry options may come after --start-station, so resolve it last
+    if (start_station > 0) {
+        cfg.START = cfg.MARGIN + ((start_station - 1) * cfg.SPACING);
+    } else if (!start_set) {
+        cfg.START = cfg.MARGIN + (((cfg.STATIONS - 1) / 2) * cfg.SPACING);
+    }
+
+    if (from_stdin) {
+        std::string line;
+        while (std::getline(std::cin, line)) {
+            size_t split = line.find(' ');
+            if (line.empty() || (line[0] == '#') || (split == std::string::npos)) {
+                continue;
+            }
+            script.insert(std::make_pair(strtoul(line.c_str(), 0, 10), line.substr(split + 1)));
+        }
+    }
+
+    sim_init(&cfg);
+    if (eeprom) {
+        sim_eeprom_load(eeprom);
+    }
+    sim_serial_echo(true);
+    printf("[%10.3f] SIM: rail %.0f mm, %d stations, arm at %.1f mm, speed %.0f mm/s\n",
+           0.0, sim_rail_length(), cfg.STATIONS, cfg.START, cfg.SPEED);
+    setup();
+
+    double last_pos = sim_position();
+    int last_station = sim_station_at(last_pos);
+    bool last_running = sim_motor_running();
+    while (millis() < until) {
+        while (!script.empty() && (script.begin()->first <= millis())) {
+            printf("[%10.3f] SIM: >> %s\n", sim_now_us() / 1000.0, script.begin()->second.c_str());
+            send_command(script.begin()->second);
+            script.erase(script.begin());
+        }
+        loop();
+        sim_advance_us(cfg.LOOP_COST_US);
+        if (rail) {
+            int station = sim_station_at(sim_position());
+            bool running = sim_motor_running();
+            if ((station != last_station) || (running != last_running)) {
+                printf("[%10.3f] SIM: arm %s at %.1f mm, sensor %s\n", sim_now_us() / 1000.0,
+                       running ? "moving" : "stopped", sim_position(),
+                       station ? ("on station " + std::to_string(station)).c_str() : "clear");
+                last_station = station;
+                last_running = running;
+            }
+        }
+    }
+    printf("[%10.3f] SIM: done, arm at %.1f mm (station %d), travelled %.1f mm\n", sim_now_us() / 1000.0,
+           sim_position(), sim_station_at(sim_position()), sim_odometer());
+    if (eeprom && !sim_eeprom_save(eeprom)) {
+        fprintf(stderr, "Could not write %s\n", eeprom);
+        return 1;
+    }
+    return 0;
+}
+
+#endif
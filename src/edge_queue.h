@@ -0,0 +1,65 @@
+/*  edge_queue.h - Proximity sensor edges from isr_prox_sensor() to loop()
+
+                Single producer (the ISR), single consumer (loop()), no locks: the ISR only ever
+                writes HEAD and loop() only ever writes TAIL, both single bytes so every access is
+                atomic on the AVR.  A compiler barrier keeps the record written before HEAD moves
+                past it, and read before TAIL gives it back.  When loop() falls behind by a full
+                queue, new edges are dropped and counted rather than overwriting unread ones.
+*/
+#ifndef VACROUTER_EDGE_QUEUE_H
+#define VACROUTER_EDGE_QUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define EDGE_QUEUE_SIZE     8       // Power of two
+#define EDGE_QUEUE_MASK     ((EDGE_QUEUE_SIZE) - 1)
+
+// SENSOR_EDGE.FLAGS, what the ISR did about the edge
+#define EDGE_STOPPED        0x01    // Flag reached, relays switched off
+#define EDGE_PASSED         0x02    // Intermediate flag on a multi-hop move, kept driving
+#define EDGE_BOUNCE         0x04    // Inside the debounce lockout, ignored
+
+#define EDGE_BARRIER()      __asm__ __volatile__("" ::: "memory")
+
+typedef struct {
+    unsigned long US;       // micros() at the edge
+    uint8_t LEVEL;          // Sensor pin after the edge, LOW on a flag
+    uint8_t FLAGS;
+    uint16_t LATENCY;       // Timer ticks from ISR entry to relays off, EDGE_STOPPED only
+} SENSOR_EDGE;
+
+typedef struct {
+    volatile uint8_t HEAD;      // Next slot the ISR writes
+    volatile uint8_t TAIL;      // Next slot loop() reads
+    volatile uint8_t DROPPED;   // Edges lost to a full queue, only counts up (and wraps)
+    SENSOR_EDGE BUF[EDGE_QUEUE_SIZE];
+} EDGE_QUEUE;
+
+// ISR side.  False if the queue was full.
+static inline bool edge_push(EDGE_QUEUE *q, const SENSOR_EDGE *edge) {
+    uint8_t head = q->HEAD;
+    if ((uint8_t)(head - q->TAIL) >= EDGE_QUEUE_SIZE) {
+        q->DROPPED++;
+        return false;
+    }
+    q->BUF[head & EDGE_QUEUE_MASK] = *edge;
+    EDGE_BARRIER();
+    q->HEAD = head + 1;
+    return true;
+}
+
+// loop() side.  False if there is nothing to read.
+static inline bool edge_pop(EDGE_QUEUE *q, SENSOR_EDGE *edge) {
+    uint8_t tail = q->TAIL;
+    if (tail == q->HEAD) {
+        return false;
+    }
+    EDGE_BARRIER();
+    *edge = q->BUF[tail & EDGE_QUEUE_MASK];
+    EDGE_BARRIER();
+    q->TAIL = tail + 1;
+    return true;
+}
+
+#endif
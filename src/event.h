@@ -0,0 +1,53 @@
+/*  event.h - State change events pushed to the host, shared by the firmware and the bridge
+
+                The firmware sends one event for every transition the host cares about, as it happens,
+                so the host never has to poll or wait for a move to finish:
+
+                  EV <seq> <id> <arg>           text, or
+                  FRAME_OP_EVENT                payload ID, SEQ (uint16 LE), ARG (int16 LE)
+
+                SEQ counts up from 1 at boot, one per event, wrapping 65535 to 0.  An event is short
+                enough to always fit in the TX buffer, so it is never dropped, but one lost on the wire
+                or in a reconnect still shows up as a gap and the host can ask for STATUS.  A SEQ of 1
+                after anything else is the board restarting, not a gap.
+
+                Plain C so the same file builds in the firmware and on the host.
+*/
+#ifndef VACROUTER_EVENT_H
+#define VACROUTER_EVENT_H
+
+#include <stdint.h>
+
+// Event IDs, ARG in brackets
+#define EVENT_MOVE          1       // Seek towards a station started or redirected (target station)
+#define EVENT_SENSOR        2       // Sensor edge, bounces left out (LEVEL | EDGE_* << 1)
+#define EVENT_ARRIVED       3       // Stopped on a flag (CURRENT_POS)
+#define EVENT_TIMEOUT       4       // Safety cutoff without a flag, position assumed (CURRENT_POS)
+#define EVENT_HOME_STEP     5       // Homing seek started (HS_*)
+#define EVENT_HOMED         6       // Homing found the arm (station)
+#define EVENT_FAULT         7       // Something needs a person (EVENT_FAULT_*)
+#define EVENT_ABORT         8       // Move or homing stopped short, position unknown (SOURCE)
+
+// EVENT_FAULT arguments
+#define EVENT_FAULT_HOMING  1       // Homing failed, not homed
+#define EVENT_FAULT_RANGE   2       // Move refused or ran past the end stations
+#define EVENT_FAULT_EDGES   3       // Sensor edges lost, SENSOR_EDGES was full
+#define EVENT_FAULT_RELAYS  4       // Asked to drive both ways at once
+
+#define EVENT_PAYLOAD       5
+
+static inline const char *event_name(uint8_t id) {
+    switch (id) {
+        case EVENT_MOVE:      return "MOVE";
+        case EVENT_SENSOR:    return "SENSOR";
+        case EVENT_ARRIVED:   return "ARRIVED";
+        case EVENT_TIMEOUT:   return "TIMEOUT";
+        case EVENT_HOME_STEP: return "HOME_STEP";
+        case EVENT_HOMED:     return "HOMED";
+        case EVENT_FAULT:     return "FAULT";
+        case EVENT_ABORT:     return "ABORT";
+        default:              return "UNKNOWN";
+    }
+}
+
+#endif
@@ -0,0 +1,68 @@
+/*  fast_pin.h - Compile time GPIO for the pins on the sensor to relay path
+
+                FastPin<'G', 5, 4> is pin D4 named by its AVR port and bit.  Everything is a static
+                inline on a constant I/O address, so on the Mega high() and low() compile to a single
+                SBI or CBI and read() to an SBIS/SBIC test, where digitalWrite() looks the pin up in
+                three flash tables, checks for PWM and masks interrupts around a read-modify-write.
+                SBI/CBI are atomic, so the ISR and loop() can share a port without masking.  Only
+                ports A..G are in the low I/O space those instructions reach; naming H..L is a
+                compile error rather than a silent slow path.
+
+                Off the AVR (the sim) the Arduino pin number is used with digitalWrite()/digitalRead().
+                Build with -DFAST_PIN_DISABLE to do the same on the Mega, to compare latencies.
+*/
+#ifndef VACROUTER_FAST_PIN_H
+#define VACROUTER_FAST_PIN_H
+
+#include <Arduino.h>
+
+#if defined(__AVR__) && !defined(FAST_PIN_DISABLE)
+
+template <char PORT> struct FastPort;   // Only the specialisations below exist
+
+#define FAST_PORT(letter, out, in) \
+    template <> struct FastPort<letter> { \
+        static inline volatile uint8_t &OUT() { return out; } \
+        static inline volatile uint8_t &IN() { return in; } \
+    }
+
+FAST_PORT('A', PORTA, PINA);
+FAST_PORT('B', PORTB, PINB);
+FAST_PORT('C', PORTC, PINC);
+FAST_PORT('D', PORTD, PIND);
+FAST_PORT('E', PORTE, PINE);
+FAST_PORT('F', PORTF, PINF);
+FAST_PORT('G', PORTG, PING);
+
+#undef FAST_PORT
+
+template <char PORT, uint8_t BIT, uint8_t PIN>
+struct FastPin {
+    static_assert(BIT < 8, "FastPin: bit out of range");
+    static inline void high() { FastPort<PORT>::OUT() |= (uint8_t)(1 << BIT); }
+    static inline void low() { FastPort<PORT>::OUT() &= (uint8_t)~(1 << BIT); }
+    static inline uint8_t read() { return (FastPort<PORT>::IN() & (1 << BIT)) ? HIGH : LOW; }
+    static inline uint8_t output() { return (FastPort<PORT>::OUT() & (1 << BIT)) ? HIGH : LOW; }
+    static inline void write(uint8_t level) {
+        if (level) {
+            high();
+        } else {
+            low();
+        }
+    }
+};
+
+#else
+
+template <char PORT, uint8_t BIT, uint8_t PIN>
+struct FastPin {
+    static inline void high() { digitalWrite(PIN, HIGH); }
+    static inline void low() { digitalWrite(PIN, LOW); }
+    static inline uint8_t read() { return digitalRead(PIN); }
+    static inline uint8_t output() { return digitalRead(PIN); }
+    static inline void write(uint8_t level) { digitalWrite(PIN, level); }
+};
+
+#endif
+
+#endif
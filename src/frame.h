@@ -0,0 +1,197 @@
+/*  frame.h - Binary framing for the vacrouter serial link, shared by the firmware and the host codec
+
+                Optional alternative to the text CLI.  A frame starts with FRAME_SYNC, which never
+                appears in the ASCII text protocol, so both can share the port:
+
+                  SYNC  LEN  OP  SEQ  PAYLOAD[LEN]  CRC8
+                  0xA5
+
+                CRC8 (polynomial 0x07, initial 0) covers LEN, OP, SEQ and PAYLOAD.  The host numbers its
+                commands with SEQ 1..255, and every command frame is answered with FRAME_OP_ACK carrying
+                the same SEQ, so several commands can be in flight and replies matched without scraping
+                text.  A command that has to wait for a move in progress is acked FRAME_ACK_QUEUED, then
+                acked again with its result when it runs.  A frame that fails its CRC is answered with
+                FRAME_ACK_CRC (SEQ as received) and never executed.  Resending a SEQ that was already
+                acked repeats the ack without running the command twice; the firmware remembers the
+                last FRAME_WINDOW commands for that, so the host keeps no more than that many unacked.
+
+                A frame is written in one go, so a receiver that finds the line quiet for FRAME_RX_GAP_US
+                in the middle of one drops it (frame_rx_idle()): it was cut short by a host that died
+                mid-write, or its FRAME_SYNC was noise, and the text line that follows must not be taken
+                for the rest of it.
+
+                Plain C so the same file builds in the firmware and on the host.
+*/
+#ifndef VACROUTER_FRAME_H
+#define VACROUTER_FRAME_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FRAME_SYNC          0xA5
+#define FRAME_MAX_PAYLOAD   8
+#define FRAME_OVERHEAD      5       // SYNC, LEN, OP, SEQ, CRC
+#define FRAME_MAX_SIZE      ((FRAME_MAX_PAYLOAD) + (FRAME_OVERHEAD))
+#define FRAME_WINDOW        4       // Commands the host may have in flight
+#define FRAME_RX_GAP_US     1000    // Quiet this long mid-frame, about 11 character times at 115200, and it's cut
+
+// Host to firmware
+#define FRAME_OP_HOME       0x01    // No payload
+#define FRAME_OP_MOVE       0x02    // Payload: FRAME_MOVE_* target
+#define FRAME_OP_STATUS     0x03    // No payload, answered with FRAME_OP_STATUS_REPLY
+#define FRAME_OP_GOTO       0x04    // Payload: station number, 1..STATION_COUNT
+#define FRAME_OP_STATS      0x05    // No payload, answered with the text STATS line, too long for a frame
+
+// Firmware to host
+#define FRAME_OP_ACK        0x80    // Payload: acked op, FRAME_ACK_* result
+#define FRAME_OP_POS        0x81    // Payload: PPOS, CPOS (int8).  SEQ of the command that moved the arm
+#define FRAME_OP_STATUS_REPLY 0x82  // Payload: HOMING, STEP, MOTION, PPOS, CPOS (int8)
+#define FRAME_OP_EVENT      0x83    // Payload: ID, SEQ, ARG, see event.h.  SEQ of the command that moved the arm
+#define FRAME_OP_CREDIT     0x84    // Payload: FREE, TAKEN, see CREDITcommand in main.cpp.  SEQ is 0
+
+// FRAME_OP_ACK results
+#define FRAME_ACK_OK        0       // Command run
+#define FRAME_ACK_QUEUED    1       // Accepted, runs when the current move or homing finishes
+#define FRAME_ACK_BUSY      2       // Queue full, not run, resend later
+#define FRAME_ACK_ERROR     3       // Run and failed, e.g. MOVE while not homed
+#define FRAME_ACK_INVALID   4       // Unknown op or bad payload
+#define FRAME_ACK_CRC       5       // Corrupted frame, not run
+#define FRAME_ACK_CANCELLED 6       // Was FRAME_ACK_QUEUED, then dropped by a later move or STOP before it ran
+
+// FRAME_OP_MOVE targets, the same values as the MOVE defines in main.cpp
+#define FRAME_MOVE_STOP       0
+#define FRAME_MOVE_RIGHT      1
+#define FRAME_MOVE_LEFT       2
+#define FRAME_MOVE_GL1        4
+#define FRAME_MOVE_GR1        5
+#define FRAME_MOVE_H1         6
+#define FRAME_MOVE_H2         7
+#define FRAME_MOVE_H3         8
+#define FRAME_MOVE_H4         9
+#define FRAME_MOVE_WORKBENCH  11
+#define FRAME_MOVE_CHOPSAW    12
+#define FRAME_MOVE_CNC        13
+
+// frame_rx_byte() results
+#define FRAME_RX_MORE       0       // Frame incomplete, or byte was not part of a frame
+#define FRAME_RX_DONE       1       // FRAME_RX.DATA holds a valid frame
+#define FRAME_RX_BAD        2       // Frame complete but the CRC failed, FRAME_RX.DATA.SEQ is as received
+
+typedef struct {
+    uint8_t OP;
+    uint8_t SEQ;
+    uint8_t LEN;
+    uint8_t PAYLOAD[FRAME_MAX_PAYLOAD];
+} FRAME;
+
+typedef struct {
+    uint8_t STATE;      // Next field expected, 0 while waiting for FRAME_SYNC
+    uint8_t AT;         // Payload bytes received
+    uint8_t CRC;
+    bool    IDLE;       // No byte since frame_rx_idle() last found none waiting...
+    uint32_t IDLE_US;   // ...which it first did then
+    FRAME   DATA;       // The frame, once frame_rx_byte() returns FRAME_RX_DONE
+} FRAME_RX;
+
+static inline uint8_t frame_crc8(uint8_t crc, uint8_t data) {
+    crc ^= data;
+    for (uint8_t i = 0; i < 8; i++) {
+        crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+    }
+    return crc;
+}
+
+static inline void frame_rx_reset(FRAME_RX *rx) {
+    rx->STATE = 0;
+    rx->IDLE = false;
+}
+
+static inline bool frame_rx_busy(const FRAME_RX *rx) {
+    return rx->STATE != 0;
+}
+
+// Feed one received byte.  Outside a frame, anything but FRAME_SYNC is ignored (returns FRAME_RX_MORE).
+static inline uint8_t frame_rx_byte(FRAME_RX *rx, uint8_t c) {
+    rx->IDLE = false;
+    switch (rx->STATE) {
+        case 0:
+            if (c == FRAME_SYNC) {
+                rx->STATE = 1;
+                rx->CRC = 0;
+            }
+            return FRAME_RX_MORE;
+        case 1:
+            if (c > FRAME_MAX_PAYLOAD) {
+                rx->STATE = 0;      // Can't be a frame, resynchronise on the next FRAME_SYNC
+                return FRAME_RX_MORE;
+            }
+            rx->DATA.LEN = c;
+            rx->AT = 0;
+            rx->CRC = frame_crc8(rx->CRC, c);
+            rx->STATE = 2;
+            return FRAME_RX_MORE;
+        case 2:
+            rx->DATA.OP = c;
+            rx->CRC = frame_crc8(rx->CRC, c);
+            rx->STATE = 3;
+            return FRAME_RX_MORE;
+        case 3:
+            rx->DATA.SEQ = c;
+            rx->CRC = frame_crc8(rx->CRC, c);
+            rx->STATE = (rx->DATA.LEN > 0) ? 4 : 5;
+            return FRAME_RX_MORE;
+        case 4:
+            rx->DATA.PAYLOAD[rx->AT++] = c;
+            rx->CRC = frame_crc8(rx->CRC, c);
+            if (rx->AT >= rx->DATA.LEN) {
+                rx->STATE = 5;
+            }
+            return FRAME_RX_MORE;
+        default:
+            rx->STATE = 0;
+            return (c == rx->CRC) ? FRAME_RX_DONE : FRAME_RX_BAD;
+    }
+}
+
+// Call whenever no received byte is waiting, with the time in us.  Drops a frame the line has been quiet in
+// the middle of for FRAME_RX_GAP_US and returns true.  The quiet is timed from the first call that found
+// nothing waiting, not from the last byte, so a receiver that was busy elsewhere while the rest of the frame
+// arrived doesn't cut it.
+static inline bool frame_rx_idle(FRAME_RX *rx, uint32_t now_us) {
+    if (rx->STATE == 0) {
+        return false;
+    }
+    if (!rx->IDLE) {
+        rx->IDLE = true;
+        rx->IDLE_US = now_us;
+        return false;
+    }
+    if ((uint32_t)(now_us - rx->IDLE_US) < FRAME_RX_GAP_US) {
+        return false;
+    }
+    frame_rx_reset(rx);
+    return true;
+}
+
+// Encode a frame into buf (at least FRAME_MAX_SIZE bytes), returns the number of bytes to send
+static inline uint8_t frame_encode(uint8_t *buf, uint8_t op, uint8_t seq, const uint8_t *payload, uint8_t len) {
+    uint8_t n = 0;
+    uint8_t crc = 0;
+    if (len > FRAME_MAX_PAYLOAD) {
+        len = FRAME_MAX_PAYLOAD;
+    }
+    buf[n++] = FRAME_SYNC;
+    buf[n++] = len;
+    buf[n++] = op;
+    buf[n++] = seq;
+    for (uint8_t i = 0; i < len; i++) {
+        buf[n++] = payload[i];
+    }
+    for (uint8_t i = 1; i < n; i++) {
+        crc = frame_crc8(crc, buf[i]);
+    }
+    buf[n++] = crc;
+    return n;
+}
+
+#endif
@@ -0,0 +1,98 @@
+/*  log.h - Levelled log lines that never stall motion control on a full serial buffer
+
+                LOG_ERROR/LOG_WARN/LOG_INFO/LOG_DEBUG("MOTOR: STOP ISSUED BY SOURCE: ", SOURCE) takes a string
+                literal, kept in flash with PSTR(), and an optional number or string to go after it.
+                Levels above LOG_LEVEL (set in platformio.ini build_flags) compile to nothing, strings
+                included.  The line is built in one buffer and handed to Serial in one write.  An INFO or
+                DEBUG line that doesn't fit in the TX buffer as it stands is dropped and counted in
+                LOG_DROPPED rather than waiting for the UART, so loop() never stalls on one.  WARN and
+                ERROR lines always go out, waiting for room if they have to.
+
+                The messages keep the same text they had as print2() lines, but nothing may rely on an
+                INFO or DEBUG line arriving: what the host or bench acts on goes out as a WARN, an
+                event (event.h) or a command reply.
+*/
+#ifndef VACROUTER_LOG_H
+#define VACROUTER_LOG_H
+
+#include <Arduino.h>
+
+#define LOG_LEVEL_NONE      0
+#define LOG_LEVEL_ERROR     1
+#define LOG_LEVEL_WARN      2
+#define LOG_LEVEL_INFO      3
+#define LOG_LEVEL_DEBUG     4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL           LOG_LEVEL_INFO
+#endif
+
+#define LOG_LINE_MAX        112     // Longest line, message, value and CR LF.  Longer is cut short.
+
+extern uint16_t LOG_DROPPED;        // INFO and DEBUG lines dropped on a full TX buffer, stops at 65535
+
+static inline void log_send(uint8_t level, char *line, uint8_t len) {
+    line[len++] = '\r';
+    line[len++] = '\n';
+    if ((level > LOG_LEVEL_WARN) && (Serial.availableForWrite() < len)) {
+        if (LOG_DROPPED != 0xFFFF) {
+            LOG_DROPPED++;
+        }
+        return;
+    }
+    Serial.write((const uint8_t *)line, len);
+}
+
+// Copy the flash message to line, room is left for the longest number and CR LF
+static inline uint8_t log_start(char *line, const char *msg) {
+    strncpy_P(line, msg, LOG_LINE_MAX - 14);
+    line[LOG_LINE_MAX - 14] = '\0';
+    return strlen(line);
+}
+
+static inline void log_write(uint8_t level, const char *msg) {
+    char line[LOG_LINE_MAX];
+    log_send(level, line, log_start(line, msg));
+}
+
+static inline void log_write(uint8_t level, const char *msg, long value) {
+    char line[LOG_LINE_MAX];
+    uint8_t len = log_start(line, msg);
+    ltoa(value, line + len, 10);
+    log_send(level, line, strlen(line));
+}
+
+static inline void log_write(uint8_t level, const char *msg, const char *value) {
+    char line[LOG_LINE_MAX];
+    uint8_t len = log_start(line, msg);
+    strncpy(line + len, value, LOG_LINE_MAX - 3 - len);
+    line[LOG_LINE_MAX - 3] = '\0';
+    log_send(level, line, strlen(line));
+}
+
+static inline void log_write(uint8_t level, const char *msg, const String &value) {
+    log_write(level, msg, value.c_str());
+}
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(msg, ...)     log_write(LOG_LEVEL_ERROR, PSTR(msg), ##__VA_ARGS__)
+#else
+#define LOG_ERROR(msg, ...)     ((void)0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(msg, ...)      log_write(LOG_LEVEL_WARN, PSTR(msg), ##__VA_ARGS__)
+#else
+#define LOG_WARN(msg, ...)      ((void)0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(msg, ...)      log_write(LOG_LEVEL_INFO, PSTR(msg), ##__VA_ARGS__)
+#else
+#define LOG_INFO(msg, ...)      ((void)0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(msg, ...)     log_write(LOG_LEVEL_DEBUG, PSTR(msg), ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(msg, ...)     ((void)0)
+#endif
+
+#endif
@@ -39,6 +39,14 @@ TODO:
 #include <Arduino.h>        // Base header required for basic Arduino functions
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
+#include <EEPROM.h>
+#include "frame.h"          // Binary framing, the optional alternative to the text CLI
+#include "edge_queue.h"     // Sensor edges from the ISR to loop()
+#include "fast_pin.h"       // Direct port GPIO for the stop path
+#include "trace.h"          // Event trace ring, see TRACEcommand
+#include "event.h"          // State change events pushed to the host, see event_send()
+#include "log.h"            // LOG_ERROR..LOG_DEBUG, levels set by LOG_LEVEL in platformio.ini
 
 // PINS
 #define PIN_PROX_SENSOR   3  // 5V Inductive Sensor trigger line  # Use interupt pin on different bank?
@@ -49,6 +57,26 @@ TODO:
 #define PIN_LED_RED       21 // Solid for movement, flash for errors?
 #define PIN_LED_GREEN     20 // Triggers solid for x secs with sensor
 
+// The same pins by Mega 2560 port and bit, for everything after setup().  Relays are LOW trigger.
+typedef FastPin<'E', 5, PIN_PROX_SENSOR> FAST_PROX_SENSOR;   // PE5
+typedef FastPin<'G', 5, PIN_MOTOR_FWD>   FAST_MOTOR_FWD;     // PG5
+typedef FastPin<'E', 3, PIN_MOTOR_REV>   FAST_MOTOR_REV;     // PE3
+typedef FastPin<'D', 0, PIN_LED_RED>     FAST_LED_RED;       // PD0
+typedef FastPin<'D', 1, PIN_LED_GREEN>   FAST_LED_GREEN;     // PD1
+
+// Edge to relay off latency, timed from the first instruction of isr_prox_sensor() to the relay writes,
+// see there.  On the Mega Timer1 free runs at the CPU clock for this (62.5 ns a tick, wraps every 4 ms),
+// nothing else here uses it.
+#if defined(__AVR__)
+#define LATENCY_TIMER_START()  (TCCR1A = 0, TCCR1B = _BV(CS10))
+#define LATENCY_NOW()          ((uint16_t)TCNT1)
+#define LATENCY_TICKS_PER_US   (F_CPU / 1000000UL)
+#else
+#define LATENCY_TIMER_START()
+#define LATENCY_NOW()          ((uint16_t)micros())
+#define LATENCY_TICKS_PER_US   1
+#endif
+
 // COMMANDLINE.h defines
 //this following macro is good for debugging, e.g.  print2("myVar= ", myVar);
 #define print1(x)   (Serial.println(x))
@@ -62,7 +90,7 @@ TODO:
 // CLI CONFIG
 #define COMMAND_BUFFER_LENGTH        25                        //length of serial buffer for incoming commands
 
-// MOVE COMMANDS - Add case IDs here and also in the top of the MOVE logic in MOVEcommand() for RXCOMMAND
+// MOVE COMMANDS - Add case IDs here and also a MOVE row in COMMAND_ARRAY
 #define STOP      0
 #define RIGHT     1
 #define LEFT      2
@@ -77,6 +105,9 @@ TODO:
 #define CHOPSAW   12
 #define CNC       13
 
+static_assert((FRAME_MOVE_STOP == STOP) && (FRAME_MOVE_GL1 == GL1) && (FRAME_MOVE_H4 == H4) && (FRAME_MOVE_CNC == CNC),
+              "frame.h MOVE targets must match the MOVE defines");
+
 // STATUS TRACKING
 // Sources - where a command originated
 #define INIT      0
@@ -88,38 +119,63 @@ TODO:
 #define SENSOR_FALLOFF 300
 #define SAFETY_CUTOFF ((2000) - (SENSOR_FALLOFF))
 #define SENSOR_DEBOUNCE_DELAY 50
-#define HOMING_TIMEOUT_LONG ((SAFETY_CUTOFF) + (500))
-#define HOMING_TIMEOUT_SHORT ((HOMING_TIMEOUT_LONG) / (2))
-
-// HOMING POSTIION DEFINES
-// END_POS
-#define A 1
-#define B 2
-#define C 3
-
-// START POS
-#define XA  0
-#define AA  1
-#define ABA 2
-#define ABB 3
-#define BB  4
-#define BCB 5
-#define BCC 6
-#define CC  7
-#define CX  8
-
-// Homing sequences where N is null
-#define RNNRNRL   0
-#define NNRNRL    1
-#define LNNRNRL   2
-#define RNNLRNRL  3
-#define LRNNLRNRL 4
-#define NNLRNRL   5
-#define LNNLRNRL  6
-#define RNNLRNL   7
-#define LRNNLRNL  8
-#define NNLRNL    9
-#define LNNLRNL   10
+
+// STATIONS - the outlets, left to right, as named in GOTO and MOVE GO<name>.  To add outlets override
+// from platformio.ini build_flags, e.g. -D 'STATION_NAMES="WORKBENCH","CHOPSAW","CNC","TABLESAW","PLANER"'
+#ifndef STATION_NAMES
+#define STATION_NAMES         "WORKBENCH", "CHOPSAW", "CNC"
+#endif
+#ifndef STATION_DEFAULT
+#define STATION_DEFAULT       2     // Where the arm parks after homing
+#endif
+#define STATION_NAME_MAX      12    // Longest name plus its terminator
+static const char STATION_NAME_ARRAY[][STATION_NAME_MAX] PROGMEM = { STATION_NAMES };
+#define STATION_COUNT         ((int)(sizeof(STATION_NAME_ARRAY) / sizeof(STATION_NAME_ARRAY[0])))
+static_assert((STATION_DEFAULT >= 1) && (STATION_DEFAULT <= STATION_COUNT), "STATION_DEFAULT is not a station");
+static_assert((STATION_COUNT >= 2) && (STATION_COUNT <= 9), "STATION_NAMES: 2 to 9 stations, a travel segment "
+              "each way between neighbours must fit the uint16_t TRAVEL_DIRTY and TRAVEL_WARNED masks");
+
+// STATS - counters since boot or STATS RESET, see STATScommand().  Counters stop at 65535 rather than wrap.
+#define STATS_MOVE_BINS       10    // Move duration histogram...
+#define STATS_MOVE_BIN_MS     500   // ...this wide, the last bin takes everything longer
+#define STATS_SWEEP_BINS      (STATION_COUNT)   // The sweep passes at most STATION_COUNT - 1 flags
+
+// TRAVEL TIME LEARNING - each hop between neighbouring stations, per direction, is timed from the relay
+// switching on to the flag edge.  The learned mean and deviation replace the fixed hop limit, see
+// travel_limit_ms(), and set the homing seek limit once every segment has been seen.
+#define TRAVEL_SEGMENTS       (((STATION_COUNT) - 1) * 2)
+#define TRAVEL_DEFAULT_MS     ((SENSOR_FALLOFF) + (SAFETY_CUTOFF))  // Hop limit until a segment is learned
+#define TRAVEL_MAX_MS         ((TRAVEL_DEFAULT_MS) * 2)             // Learned limits never exceed this
+#define TRAVEL_TRUST_COUNT    5     // Hops timed before a segment's own limit is used
+#define TRAVEL_WINDOW         16    // Mean and variance follow roughly the last this many hops
+#define TRAVEL_SIGMAS         4     // Limit is the mean plus this many deviations...
+#define TRAVEL_SIGMA_MIN_PCT  3     // ...with the deviation at least this % of the mean...
+#define TRAVEL_MARGIN_MS      100   // ...plus this
+#define TRAVEL_DRIFT_PCT      8     // Warn when a mean moves this % from its baseline, before the limit bites
+#define TRAVEL_SAVE_EVERY     4     // Hops between EEPROM saves once trusted, a power cut loses fewer
+#define TRAVEL_MAGIC          (0x5400 + STATION_COUNT)  // A different rail starts learning afresh
+#define EEPROM_TRAVEL_ADDR    0
+
+// SAVED POSITION - the last confirmed station, in a ring of records so no one EEPROM byte takes every
+// write.  A record's slot is always SEQ % POSITION_SLOTS, the newest is the one its successor doesn't follow.
+#define EEPROM_POSITION_ADDR  512   // After the travel table, with room for it to grow
+#define POSITION_SLOTS        32    // Divides 256, so SEQ wrapping keeps the slot rule
+#define POSITION_MOVING       0x01  // FLAGS: relays switched on since STATION was confirmed
+#define VERIFY_JOG_MS         ((TRAVEL_DEFAULT_MS) / 8)  // Searched each way for the flag we saved on
+
+// MOTION STATES - move_right()/move_left() start a hop, motion_update() advances it from loop()
+#define MOTION_IDLE     0
+#define MOTION_BYPASS   1   // Leaving the current flag, sensor ignored for SENSOR_FALLOFF
+#define MOTION_TRAVEL   2   // Waiting for the next flag, or SAFETY_CUTOFF
+#define MOTION_ARRIVED  3
+#define MOTION_TIMEOUT  4
+
+// HOMING STEPS - each step is one seek, homing_step() picks the next from where the last one stopped
+#define HS_IDLE         0
+#define HS_SWEEP_LEFT   1   // Drive LEFT through every flag until station 1's, or a hop passes without one
+#define HS_FIND_FIRST   2   // Past the left end flag, back RIGHT onto station 1
+#define HS_VERIFY_LEFT  3   // Saved position, jog LEFT for its flag unless already on it
+#define HS_VERIFY_RIGHT 4   // Saved position, not found LEFT, jog back past the start and further RIGHT
 
 // LED Colours
 #define OFF       0
@@ -129,20 +185,106 @@ TODO:
 
 // VARIABLES
 // Sensor
-int PREV_SENSOR_STATE = HIGH;
 int SENSOR_STATE = HIGH;                        // Set initial state to high, since we pull low when triggered
-int SENSOR_OVERRIDE = LOW;
+volatile int SENSOR_OVERRIDE = LOW;
+EDGE_QUEUE SENSOR_EDGES;                        // Filled by isr_prox_sensor(), drained by sensor_update()
+uint8_t SENSOR_EDGES_DROPPED = 0;               // SENSOR_EDGES.DROPPED when last reported
+uint16_t LATENCY_COUNT = 0;                     // Sensor stops timed, see LATENCYcommand()
+uint16_t LATENCY_MIN = 0xFFFF;                  // In LATENCY_NOW() ticks
+uint16_t LATENCY_MAX = 0;
+uint32_t LATENCY_SUM = 0;
+unsigned long sensor_edge_us = 0;               // micros() of the last edge, for the bounce lockout
+// Stats
+typedef struct {
+    uint16_t MOVES;                           // Seeks outside homing, by how they ended...
+    uint16_t ARRIVED;                         // ...on the target's flag
+    uint16_t TIMEOUTS;                        // ...on the safety cutoff
+    uint16_t ABORTS;                          // Moves and homing runs cut short by STOP
+    uint16_t REDIRECTS;                       // Moves pointed at a new station on the way, see motion_redirect()
+    uint16_t MOVE_HIST[STATS_MOVE_BINS];      // Move durations, STATS_MOVE_BIN_MS wide
+    uint16_t MOVE_MAX_MS;
+    uint32_t MOVE_SUM_MS;
+    uint16_t ISR;                             // Sensor interrupts, including dropped edges
+    uint16_t BOUNCES;                         // Edges inside the debounce lockout
+    uint16_t PASSES;                          // Flags driven through on multi-hop moves and sweeps
+    uint16_t DROPPED;                         // Edges lost to a full SENSOR_EDGES
+    uint16_t RX_OVERRUNS;                     // Times the RX buffer was found full, bytes after it were lost
+    uint16_t RX_TOO_LONG;                     // Lines longer than COMMAND_BUFFER_LENGTH, not run
+    uint16_t QUEUE_FULL;                      // Commands turned away by a full CMD_QUEUE, the host overran its credit
+    uint16_t HOMES;                           // Homing runs that found station 1 or confirmed the saved one
+    uint16_t HOME_FAILS;
+    uint16_t HOME_VERIFIED;                   // Of HOMES, saved position confirmed without a sweep
+    uint16_t HOME_SWEEP[STATS_SWEEP_BINS];    // Flags passed on each sweep
+    uint16_t HOME_MAX_MS;
+    uint32_t HOME_SUM_MS;
+} STATS_BLOCK;
+
+STATS_BLOCK STATS;
+uint16_t LOG_DROPPED = 0;                       // INFO and DEBUG lines dropped, see log.h
+unsigned long stats_since_ms = 0;               // Boot or STATS RESET
+unsigned long stats_home_ms = 0;                // Start of the homing run in progress
+TRACE_RING TRACE;
 // Homing
 int HOME_STATE = 0;
 int TRIGGER_COUNT = 0;
 bool HOMING_ACTIVE = 0;
 int HOMING = 0;
 int HOME_DIRECTION = 0;
-int HOMED_POS = 0;
+int HOME_STEP = HS_IDLE;
+uint8_t HOME_FLAGS = 0;               // Flags passed on the homing sweep
 int CURRENT_POS = -1;
 int PREVIOUS_POS = -1;
 String TRIGGER_ORDER = "";
 String TRIGGER_ORDER2 = "";
+// Motion
+volatile int MOTION_STATE = MOTION_IDLE;
+bool MOTION_EDGE = 0;                 // Set by sensor_update() when the ISR stopped us on a flag
+volatile uint8_t MOTION_PASSING = 0;  // Intermediate flags still to drive through on a multi-hop move
+uint8_t MOTION_PASS_EDGE = 0;         // Intermediate flags driven through, counted by sensor_update()
+int MOTION_DIRECTION = 0;
+int MOTION_TARGET = -1;               // Station a multi-hop move ends on, -1 for a single hop
+int MOTION_RESULT = MOTION_IDLE;      // How the last seek ended, MOTION_ARRIVED or MOTION_TIMEOUT
+unsigned long MOTION_BYPASS_MS = 0;
+unsigned long MOTION_TIMEOUT_MS = 0;
+unsigned long motion_timestamp = 0;   // Start of the current motion phase, in milliseconds
+unsigned long motion_start_us = 0;    // Relays switched on, for travel_learn()
+int MOTION_SEGMENT = -1;              // Segment this move started on, timed at the first flag, -1 for none
+// Travel times
+typedef struct {
+    uint16_t COUNT;       // Hops timed, saturates
+    float MEAN_MS;
+    float VAR_MS2;
+    float BASE_MS;        // MEAN_MS when the segment became trusted, drift is measured from here
+} TRAVEL_SEGMENT;
+
+typedef struct {
+    uint16_t MAGIC;
+    TRAVEL_SEGMENT SEG[TRAVEL_SEGMENTS];  // 1>2, 2>1, 2>3, 3>2, ...
+} TRAVEL_TABLE;
+
+static_assert(sizeof(TRAVEL_TABLE) <= EEPROM_POSITION_ADDR, "Travel table runs into the saved position");
+static_assert(TRAVEL_SEGMENTS <= 16, "TRAVEL_DIRTY and TRAVEL_WARNED have a bit per segment");
+
+TRAVEL_TABLE TRAVEL;
+uint16_t TRAVEL_DIRTY = 0;            // Segments changed since travel_save(), one bit each
+uint8_t TRAVEL_UNSAVED = 0;           // Hops timed since travel_save()
+uint16_t TRAVEL_WARNED = 0;           // Segments already reported as drifting this boot
+// Saved position
+typedef struct {
+    uint8_t SEQ;
+    int8_t  STATION;      // -1 if not homed
+    uint8_t FLAGS;
+    uint8_t CRC;          // frame_crc8() over the bytes above
+} POSITION_RECORD;
+
+POSITION_RECORD POSITION_SAVED;       // Newest record, as in EEPROM once position_flush() is done with it
+int8_t POSITION_SLOT = -1;            // Where it is, -1 if EEPROM has none yet
+uint8_t POSITION_UNWRITTEN = 0;       // Bytes of it, from the end, still to go to EEPROM
+int RESTORE_POS = -1;                 // Station the first HOME verifies instead of searching, -1 for a full home
+int VERIFY_POS = -1;                  // Station the verify jog in progress is looking for
+// Lights
+int DRAG_STEP = 0;                    // Position in the drag_lights() sequence, 0 when not running
+unsigned long drag_timestamp = 0;
 
 // Misc
 int SOURCE = 0;           // What authority, CLI, sensor etc is calling the function 
@@ -163,50 +305,87 @@ static LED_CFG LED_ARRAY[] = {
   { YELLOW,   0,   0 },      
 };
 
-// Homing position lookup table
-typedef struct { // Structure to store the alarm code light indicator configuration
-    int TORDER;      // Trigger order as determined by homing sequence
-    int START_POS;    // Derived start position, based on trigger order
-    int END_POS;         // Derived end position, based on trigger order
-} HOMED_CFG;
-
-// Accessed as HOMED_ARRAY[0].value, ordered by definitions and positions from left to right
-// example HOMED_ARRAY[3].END_POS would yield "A"
-// KNOWN HOMING SEQUENCES
-// NNLRNL
-static HOMED_CFG HOMED_ARRAY[] = { 
-  { RNNRNRL,    XA,   A },      
-  { NNRNRL,     AA,   A },
-  { LNNRNRL,    ABA,  A },
-  { RNNLRNRL,   ABB,  B },
-  { LRNNLRNRL,  ABB,  B },
-  { NNLRNRL,    BB,   B },
-  { LNNLRNRL,   BB,   B },
-  { RNNLRNL,    BCC,  C },
-  { LRNNLRNL,   BCC,  C },
-  { NNLRNL,     CC,   C },
-  { LNNLRNL,    CC,   C },
-//  { LNNLRNL,    XC,   C },
-};
-
 static unsigned long state_start_timestamp = 0;     // In milliseconds, for the delay_ms function
 
 char   CommandLine[COMMAND_BUFFER_LENGTH + 1];                 //Read commands into this buffer from Serial.  +1 in length for a termination char
 
 const char *delimiters            = ", \n \r \r\n";                    //commands can be separated by return, space or comma
 
-uint8_t RX_COMMAND = 99;
 char firstCMDVariable[COMMAND_BUFFER_LENGTH + 1];
-
-String rxWord;
-
-/*************************************************************************************************************
-     your Command Names Here
-*/
-const char *addCommandToken       = "add";                     //Modify here
-const char *subtractCommandToken  = "sub";                     //Modify here
-const char *MOVECommandToken      = "MOVE";                    //Modify here
-const char *HOMECommandToken      = "HOME";                    //Modify here
+FRAME_RX FrameRx;                     // Binary frame being received, see frame.h
+bool FRAME_MODE = 0;                  // Host last spoke in frames, so report in frames too
+uint8_t FRAME_SEQ = 0;                // SEQ of the binary command that started the current move
+uint16_t EVENT_SEQ = 0;               // SEQ of the last event sent, see event.h
+
+// COMMAND QUEUE - text lines and frames that arrive while the arm is moving or homing wait here, in order.
+// A station move replaces any station move still waiting, and can redirect the move in progress
+// instead of waiting for it, see command_queue_update().  STOP empties the queue.
+#define CMD_QUEUE_SIZE        4
+#define CMD_QUEUED_TEXT       0
+#define CMD_QUEUED_FRAME      1
+
+typedef struct {
+    uint8_t KIND;                             // CMD_QUEUED_TEXT or CMD_QUEUED_FRAME
+    int8_t  STATION;                          // Target if this is a station move, else 0
+    union {
+        char  LINE[COMMAND_BUFFER_LENGTH + 1];
+        FRAME BIN;
+    };
+} CMD_QUEUED;
+
+CMD_QUEUED CMD_QUEUE[CMD_QUEUE_SIZE];
+uint8_t CMD_QUEUE_HEAD = 0;           // Oldest entry
+uint8_t CMD_QUEUE_COUNT = 0;
+
+// CREDITS - flow control for the host, see CREDITcommand().  Free credits are the commands the host may
+// send without waiting: what CMD_QUEUE has room for, but never more than the RX buffer holds while a
+// delay() keeps us from reading it, less room kept for a MOVE STOP, which the host may always send.
+#define CMD_CREDIT_RESERVE    11    // "MOVE STOP" and its line end
+#define CMD_CREDITS_MAX       (((SERIAL_RX_BUFFER_SIZE) - 1 - (CMD_CREDIT_RESERVE)) / ((COMMAND_BUFFER_LENGTH) + 2))
+#define CREDIT_NONE           0xFF  // CREDIT_SENT_FREE before the first report
+
+bool CREDIT_REPORTING = 0;            // Host asked for CREDIT reports
+uint8_t CREDIT_TAKEN = 0;             // Lines and frames read from the port, mod 256
+uint8_t CREDIT_SENT_FREE = CREDIT_NONE;
+uint8_t CREDIT_SENT_TAKEN = 0;
+
+// Recent binary commands and how they were acked, so a resend is acked again but not run twice
+typedef struct {
+    uint8_t SEQ;
+    uint8_t OP;
+    uint8_t RESULT;
+} FRAME_SEEN;
+
+static FRAME_SEEN FRAME_SEEN_ARRAY[FRAME_WINDOW];
+uint8_t FRAME_SEEN_NEXT = 0;
+
+// Command table, see COMMAND_ARRAY
+#define COMMAND_NAME_LENGTH  8     // Longest command name + 1
+#define COMMAND_SUB_LENGTH   12    // Longest subcommand name + 1
+#define CMD_ARGS_NONE        0
+#define CMD_ARGS_INTS        1     // Two numbers follow, e.g. add 5, 10
+#define CMD_ARGS_STATION     2     // A station name or number follows, e.g. GOTO CNC, GOTO 3
+#define CMD_IMMEDIATE        1     // FLAGS: runs even while the arm is moving or homing
+
+typedef int (*COMMAND_HANDLER)(int arg1, int arg2);
+
+typedef struct {
+    uint8_t  LEN;                        // strlen(NAME), compared before anything else
+    uint16_t HASH;                       // token_hash(NAME)
+    uint8_t  SUB_LEN;                    // 0 for a command without subcommand, or the MOVE fallback
+    uint16_t SUB_HASH;
+    char     NAME[COMMAND_NAME_LENGTH];
+    char     SUB[COMMAND_SUB_LENGTH];
+    uint8_t  ARGS;                       // CMD_ARGS_*, what follows the name (and subcommand)
+    uint8_t  ARG;                        // Passed to HANDLER as arg1 when ARGS is CMD_ARGS_NONE
+    uint8_t  FLAGS;
+    COMMAND_HANDLER HANDLER;
+} COMMAND_CFG;
+
+// Evaluated by the compiler for the table, and at run time over a token of len characters
+constexpr uint16_t token_hash(const char *token, uint8_t len, uint16_t hash = 5381) {
+  return (len == 0) ? hash : token_hash(token + 1, len - 1, (uint16_t)((hash * 33) ^ (uint8_t)*token));
+}
 
 // FUNCTIONS
 
@@ -234,73 +413,191 @@ static void rgb_set_led (uint8_t reqColor) {
     static uint8_t currColor = 99;
     if ( currColor != reqColor) {
         currColor = reqColor;
-        digitalWrite(PIN_LED_RED, LED_ARRAY[reqColor].R);
-        digitalWrite(PIN_LED_GREEN, LED_ARRAY[reqColor].G);
+        FAST_LED_RED::write(LED_ARRAY[reqColor].R);
+        FAST_LED_GREEN::write(LED_ARRAY[reqColor].G);
     }
 }
 
+// Red, yellow, green, off at 333 ms a step, stepped by drag_lights_update() from loop()
 void drag_lights() {
   rgb_set_led(RED);
-  delay(333);
-  rgb_set_led(YELLOW);
-  delay(333);
-  rgb_set_led(GREEN);
-  delay(333);
-  rgb_set_led(OFF);
-  delay(333);
+  DRAG_STEP = 1;
+  drag_timestamp = millis();
+}
+
+void drag_lights_update() {
+  static const uint8_t DRAG_COLORS[] = { RED, YELLOW, GREEN, OFF };
+  if ((DRAG_STEP > 0) && (millis() - drag_timestamp >= 333)) {
+    drag_timestamp = millis();
+    if (DRAG_STEP < 4) {
+      rgb_set_led(DRAG_COLORS[DRAG_STEP]);
+      DRAG_STEP++;
+    } else {
+      DRAG_STEP = 0;
+    }
+  }
 }
 
 
 void motor_stop() {
         // If either motor pin is engaged, stop them both by setting them to HIGH since relay is LOW trigger
-        if (!(digitalRead(PIN_MOTOR_FWD)) || !(digitalRead(PIN_MOTOR_REV))) {
-           print2("MOTOR: STOP ISSUED BY SOURCE: ", SOURCE);
-          digitalWrite(PIN_MOTOR_FWD, HIGH); 
-          digitalWrite(PIN_MOTOR_REV, HIGH);
+        if (!(FAST_MOTOR_FWD::output()) || !(FAST_MOTOR_REV::output())) {
+          FAST_MOTOR_FWD::high();
+          FAST_MOTOR_REV::high();
+          trace_add(&TRACE, micros(), TRACE_MOTOR_STOP, SOURCE);
+          LOG_INFO("MOTOR: STOP ISSUED BY SOURCE: ", SOURCE);
           if ( SENSOR_STATE != 0 ) {
             rgb_set_led(OFF);  // If we didn't trigger the sensor, turn off the lights, otherwise sensor will
           }
         } 
 }
 
-// Proximity sensor pulls LOW when triggered
+// Proximity sensor pulls LOW when triggered.  Runs with interrupts off, so it only does what can't wait
+// for loop(): cut the relays if this flag is where we stop, and queue the edge for sensor_update().
+// An edge within SENSOR_DEBOUNCE_DELAY of the one before it is contact bounce, queued but not acted on.
+// The relays go first, before micros() and the debounce: any LOW edge we aren't driving past cuts them,
+// and a bounce puts them back a few microseconds later, far too soon for a relay to drop out.  LATENCY
+// is from the first instruction here to the relay port writes, so it leaves out the interrupt response
+// and the ISR prologue ahead of it.  edge.US is read just after the relays are cut.
 void isr_prox_sensor() {
-    int PREV_SOURCE = SOURCE;
-    SOURCE = SENSOR;
-    // Should really de-bounce but may not be necessary giving the call to stop motor
-    if (digitalRead(PIN_PROX_SENSOR) != SENSOR_STATE) {
-      delay(50);
-      //print2("SENSOR: Debounced for (ms): ", SENSOR_DEBOUNCE_DELAY);
-      //print2("SENSOR: OVERRIDE is ", SENSOR_OVERRIDE);
-      SENSOR_STATE = digitalRead(PIN_PROX_SENSOR);
-      if ((PREV_SENSOR_STATE != SENSOR_STATE) && (SENSOR_OVERRIDE == LOW)) {
-        if (SENSOR_STATE == LOW) {
-            //print2("SENSOR: !! TRIGGERED !! STATE: ", SENSOR_STATE);
-            motor_stop();
-            // Single pulse the green on detect
-            if (( HOMING <= 0 ) || ( HOMING >= 5 )) {
-              rgb_set_led(YELLOW);
-            } else {
-              rgb_set_led(GREEN);
-            }
+  uint16_t entry = LATENCY_NOW();
+  SENSOR_EDGE edge;
+  edge.LEVEL = FAST_PROX_SENSOR::read();
+  edge.FLAGS = 0;
+  bool flag = (edge.LEVEL == LOW) && (SENSOR_OVERRIDE == LOW);
+  bool passing = (MOTION_STATE == MOTION_TRAVEL) && (MOTION_PASSING > 0);
+  uint8_t fwd = FAST_MOTOR_FWD::output();
+  uint8_t rev = FAST_MOTOR_REV::output();
+  if (flag && !passing) {
+    FAST_MOTOR_FWD::high();
+    FAST_MOTOR_REV::high();
+    edge.LATENCY = LATENCY_NOW() - entry;
+  }
+  edge.US = micros();
+  bool settled = (edge.US - sensor_edge_us >= (SENSOR_DEBOUNCE_DELAY) * 1000UL);
+  sensor_edge_us = edge.US;
+  if (!settled) {
+    edge.FLAGS = EDGE_BOUNCE;
+    FAST_MOTOR_FWD::write(fwd);
+    FAST_MOTOR_REV::write(rev);
+  } else if (flag && passing) {
+    // Station on the way to the target, keep driving and let motion_update() count it
+    MOTION_PASSING--;
+    edge.FLAGS = EDGE_PASSED;
+  } else if (flag) {
+    edge.FLAGS = EDGE_STOPPED;
+  }
+  edge_push(&SENSOR_EDGES, &edge);
+}
 
-            if ((HOMING) && (HOME_DIRECTION == RIGHT)) {
-              TRIGGER_ORDER2 = TRIGGER_ORDER + 'R';
-              TRIGGER_ORDER = TRIGGER_ORDER2;
-            }
-            if ((HOMING) && (HOME_DIRECTION == LEFT)) {
-              TRIGGER_ORDER2 = TRIGGER_ORDER + 'L';
-              TRIGGER_ORDER = TRIGGER_ORDER2;
-            }
-        } else {
-            // print2("SENSOR: Trigger released.  STATE: ", SENSOR_STATE);
-        }
+void travel_learn(int segment, float ms);
+void event_send(uint8_t id, int arg);
+
+void stats_count(uint16_t * counter) {
+  if (*counter != 0xFFFF) {
+    (*counter)++;
+  }
+}
+
+// Duration into a sum and max
+void stats_time(unsigned long ms, uint16_t * max_ms, uint32_t * sum_ms) {
+  if (ms > 0xFFFF) {
+    ms = 0xFFFF;
+  }
+  if (ms > *max_ms) {
+    *max_ms = ms;
+  }
+  *sum_ms += ms;
+}
+
+// A seek outside homing just ended, MOTION_RESULT says how
+void stats_move() {
+  stats_count(&STATS.MOVES);
+  stats_count((MOTION_RESULT == MOTION_ARRIVED) ? &STATS.ARRIVED : &STATS.TIMEOUTS);
+  unsigned long ms = (micros() - motion_start_us) / 1000;
+  stats_count(&STATS.MOVE_HIST[(ms / STATS_MOVE_BIN_MS < STATS_MOVE_BINS) ? (ms / STATS_MOVE_BIN_MS) : (STATS_MOVE_BINS - 1)]);
+  stats_time(ms, &STATS.MOVE_MAX_MS, &STATS.MOVE_SUM_MS);
+}
+
+// A homing run ended, -1 for a failure
+void stats_home(int station, bool verified) {
+  if (station < 0) {
+    stats_count(&STATS.HOME_FAILS);
+    return;
+  }
+  stats_count(&STATS.HOMES);
+  if (verified) {
+    stats_count(&STATS.HOME_VERIFIED);
+  } else {
+    stats_count(&STATS.HOME_SWEEP[(HOME_FLAGS < STATS_SWEEP_BINS) ? HOME_FLAGS : (STATS_SWEEP_BINS - 1)]);
+  }
+  stats_time(millis() - stats_home_ms, &STATS.HOME_MAX_MS, &STATS.HOME_SUM_MS);
+}
+
+// Polled from loop(), everything about a sensor edge the ISR left for later
+void sensor_update() {
+  SENSOR_EDGE edge;
+  while (edge_pop(&SENSOR_EDGES, &edge)) {
+    SENSOR_STATE = edge.LEVEL;
+    trace_add(&TRACE, edge.US, TRACE_SENSOR, edge.LEVEL | (edge.FLAGS << 1));
+    if (!(edge.FLAGS & EDGE_BOUNCE)) {
+      event_send(EVENT_SENSOR, edge.LEVEL | (edge.FLAGS << 1));
+    }
+    stats_count(&STATS.ISR);
+    if (edge.FLAGS & EDGE_BOUNCE) {
+      stats_count(&STATS.BOUNCES);
+    }
+    if (!(edge.FLAGS & (EDGE_STOPPED | EDGE_PASSED))) {
+      continue;
+    }
+    if (edge.FLAGS & EDGE_STOPPED) {
+      LATENCY_COUNT++;
+      LATENCY_SUM += edge.LATENCY;
+      if (edge.LATENCY < LATENCY_MIN) {
+        LATENCY_MIN = edge.LATENCY;
+      }
+      if (edge.LATENCY > LATENCY_MAX) {
+        LATENCY_MAX = edge.LATENCY;
+      }
+      if (MOTION_STATE == MOTION_TRAVEL) {
+        LOG_INFO("MOTOR: STOP ISSUED BY SOURCE: ", SENSOR);   // The ISR already cut the relays
+        MOTION_EDGE = 1;    // Let motion_update() report arrival now rather than at SAFETY_CUTOFF
+      }
+      // Single pulse the green on detect
+      if (( HOMING <= 0 ) || ( HOMING >= 5 )) {
+        rgb_set_led(YELLOW);
+      } else {
+        rgb_set_led(GREEN);
       }
+    } else {
+      MOTION_PASS_EDGE++;
+      stats_count(&STATS.PASSES);
     }
-
-  PREV_SENSOR_STATE = SENSOR_STATE;
-  SOURCE = PREV_SOURCE;
-} 
+    if ((MOTION_SEGMENT >= 0) && (MOTION_STATE == MOTION_TRAVEL)) {
+      // First flag since the relays switched on.  Later hops of a multi-hop move start at speed, so
+      // they aren't timed, their limit from a standing start is only a little loose for them.
+      travel_learn(MOTION_SEGMENT, (edge.US - motion_start_us) / 1000.0);
+      MOTION_SEGMENT = -1;
+    }
+    if ((HOMING_ACTIVE) && (HOME_DIRECTION == RIGHT)) {
+      TRIGGER_ORDER2 = TRIGGER_ORDER + 'R';
+      TRIGGER_ORDER = TRIGGER_ORDER2;
+    }
+    if ((HOMING_ACTIVE) && (HOME_DIRECTION == LEFT)) {
+      TRIGGER_ORDER2 = TRIGGER_ORDER + 'L';
+      TRIGGER_ORDER = TRIGGER_ORDER2;
+    }
+  }
+  if (SENSOR_EDGES.DROPPED != SENSOR_EDGES_DROPPED) {
+    LOG_WARN("SENSOR: WARNING edges dropped, queue full. Total: ", SENSOR_EDGES.DROPPED);
+    event_send(EVENT_FAULT, EVENT_FAULT_EDGES);
+    for (uint8_t lost = SENSOR_EDGES.DROPPED - SENSOR_EDGES_DROPPED; lost > 0; lost--) {
+      stats_count(&STATS.DROPPED);
+      stats_count(&STATS.ISR);
+    }
+    SENSOR_EDGES_DROPPED = SENSOR_EDGES.DROPPED;
+  }
+}
 
 void sensor_bypass() {
     SENSOR_OVERRIDE = 1;
@@ -310,71 +607,455 @@ void sensor_bypass() {
     //print2("SENSOR_BYPASS: Enabled sensor interupt, SENSOR_OVERRIDE: ", SENSOR_OVERRIDE);      
 }
 
+void frame_send(uint8_t op, uint8_t seq, const uint8_t *payload, uint8_t len) {
+  uint8_t buf[FRAME_MAX_SIZE];
+  Serial.write(buf, frame_encode(buf, op, seq, payload, len));
+}
+
+// SAVED POSITION
+uint8_t position_crc(const POSITION_RECORD *rec) {
+  return frame_crc8(frame_crc8(frame_crc8(0, rec->SEQ), (uint8_t)rec->STATION), rec->FLAGS);
+}
+
+bool position_read(uint8_t slot, POSITION_RECORD *rec) {
+  EEPROM.get(EEPROM_POSITION_ADDR + slot * sizeof(POSITION_RECORD), *rec);
+  return (rec->CRC == position_crc(rec)) && ((rec->SEQ % POSITION_SLOTS) == slot) &&
+         !((rec->SEQ == 0xFF) && (rec->FLAGS == 0xFF));
+}
+
+// Find the newest record.  A write torn by a power cut fails its CRC, leaving the one before it newest.
+void position_load() {
+  POSITION_RECORD rec;
+  POSITION_RECORD next;
+  POSITION_SLOT = -1;
+  for (uint8_t i = 0; i < POSITION_SLOTS; i++) {
+    if (!position_read(i, &rec)) {
+      continue;
+    }
+    if (!position_read((i + 1) % POSITION_SLOTS, &next) || (next.SEQ != (uint8_t)(rec.SEQ + 1))) {
+      POSITION_SAVED = rec;
+      POSITION_SLOT = i;
+      break;
+    }
+  }
+  if (POSITION_SLOT < 0) {
+    LOG_INFO("POSITION: None saved, HOME will search");
+  } else if (POSITION_SAVED.FLAGS & POSITION_MOVING) {
+    LOG_INFO("POSITION: Moved since saved, HOME searches. Station: ", POSITION_SAVED.STATION);
+  } else if ((POSITION_SAVED.STATION < 1) || (POSITION_SAVED.STATION > STATION_COUNT)) {
+    LOG_INFO("POSITION: Saved while not homed, HOME will search");
+  } else {
+    RESTORE_POS = POSITION_SAVED.STATION;
+    LOG_INFO("POSITION: Saved, HOME will verify. Station: ", RESTORE_POS);
+  }
+}
+
+// Write what is left of the newest record, a byte at a time while the EEPROM is free unless told to wait.
+// A byte takes 3.3 ms to program but the AVR does that in the background, so loop() never waits on it.
+// CRC goes last, a record cut short by a power cut reads as no record.
+void position_flush(bool wait) {
+  const uint8_t *rec = (const uint8_t *)&POSITION_SAVED;
+  int addr = EEPROM_POSITION_ADDR + POSITION_SLOT * sizeof(POSITION_RECORD);
+  while (POSITION_UNWRITTEN && (wait || eeprom_is_ready())) {
+    uint8_t i = sizeof(POSITION_RECORD) - POSITION_UNWRITTEN--;
+    EEPROM.update(addr + i, rec[i]);
+  }
+}
+
+// Append a record in the next slot, written out by position_flush() from loop()
+void position_write(int station, uint8_t flags) {
+  if ((POSITION_SLOT >= 0) && (POSITION_SAVED.STATION == station) && (POSITION_SAVED.FLAGS == flags)) {
+    return;
+  }
+  position_flush(true);     // The slot after a half written one would read as the older record's successor
+  POSITION_RECORD rec;
+  rec.SEQ = (POSITION_SLOT < 0) ? 0 : (uint8_t)(POSITION_SAVED.SEQ + 1);
+  rec.STATION = station;
+  rec.FLAGS = flags;
+  rec.CRC = position_crc(&rec);
+  POSITION_SLOT = rec.SEQ % POSITION_SLOTS;
+  POSITION_SAVED = rec;
+  POSITION_UNWRITTEN = sizeof(POSITION_RECORD);
+  position_flush(false);
+}
+
+// The relays just switched on, whatever is saved no longer says where the arm is.  Written once per
+// move: a redirect or homing step switches them on again with the record already marked moving.  It has
+// to start now, not once idle like travel_save(), or a power cut mid move would leave the old station
+// looking confirmed; position_flush() keeps it from holding up the start of the move.
+void position_moving() {
+  RESTORE_POS = -1;
+  if ((POSITION_SLOT >= 0) && (POSITION_SAVED.FLAGS & POSITION_MOVING)) {
+    return;
+  }
+  position_write(POSITION_SAVED.STATION, POSITION_MOVING);
+}
+
+// The arm stopped and CURRENT_POS is confirmed, or -1
+void position_save() {
+  if ((FAST_MOTOR_FWD::output() == LOW) || (FAST_MOTOR_REV::output() == LOW)) {
+    return;   // Only passing through on the way somewhere, still moving
+  }
+  position_write(CURRENT_POS, 0);
+}
+
 void report_pos() {
-  Serial.print("OK ");
-  Serial.print("PPOS: ");
-  Serial.print(PREVIOUS_POS);
-  Serial.print(" CPOS: ");
-  Serial.println(CURRENT_POS);
+  position_save();
+  if (FRAME_MODE) {
+    uint8_t pos[2] = { (uint8_t)PREVIOUS_POS, (uint8_t)CURRENT_POS };
+    frame_send(FRAME_OP_POS, FRAME_SEQ, pos, 2);
+    return;
+  }
+  // One write, the host waits on this line.  Never dropped, so this may wait for room in the TX buffer.
+  char line[32];
+  strcpy_P(line, PSTR("OK PPOS: "));
+  ltoa(PREVIOUS_POS, line + strlen(line), 10);
+  strcat_P(line, PSTR(" CPOS: "));
+  ltoa(CURRENT_POS, line + strlen(line), 10);
+  strcat_P(line, PSTR("\r\n"));
+  Serial.write((const uint8_t *)line, strlen(line));
+}
+
+// Tell the host about a state change now, see event.h.  Like a log line it fits in the TX buffer, so at
+// worst it waits for that to drain.
+void event_send(uint8_t id, int arg) {
+  EVENT_SEQ++;
+  if (FRAME_MODE) {
+    uint8_t payload[EVENT_PAYLOAD] = { id, (uint8_t)EVENT_SEQ, (uint8_t)(EVENT_SEQ >> 8), (uint8_t)arg,
+                                       (uint8_t)(arg >> 8) };
+    frame_send(FRAME_OP_EVENT, FRAME_SEQ, payload, EVENT_PAYLOAD);
+  } else {
+    char line[24];
+    strcpy_P(line, PSTR("EV "));
+    ltoa(EVENT_SEQ, line + strlen(line), 10);
+    strcat_P(line, PSTR(" "));
+    ltoa(id, line + strlen(line), 10);
+    strcat_P(line, PSTR(" "));
+    ltoa(arg, line + strlen(line), 10);
+    strcat_P(line, PSTR("\r\n"));
+    Serial.write((const uint8_t *)line, strlen(line));
+  }
 }
 
 void motor_forward() { 
     // Check that we aren't already engaged
-    if (digitalRead(PIN_MOTOR_REV) == LOW) {
-        Serial.println("ERROR: motor_forward ignored, motor_reverse already engaged");
+    if (FAST_MOTOR_REV::output() == LOW) {
+        LOG_ERROR("ERROR: motor_forward ignored, motor_reverse engaged");
+        event_send(EVENT_FAULT, EVENT_FAULT_RELAYS);
    } else {
-        if ((CURRENT_POS < 3) || (HOMING_ACTIVE == 1) || (CURRENT_POS <= -1)) {
+        if ((CURRENT_POS < STATION_COUNT) || (HOMING_ACTIVE == 1) || (CURRENT_POS <= -1)) {
           rgb_set_led(RED);
-          print2("MOTOR Forward: HOMING = ", HOMING);
+          LOG_DEBUG("MOTOR Forward: HOMING = ", HOMING);
           if ( (HOMING >= 1) && (HOMING < 5) ) {
             // If we're homing, use yellow instead of red
             rgb_set_led(YELLOW);
           }
           //Serial.println("MOTOR: FORWARD");
-          digitalWrite(PIN_MOTOR_FWD, LOW);
+          FAST_MOTOR_FWD::low();
+          trace_add(&TRACE, micros(), TRACE_MOTOR_RIGHT, CURRENT_POS);
+          position_moving();
         } else {
-          Serial.print("ERROR: Requested travel would exceed range.  CPOS: ");
-          Serial.println(CURRENT_POS);
+          LOG_ERROR("ERROR: Requested travel would exceed range.  CPOS: ", CURRENT_POS);
+          event_send(EVENT_FAULT, EVENT_FAULT_RANGE);
         }
      }
 }
 
 void motor_reverse() {
     // Check that we aren't already engaged
-    if (digitalRead(PIN_MOTOR_FWD) == LOW)  { 
-      Serial.println("ERROR: motor_reverse ignored, motor_forward already engaged");
+    if (FAST_MOTOR_FWD::output() == LOW)  { 
+      LOG_ERROR("ERROR: motor_reverse ignored, motor_forward engaged");
+      event_send(EVENT_FAULT, EVENT_FAULT_RELAYS);
     } else {
         if (( CURRENT_POS > 1) || (HOMING_ACTIVE == 1) || (CURRENT_POS <= -1)) { 
           rgb_set_led(RED);
-          print2("MOTOR REVERSE: HOMING = ", HOMING);
+          LOG_DEBUG("MOTOR REVERSE: HOMING = ", HOMING);
           if ( (HOMING >= 1) && (HOMING < 5) ) {
             // If we're homing, use yellow instead of red
             rgb_set_led(YELLOW);
           }
           //Serial.println("MOTOR: Reverse");
-          digitalWrite(PIN_MOTOR_REV, LOW);
+          FAST_MOTOR_REV::low();
+          trace_add(&TRACE, micros(), TRACE_MOTOR_LEFT, CURRENT_POS);
+          position_moving();
         } else {
-          Serial.print("ERROR: Requested travel would exceed range.  CPOS: ");
-          Serial.println(CURRENT_POS);
+          LOG_ERROR("ERROR: Requested travel would exceed range.  CPOS: ", CURRENT_POS);
+          event_send(EVENT_FAULT, EVENT_FAULT_RANGE);
         }
     }
   }
 
-  void move_right() {
-    PREVIOUS_POS = CURRENT_POS;
+// TRAVEL TIMES
+// Segment for a hop from station in direction, -1 if the position is unknown or there is no such hop
+int travel_segment(int station, int direction) {
+  if ((direction == RIGHT) && (station >= 1) && (station < STATION_COUNT)) {
+    return ((station - 1) * 2);
+  }
+  if ((direction == LEFT) && (station > 1) && (station <= STATION_COUNT)) {
+    return ((station - 2) * 2) + 1;
+  }
+  return -1;
+}
+
+void travel_print_segment(int segment) {
+  Serial.print((segment / 2) + 1 + (segment % 2));
+  Serial.print('>');
+  Serial.print((segment / 2) + 2 - (segment % 2));
+}
+
+// Longest a hop on segment may take, from the relay switching on to the flag, before it counts as stalled
+unsigned long travel_limit_ms(int segment) {
+  if ((segment < 0) || (TRAVEL.SEG[segment].COUNT < TRAVEL_TRUST_COUNT)) {
+    return TRAVEL_DEFAULT_MS;
+  }
+  const TRAVEL_SEGMENT *seg = &TRAVEL.SEG[segment];
+  float sd = sqrt(seg->VAR_MS2);
+  if (sd < seg->MEAN_MS * (TRAVEL_SIGMA_MIN_PCT) / 100) {
+    sd = seg->MEAN_MS * (TRAVEL_SIGMA_MIN_PCT) / 100;
+  }
+  unsigned long limit = seg->MEAN_MS + (TRAVEL_SIGMAS) * sd + (TRAVEL_MARGIN_MS);
+  if (limit < (SENSOR_FALLOFF) + (TRAVEL_MARGIN_MS)) {
+    return (SENSOR_FALLOFF) + (TRAVEL_MARGIN_MS);
+  }
+  return (limit > (TRAVEL_MAX_MS)) ? (TRAVEL_MAX_MS) : limit;
+}
+
+// Hop limit for homing seeks.  Homing doesn't know which segment it is on, so this is the slowest
+// learned limit once every segment is trusted, TRAVEL_DEFAULT_MS until then.
+unsigned long homing_hop_ms() {
+  unsigned long longest = 0;
+  for (uint8_t i = 0; i < TRAVEL_SEGMENTS; i++) {
+    if (TRAVEL.SEG[i].COUNT < TRAVEL_TRUST_COUNT) {
+      return TRAVEL_DEFAULT_MS;
+    }
+    if (travel_limit_ms(i) > longest) {
+      longest = travel_limit_ms(i);
+    }
+  }
+  return longest;
+}
+
+// Actuator wear shows up as hops slowly getting longer (or shorter) long before one stalls
+void travel_check_drift(int segment) {
+  const TRAVEL_SEGMENT *seg = &TRAVEL.SEG[segment];
+  if ((seg->COUNT <= TRAVEL_TRUST_COUNT) || (TRAVEL_WARNED & (1U << segment))) {
+    return;
+  }
+  if (fabs(seg->MEAN_MS - seg->BASE_MS) > seg->BASE_MS * (TRAVEL_DRIFT_PCT) / 100) {
+    TRAVEL_WARNED |= (1U << segment);
+    // One line, "1>2 480 to 530", so it goes out in one write like any other log line
+    char hop[24];
+    ltoa((segment / 2) + 1 + (segment % 2), hop, 10);
+    strcat_P(hop, PSTR(">"));
+    ltoa((segment / 2) + 2 - (segment % 2), hop + strlen(hop), 10);
+    strcat_P(hop, PSTR(" "));
+    ltoa((long)seg->BASE_MS, hop + strlen(hop), 10);
+    strcat_P(hop, PSTR(" to "));
+    ltoa((long)seg->MEAN_MS, hop + strlen(hop), 10);
+    LOG_WARN("TRAVEL: WARNING drift, hop base to mean ms: ", hop);
+  }
+}
+
+// Fold one timed hop into the segment's running mean and variance.  Both are averaged over at most
+// TRAVEL_WINDOW hops, so they follow the actuator as it wears instead of settling on its first week.
+void travel_learn(int segment, float ms) {
+  TRAVEL_SEGMENT *seg = &TRAVEL.SEG[segment];
+  if (seg->COUNT < 0xFFFF) {
+    seg->COUNT++;
+  }
+  float n = (seg->COUNT < TRAVEL_WINDOW) ? seg->COUNT : TRAVEL_WINDOW;
+  float d = ms - seg->MEAN_MS;
+  seg->MEAN_MS += d / n;
+  seg->VAR_MS2 += (d * (ms - seg->MEAN_MS) - seg->VAR_MS2) / n;
+  if (seg->COUNT == TRAVEL_TRUST_COUNT) {
+    seg->BASE_MS = seg->MEAN_MS;
+    TRAVEL_UNSAVED = TRAVEL_SAVE_EVERY;   // Save the baseline now
+  }
+  TRAVEL_DIRTY |= (1U << segment);
+  if (TRAVEL_UNSAVED < TRAVEL_SAVE_EVERY) {
+    TRAVEL_UNSAVED++;
+  }
+  travel_check_drift(segment);
+}
+
+void travel_load() {
+  EEPROM.get(EEPROM_TRAVEL_ADDR, TRAVEL);
+  if (TRAVEL.MAGIC != TRAVEL_MAGIC) {
+    memset(&TRAVEL, 0, sizeof(TRAVEL));
+    TRAVEL.MAGIC = TRAVEL_MAGIC;
+    TRAVEL_DIRTY = (1UL << TRAVEL_SEGMENTS) - 1;
+    return;
+  }
+  for (uint8_t i = 0; i < TRAVEL_SEGMENTS; i++) {
+    travel_check_drift(i);
+  }
+}
+
+// Write changed segments back.  Each EEPROM byte takes 3.3 ms, so loop() only calls this while idle.
+void travel_save(bool force) {
+  if ((TRAVEL_DIRTY == 0) || (!force && (TRAVEL_UNSAVED < TRAVEL_SAVE_EVERY))) {
+    return;
+  }
+  EEPROM.put(EEPROM_TRAVEL_ADDR, TRAVEL.MAGIC);
+  for (uint8_t i = 0; i < TRAVEL_SEGMENTS; i++) {
+    if (TRAVEL_DIRTY & (1U << i)) {
+      EEPROM.put(EEPROM_TRAVEL_ADDR + offsetof(TRAVEL_TABLE, SEG) + i * sizeof(TRAVEL_SEGMENT), TRAVEL.SEG[i]);
+    }
+  }
+  TRAVEL_DIRTY = 0;
+  TRAVEL_UNSAVED = 0;
+}
+
+void homing_step();
+
+// Seek in direction RIGHT or LEFT until a flag trips or timeout ms pass, returns immediately.
+// The sensor is ignored for the first bypass ms so we can drive off the flag we're sitting on.
+void motion_start(int direction, unsigned long bypass, unsigned long timeout) {
+  MOTION_DIRECTION = direction;
+  MOTION_BYPASS_MS = bypass;
+  MOTION_TIMEOUT_MS = timeout;
+  if (direction == RIGHT) {
     motor_forward();
-    sensor_bypass();
-    // Blocking, Safety stop after x milliseconds in case sensor hasn't tripped
-    delay(SAFETY_CUTOFF);
-    motor_stop();
-    if (CURRENT_POS < 3) {
+  } else {
+    motor_reverse();
+  }
+  MOTION_EDGE = 0;
+  MOTION_PASSING = 0;
+  MOTION_PASS_EDGE = 0;
+  MOTION_SEGMENT = -1;
+  motion_start_us = micros();
+  motion_timestamp = millis();
+  if (bypass > 0) {
+    SENSOR_OVERRIDE = 1;          // Same as sensor_bypass(), without blocking for SENSOR_FALLOFF
+    MOTION_STATE = MOTION_BYPASS;
+  } else {
+    SENSOR_OVERRIDE = 0;
+    MOTION_STATE = MOTION_TRAVEL;
+  }
+}
+
+// Start a single station hop
+void motion_hop(int direction) {
+  int segment = travel_segment(CURRENT_POS, direction);
+  PREVIOUS_POS = CURRENT_POS;
+  motion_start(direction, SENSOR_FALLOFF, travel_limit_ms(segment) - (SENSOR_FALLOFF));
+  MOTION_SEGMENT = segment;
+  event_send(EVENT_MOVE, (MOTION_TARGET > 0) ? MOTION_TARGET : CURRENT_POS + ((direction == RIGHT) ? 1 : -1));
+}
+
+void motion_route();
+
+// Hop finished, by sensor edge or safety cutoff.  Update position, report, then continue a multi-hop move.
+void motion_finish() {
+  if (MOTION_RESULT == MOTION_TIMEOUT) {
+    LOG_WARN("MOTION: WARNING cutoff reached, no sensor edge. CPOS: ", CURRENT_POS);
+  }
+  if (MOTION_DIRECTION == RIGHT) {
+    if (CURRENT_POS < STATION_COUNT) {
       CURRENT_POS = ((CURRENT_POS) + 1);
     }
     report_pos();
-    if (CURRENT_POS == 4) {
-      print2("motor_forward: ERROR we moved past position 3. CURRENT_POS = ", CURRENT_POS);
-    } 
-  } 
+    if (CURRENT_POS > STATION_COUNT) {
+      LOG_ERROR("ERROR: (motor_forward) Past the last station. CPOS: ", CURRENT_POS);
+    }
+  } else {
+    if ( CURRENT_POS > 1) {
+      CURRENT_POS = ((CURRENT_POS) - 1);
+    }
+    report_pos();
+    if (CURRENT_POS == 0) {
+      LOG_ERROR("ERROR: (move_left) Moved past position 1. CPOS: ", CURRENT_POS);
+    }
+  }
+  event_send((MOTION_RESULT == MOTION_ARRIVED) ? EVENT_ARRIVED : EVENT_TIMEOUT, CURRENT_POS);
+  if ((MOTION_TARGET > 0) && (CURRENT_POS > 0) && (CURRENT_POS != MOTION_TARGET)) {
+    motion_route();   // After a safety cutoff or a redirect back the way we came
+  } else {
+    MOTION_TARGET = -1;
+  }
+}
+
+// Polled from loop(), advances the current seek without blocking.  When it ends the result goes
+// to homing_step() while homing, otherwise to motion_finish().
+void motion_update() {
+  switch (MOTION_STATE) {
+    case MOTION_BYPASS:
+      if (millis() - motion_timestamp >= MOTION_BYPASS_MS) {
+        SENSOR_OVERRIDE = 0;
+        motion_timestamp = millis();
+        MOTION_STATE = MOTION_TRAVEL;
+      }
+      return;
+
+    case MOTION_TRAVEL:
+      if (MOTION_PASS_EDGE) {
+        // Drove through an intermediate station, the safety cutoff restarts for the next one.
+        // It is a whole hop away now, with no bypass window in front of it.
+        if (HOMING_ACTIVE) {
+          HOME_FLAGS += MOTION_PASS_EDGE;
+          MOTION_TIMEOUT_MS = homing_hop_ms();
+        } else {
+          CURRENT_POS = CURRENT_POS + ((MOTION_DIRECTION == RIGHT) ? MOTION_PASS_EDGE : -MOTION_PASS_EDGE);
+          MOTION_TIMEOUT_MS = travel_limit_ms(travel_segment(CURRENT_POS, MOTION_DIRECTION));
+        }
+        MOTION_PASS_EDGE = 0;
+        motion_timestamp = millis();
+      }
+      if (MOTION_EDGE) {
+        MOTION_RESULT = MOTION_ARRIVED;
+      } else if (millis() - motion_timestamp >= MOTION_TIMEOUT_MS) {
+        // Safety stop after MOTION_TIMEOUT_MS in case sensor hasn't tripped
+        MOTION_RESULT = MOTION_TIMEOUT;
+      } else {
+        return;
+      }
+      motor_stop();
+      MOTION_STATE = MOTION_IDLE;
+      if (HOMING_ACTIVE) {
+        homing_step();
+      } else {
+        stats_move();
+        trace_add(&TRACE, micros(), TRACE_MOVE_END, MOTION_RESULT);
+        motion_finish();
+      }
+      return;
+
+    default:
+      return;
+  }
+}
+
+// Abort the current move or homing run, the arm is now somewhere between stations
+void motion_abort() {
+  motor_stop();
+  bool aborted = HOMING_ACTIVE || (MOTION_STATE != MOTION_IDLE);
+  if (aborted) {
+    stats_count(&STATS.ABORTS);
+  }
+  if (HOMING_ACTIVE) {
+    HOMING_ACTIVE = 0;
+    HOMING = 0;
+    HOME_STEP = HS_IDLE;
+    TRIGGER_ORDER = TRIGGER_ORDER2 = "";
+    LOG_WARN("HOMING: Aborted, machine not homed. SOURCE: ", SOURCE);
+  }
+  if (MOTION_STATE != MOTION_IDLE) {
+    SENSOR_OVERRIDE = 0;
+    MOTION_STATE = MOTION_IDLE;
+    MOTION_TARGET = -1;
+    PREVIOUS_POS = CURRENT_POS;
+    CURRENT_POS = -1;
+    report_pos();
+  }
+  if (aborted) {
+    event_send(EVENT_ABORT, SOURCE);
+  }
+}
+
+// Move to the station on the right, non-blocking
+void move_right() {
+  motion_hop(RIGHT);
+}
 
 void move_gr1() {
   motor_forward();
@@ -384,256 +1065,193 @@ void move_gr1() {
   motor_stop();
 }
 
+// Move to the station on the left, non-blocking
 void move_left() {
-  PREVIOUS_POS = CURRENT_POS;
-  motor_reverse();
-  sensor_bypass();
-  // Blocking, Safety stop after x milliseconds in case sensor hasn't tripped
-  delay(SAFETY_CUTOFF);
-  motor_stop();
-  if ( CURRENT_POS > 1) {
-    CURRENT_POS = ((CURRENT_POS) - 1);
-  }
-  report_pos();
-  if (CURRENT_POS == 0) {
-    print2("ERROR: (move_left) Moved back past position 1. CURRENT_POS = ", CURRENT_POS);
-  } 
+  motion_hop(LEFT);
 }
 
-void move_gl1() { 
-        motor_reverse();
-        sensor_bypass();
-        // Blocking, Safety stop after x milliseconds in case sensor hasn't tripped
-        delay(SENSOR_FALLOFF);
-        motor_stop();
+// Drive towards MOTION_TARGET in one sweep, passing through the stations in between
+void motion_route() {
+  int hops = MOTION_TARGET - CURRENT_POS;
+  motion_hop((hops > 0) ? RIGHT : LEFT);
+  MOTION_PASSING = abs(hops) - 1;   // Still inside the bypass window, the ISR can't see a flag yet
 }
 
+// Travel to station, non-blocking.  Stops only on the target's flag.
+void move_to(int station) {
+  if (station == CURRENT_POS) {
+    return;   // We're already where we need to be
+  }
+  MOTION_TARGET = station;
+  motion_route();
+}
 
-// Move half the expected distance between points to try and locate a neighbor for reference
-void homing_1 () {
-  // print2("\t\t\tHOMING STAGE: ", HOMING);
-  if ((HOMING == 1) && (SENSOR_STATE != 0)) {
-    HOME_DIRECTION = RIGHT;
-    motor_forward();
-    // No sensor_bypass here because we didn't start on a sensor
-    //sensor_bypass();
-    // Blocking, Safety stop after x milliseconds in case sensor hasn't tripped
-    delay_ms(HOMING_TIMEOUT_SHORT);
-    motor_stop();
-    //delay(250);
-    // Return to start position and seek the same distance in opposite direction
-    if (SENSOR_STATE != LOW) {
-      HOME_DIRECTION = LEFT;
-      motor_reverse();
-      // sensor_bypass(); // Not needed, we aren't starting on a sensor
-      delay(HOMING_TIMEOUT_SHORT * 2);  // Because we need to return and then seek in the other dir
-      motor_stop();
-      delay(250);
-    
-      // If we still haven't found a starting reference, go further and try again
-      if (SENSOR_STATE != LOW) {
-        HOME_DIRECTION = RIGHT;
-        motor_forward();
-        // No sensor_bypass here because we didn't start on a sensor
-        //sensor_bypass();
-        // Blocking, Safety stop after x milliseconds in case sensor hasn't tripped
-        delay((HOMING_TIMEOUT_SHORT) * 3 );
-        motor_stop();
-        delay(250);
-      }
-    }
-
-    if (SENSOR_STATE != LOW) {
-      print2("HOMING_1: No stops detected in HOMING STAGE 1.  NEED A BETTER APPROACH.  SOURCE: ", SOURCE);
-    } else {
-      if (HOME_DIRECTION == RIGHT) {
-        print2("HOMING_1: First stop detected RIGHT of start position, TRIGGER_ORDER: ", TRIGGER_ORDER);
-      } else {
-       print2("HOMING_1: First stop detected LEFT of start position, TRIGGER_ORDER: ", TRIGGER_ORDER);
-      }
-    }
+// Point the move in progress at a new station without stopping.  Further on in the same direction just
+// changes how many flags the ISR drives through; behind us, the arm stops on the flag it is heading for
+// and motion_finish() routes back from there.  False if there is no station move to redirect (a single
+// hop or homing), or an edge is still on its way to loop() - try again after sensor_update().
+bool motion_redirect(int station) {
+  if ((MOTION_TARGET <= 0) || HOMING_ACTIVE || (MOTION_STATE == MOTION_IDLE)) {
+    return false;
   }
-  TRIGGER_ORDER2 = TRIGGER_ORDER + 'N';
-  TRIGGER_ORDER = TRIGGER_ORDER2;
-  // print2("HOMING_1: TRIGGER_ORDER: ", TRIGGER_ORDER);
-  HOMING = 2; 
+  noInterrupts();
+  if ((SENSOR_EDGES.HEAD != SENSOR_EDGES.TAIL) || MOTION_EDGE || MOTION_PASS_EDGE) {
+    interrupts();
+    return false;
   }
+  int next = CURRENT_POS + ((MOTION_DIRECTION == RIGHT) ? 1 : -1);
+  int ahead = (MOTION_DIRECTION == RIGHT) ? (station - next) : (next - station);
+  MOTION_PASSING = (ahead > 0) ? ahead : 0;
+  MOTION_TARGET = station;
+  interrupts();
+  stats_count(&STATS.REDIRECTS);
+  trace_add(&TRACE, micros(), TRACE_REDIRECT, station);
+  event_send(EVENT_MOVE, station);
+  LOG_INFO("MOTION: Redirected to station ", station);
+  return true;
+}
 
-void homing_2 () {
-  // print2("\t\t\tHOMING STAGE: ", HOMING);
-  if ((HOMING == 2) && (SENSOR_STATE != 0)) {
-    switch (HOME_DIRECTION) {
-      // Seek in the opposite direction of the first detected point or last seek direction
-      case RIGHT:                         
-        HOME_DIRECTION = LEFT;
+void move_gl1() { 
         motor_reverse();
         sensor_bypass();
         // Blocking, Safety stop after x milliseconds in case sensor hasn't tripped
-         delay((HOMING_TIMEOUT_SHORT) * (2));
+        delay(SENSOR_FALLOFF);
         motor_stop();
-        //delay(250);
-        break;
+}
 
-      case LEFT:
-        HOME_DIRECTION = RIGHT;
-        motor_forward();
-        sensor_bypass();
-        // Blocking, Safety stop after x milliseconds in case sensor hasn't tripped
-        delay((HOMING_TIMEOUT_SHORT) * (2));
-        motor_stop();
-        //delay(250);
-        break;
 
-      default:
-        print2("ERROR: (HOMING2) HOME_DIRECTION invalid, fell through to switch case default. HOME_DIRECTION: ", HOME_DIRECTION);
-    }
+// HOMING
+// Homing runs as seeks driven by motion_update(), so serial input, STOP and STATUS are serviced throughout.
+// Every flag looks the same, so instead of decoding where it started the arm sweeps LEFT straight through
+// flags until a whole hop goes by without one, which leaves it past station 1, then seeks RIGHT onto the
+// first flag.  That is station 1 however many stations there are, in one pass over the rail.  There are
+// never more than STATION_COUNT flags to the left, so the sweep stops on the one after passing
+// STATION_COUNT - 1 of them: started right of the last station that is station 1, and no hop is wasted.
+//   HS_SWEEP_LEFT  Drive LEFT through the flags, stop on the STATION_COUNT-th or a hop after the last
+//   HS_FIND_FIRST  Back RIGHT onto the leftmost flag
+// isr_prox_sensor() appends 'L'/'R' to TRIGGER_ORDER for each flag found, for the log.
+
+void homing_seek(int step, int direction, bool bypass, unsigned long timeout) {
+  trace_add(&TRACE, micros(), TRACE_HOME_STEP, step);
+  event_send(EVENT_HOME_STEP, step);
+  HOME_STEP = step;
+  HOME_DIRECTION = direction;
+  motion_start(direction, bypass ? SENSOR_FALLOFF : 0, timeout);
+}
 
-    if (SENSOR_STATE != LOW) {
-      print2("HOMING_2: No stops detected in HOMING STAGE 2.  Starting HOMING STAGE 3.  SOURCE: ", SOURCE);
-    } else {
-      if (HOME_DIRECTION == RIGHT) {
-        // print2("HOMING_2: First stop detected RIGHT of start position: ", SOURCE);
-      } else {
-        // print2("HOMING_2: First stop detected LEFT of start position, SOURCE: ", SOURCE);
-      }
-    }
-  } 
-  TRIGGER_ORDER2 = TRIGGER_ORDER + 'N';
-  TRIGGER_ORDER = TRIGGER_ORDER2;
-  // print2("HOMING_2: TRIGGER_ORDER: ", TRIGGER_ORDER); 
-  HOMING = 3;
+// Homing ended on station, or -1 if it failed.  Parks the arm at STATION_DEFAULT.
+void homing_complete(int station) {
+  LOG_INFO("HOMING: TRIGGER_ORDER: ", TRIGGER_ORDER);
+  TRIGGER_ORDER = TRIGGER_ORDER2 = "";  // Clear variables for re-use
+  HOMING_ACTIVE = 0;
+  HOME_STEP = HS_IDLE;
+  stats_home(station, false);
+  trace_add(&TRACE, micros(), TRACE_HOME_DONE, station);
+
+  if (station < 0) {
+    LOG_ERROR("ERROR: (homing_complete) Position unknown. HOMING: ", HOMING);
+    HOMING = 0;
+    CURRENT_POS = -1;
+    report_pos();
+    event_send(EVENT_FAULT, EVENT_FAULT_HOMING);
+    return;
+  }
+
+  HOMING = 5;
+  PREVIOUS_POS = CURRENT_POS;
+  CURRENT_POS = station;
+  event_send(EVENT_HOMED, station);
+  if (CURRENT_POS != STATION_DEFAULT) {
+    LOG_INFO("Calibration complete, moving to start. STATION: ", STATION_DEFAULT);
+    move_to(STATION_DEFAULT);
+  } else { // Already on the default station, report the POS
+    report_pos();
+  }
+  drag_lights();
 }
 
+void homing_begin() {
+  if (!HOMING_ACTIVE) {
+    stats_home_ms = millis();   // Not when a failed verify falls back to a sweep, that's the same run
+  }
+  TRIGGER_ORDER = TRIGGER_ORDER2 = "";
+  HOMING_ACTIVE = 1;
+  HOMING = 1;
+  HOME_DIRECTION = 0;
+  HOME_FLAGS = 0;
+  homing_seek(HS_SWEEP_LEFT, LEFT, (SENSOR_STATE == LOW), homing_hop_ms());
+  MOTION_PASSING = STATION_COUNT - 1;   // Any more than that and the next flag is station 1
+}
 
-void homing_3 () {
-  // print2("\t\t\tHOMING STAGE: ", HOMING);
-  if (HOMING == 3) {
-    // Test left and see if we hit a stop point
-    HOME_DIRECTION = LEFT;
-    motor_reverse();
-    sensor_bypass();
-    // Blocking, Safety stop after x milliseconds in case sensor hasn't tripped
-    delay(HOMING_TIMEOUT_LONG);
-    motor_stop();
-    //delay(250);
-    if (SENSOR_STATE == LOW) {
-      //print2("HOMING_3: Stopped to the LEFT of our first point. SOURCE: ", SOURCE);
-      //print2("HOMING_3: Moving RIGHT to starting point.  SOURCE: ", SOURCE);
-      HOME_DIRECTION = RIGHT;
-      motor_forward();
-      sensor_bypass();
-      // Blocking, Safety stop after x milliseconds in case sensor hasn't tripped
-      delay(HOMING_TIMEOUT_LONG);
-      motor_stop();
-      //delay(250);
-      if (SENSOR_STATE == LOW) {
-        //print2("HOMING_3: Sitting on START point. SOURCE: ", SOURCE);
-       HOMING = 4;
-      } else {
-        //print2("HOMING 3: Moving RIGHT, DID NOT find the starting point.  SOURCE:", SOURCE);
-      }
-    } else {
-      print2("HOMING_3: No points detected left of first point.  SOURCE: ", SOURCE);
-      HOME_DIRECTION = RIGHT;
-      motor_forward();
-      sensor_bypass();
-      // Blocking, Safety stop after x milliseconds in case sensor hasn't tripped
-      delay(HOMING_TIMEOUT_LONG);
-      motor_stop();
-      delay(250);
-      if (SENSOR_STATE == LOW) {
-        print2("HOMING_3: Sitting on START point. SOURCE: ", SOURCE);
-       HOMING = 4;
-      } else {
-        print2("HOMING 3: Moving RIGHT, DID NOT find the starting point.  SOURCE:", SOURCE);
-      }
-    }
+// Instead of a full search, check the arm is still on (or right next to) the flag it was saved on.  Flags
+// all look alike, so this trusts the saved station; it only catches the arm having been moved off it.
+void homing_verify(int station) {
+  VERIFY_POS = station;
+  stats_home_ms = millis();
+  TRIGGER_ORDER = TRIGGER_ORDER2 = "";
+  HOMING_ACTIVE = 1;
+  HOMING = 1;
+  HOME_DIRECTION = 0;
+  LOG_INFO("HOMING: Verifying saved position. Station: ", station);
+  if (SENSOR_STATE == LOW) {
+    HOME_STEP = HS_VERIFY_RIGHT;
+    homing_step();
+    return;
   }
-  TRIGGER_ORDER2 = TRIGGER_ORDER + 'N';   // Denote we are at H3 (need to do , for H1 and H2 it seems)
-  TRIGGER_ORDER = TRIGGER_ORDER2;
-  // print2("HOMING_3: TRIGGER_ORDER: ", TRIGGER_ORDER);
+  homing_seek(HS_VERIFY_LEFT, LEFT, false, VERIFY_JOG_MS);
 }
 
-void homing_4 () {
-  //print2("\t\t\tHOMING STAGE: ", HOMING);
-  //print2("\t\t\tHOMING_TIMEOUT_LONG: ", HOMING_TIMEOUT_LONG);
-  //print2("\t\t\tHOMING_TIMEOUT_SHORT: ", HOMING_TIMEOUT_SHORT); 
-  if (HOMING == 4) {
-    // Test RIGHT and see if we hit a stop point
-    HOME_DIRECTION = RIGHT;
-    motor_forward();
-    sensor_bypass();
-    // Blocking, Safety stop after x milliseconds in case sensor hasn't tripped
-    delay(HOMING_TIMEOUT_LONG);
-    motor_stop();
-    //delay(250);     // Delay to let serial buffer catch up so we don't wind up in SENSOR OVERRIDE on final return
-
-    if (SENSOR_STATE == LOW) {
-      //print2("HOMING_4: Found a stop point RIGHT of our first point, SOURCE: ", SOURCE);
-      //print2("HOMING_4: Moving LEFT to starting point. SOURCE: ", SOURCE);
-      HOME_DIRECTION = LEFT;
-      motor_reverse();
-      sensor_bypass();
-      // Blocking, Safety stop after x milliseconds in case sensor hasn't tripped
-      delay(HOMING_TIMEOUT_LONG);
-      motor_stop();
-      //delay(250);
-      if (SENSOR_STATE == LOW) {
-        //print2("HOMING_4: Sitting on START point, to the LEFT of last detected point.  SOURCE:", SOURCE);
-        HOMING = 5;
-        /// Exits here if all is well, right edge case below
+// Called by motion_update() when a homing seek ends, by flag or timeout
+void homing_step() {
+  switch (HOME_STEP) {
+    case HS_VERIFY_LEFT:
+      if (SENSOR_STATE != LOW) {
+        homing_seek(HS_VERIFY_RIGHT, RIGHT, false, (VERIFY_JOG_MS) * 2);
+        return;
       }
-    
-    } else {
-      //print2("HOMING4: moving RIGHT DID NOT find the starting point.  SOURCE:", SOURCE);
-      //print2("HOMING4: Returning to last known point. SOURCE:", SOURCE);
-      HOME_DIRECTION = LEFT;
-      motor_reverse();
-      sensor_bypass();
-      // Blocking, Safety stop after x milliseconds in case sensor hasn't tripped
-      delay(HOMING_TIMEOUT_LONG);
-      motor_stop();      
-      //delay(250);     // Delay to let serial buffer catch up so we don't wind up in SENSOR OVERRIDE on final return
+      __attribute__((fallthrough));     // Found it
+    case HS_VERIFY_RIGHT:
+      TRIGGER_ORDER = TRIGGER_ORDER2 = "";
+      if (SENSOR_STATE != LOW) {
+        LOG_INFO("HOMING: Saved position not confirmed. Station: ", VERIFY_POS);
+        homing_begin();
+        return;
+      }
+      HOMING_ACTIVE = 0;
+      HOME_STEP = HS_IDLE;
+      HOMING = 5;
+      stats_home(VERIFY_POS, true);
+      trace_add(&TRACE, micros(), TRACE_HOME_DONE, VERIFY_POS);
+      PREVIOUS_POS = CURRENT_POS;
+      CURRENT_POS = VERIFY_POS;
+      report_pos();
+      event_send(EVENT_HOMED, VERIFY_POS);
+      drag_lights();
+      return;
+
+    case HS_SWEEP_LEFT:
+      HOMING = 2;
       if (SENSOR_STATE == LOW) {
-        print2("HOMING_4: Sitting on START point, to the LEFT of last detected point.  SOURCE:", SOURCE);
-        HOMING = 5;
-      } else {
-        print2("HOMING_4: Something went really really wrong. SOURCE: ", SOURCE);
+        // Stopped on the STATION_COUNT-th flag, or against the left end stop with station 1's still under
+        // the sensor
+        homing_complete(1);
+        return;
       }
-    }
-  }
-  //print2("HOMING_4: TRIGGER_ORDER: ", TRIGGER_ORDER);
-  // SEE DEFINES
-  if (TRIGGER_ORDER == "RNNRNRL")   { HOMED_POS = 0;}
-  if (TRIGGER_ORDER == "NNRNRL")    { HOMED_POS = 1;}
-  if (TRIGGER_ORDER == "LNNRNRL")   { HOMED_POS = 2;}
-  if (TRIGGER_ORDER == "RNNLRNRL")  { HOMED_POS = 3;}
-  if (TRIGGER_ORDER == "LRNNLRNRL") { HOMED_POS = 4;}
-  if (TRIGGER_ORDER == "NNLRNRL")   { HOMED_POS = 5;}
-  if (TRIGGER_ORDER == "LNNLRNRL")  { HOMED_POS = 6;}
-  if (TRIGGER_ORDER == "RNNLRNL")   { HOMED_POS = 7;}
-  if (TRIGGER_ORDER == "LRNNLRNL")  { HOMED_POS = 8;}
-  if (TRIGGER_ORDER == "NNLRNL")    { HOMED_POS = 9;}
-  if (TRIGGER_ORDER == "LNNLRNL")   { HOMED_POS = 10;}
-
-  // print2("Starting position: ",(HOMED_ARRAY[HOMED_POS].START_POS));  // See defines for starting positions, they are not outlets
-  // print2("Vacuum is estimated to be in L to R outlet: ", HOMED_ARRAY[HOMED_POS].END_POS);
-  CURRENT_POS = HOMED_ARRAY[HOMED_POS].END_POS;
-
-  if ( HOMING > 4 ) {
-    if (CURRENT_POS != 2 ) {
-      print2("Calibration complete, moving to default/start position (2). SOURCE: ", SOURCE);
-      if ( CURRENT_POS == 1) { 
-        move_right();
-      } else {
-        move_left();
+      homing_seek(HS_FIND_FIRST, RIGHT, false, homing_hop_ms());
+      return;
+
+    case HS_FIND_FIRST:
+      if (SENSOR_STATE != LOW) {
+        LOG_WARN("HOMING: No flag RIGHT of the left end. Flags: ", HOME_FLAGS);
+        homing_complete(-1);
+        return;
       }
-    } else { // If we are on the middle position already, report the POS
-      report_pos();
-    } 
+      homing_complete(1);
+      return;
+
+    default:
+      return;
   }
-  TRIGGER_ORDER = TRIGGER_ORDER2 = "";  // Clear variables for re-use
-  drag_lights();  
 }
 
   /*****************************************************************************
@@ -710,6 +1328,8 @@ void homing_4 () {
 
 
 // COMMAND LINE SERIAL FUNCTIONS
+void frame_received(uint8_t rx);
+
 /*************************************************************************************************************
     getCommandLineFromSerialPort()
       Return the string of the next command. Commands are delimited by return"
@@ -720,57 +1340,125 @@ void homing_4 () {
   bool
   getCommandLineFromSerialPort(char * commandLine) {
     static uint8_t charsRead = 0;                      //note: COMAND_BUFFER_LENGTH must be less than 255 chars long
+    static bool tooLong = 0;                           // Line ran past COMMAND_BUFFER_LENGTH
+    static bool overrun = 0;                           // RX buffer full when last looked at
+    static uint8_t intact = 0;                         // Bytes still to read from before the overrun...
+    static bool damaged = 0;                           // ...after which the line ending next lost some
+    static bool again = 0;                             // Overrun again before reaching that, drop all until past it
     //read asynchronously until full command input
     while (Serial.available()) {
+      // A full buffer means the UART has been dropping bytes since it filled, count each time it happens.
+      // Checked on every byte, the echo below can block on TX long enough to fill it again.  This is a
+      // guess, the core's RX ISR discards a byte with no full buffer flag or count (and DOR0 is cleared
+      // before we could look).  A burst that fills the buffer exactly, last byte and nothing after it, is
+      // counted as an overrun too and the line it ends in is refused, as a lost line would be.  Under
+      // credit flow control that takes commands of the longest length and a STOP all arriving during
+      // one delay(), otherwise a person pasting into a terminal.
+      bool full = Serial.available() >= (SERIAL_RX_BUFFER_SIZE - 1);
+      if (full && !overrun) {
+        stats_count(&STATS.RX_OVERRUNS);
+        again = (intact > 0);
+        intact = Serial.available();
+        LOG_ERROR("ERROR: (serial) RX buffer overrun, input lost");
+      }
+      overrun = full;
       char c = Serial.read();
+      if (intact && !--intact) {
+        damaged = 1;
+        again = 0;
+      }
+      // A binary frame can only start where a text line would
+      if ((charsRead == 0) && (frame_rx_busy(&FrameRx) || ((uint8_t)c == FRAME_SYNC))) {
+        uint8_t rx = frame_rx_byte(&FrameRx, c);
+        if (rx != FRAME_RX_MORE) {
+          CREDIT_TAKEN++;
+          damaged = 0;                                // The CRC tells us about this one
+          frame_received(rx);
+          return false;
+        }
+        continue;
+      }
       switch (c) {
         case CR:      //likely have full command in buffer now, commands are terminated by CR and/or LS
         case LF:
           commandLine[charsRead] = NULLCHAR;       //null terminate our command char array
           if (charsRead > 0)  {
             charsRead = 0;                           //charsRead is static, so have to reset
+            CREDIT_TAKEN++;
             Serial.println(commandLine);
-            return true;
+            // Whatever a clipped or spliced line would do, it isn't what was sent
+            if (tooLong) {
+              stats_count(&STATS.RX_TOO_LONG);
+              LOG_ERROR("ERROR: (serial) Too long, not run: ", commandLine);
+            } else if (damaged || again) {
+              LOG_ERROR("ERROR: (serial) Overrun cut line: ", commandLine);
+            }
+            bool intact_line = !tooLong && !damaged && !again;
+            tooLong = 0;
+            damaged = 0;
+            return intact_line;
           }
           break;
         case BS:                                    // handle backspace in input: put a space in last char
           if (charsRead > 0) {                        //and adjust commandLine and charsRead
             commandLine[--charsRead] = NULLCHAR;
-            Serial << byte(BS) << byte(SPACE) << byte(BS);  //no idea how this works, found it on the Internet
+            Serial.write(BS);                           //back over the char, blank it, back again
+            Serial.write(SPACE);
+            Serial.write(BS);
           }
           break;
         default:
           // c = tolower(c);
           if (charsRead < COMMAND_BUFFER_LENGTH) {
             commandLine[charsRead++] = c;
+          } else {
+            tooLong = 1;
           }
           commandLine[charsRead] = NULLCHAR;     //just in case
           break;
       }
     }
+    if (frame_rx_idle(&FrameRx, micros())) {
+      LOG_ERROR("ERROR: (serial) Frame cut short, dropped");
+    }
     return false;
   }
 
 
   /* ****************************
+    readToken: find the next word on the command line without modifying it, so the same line can be
+      looked at again (command_is_immediate, then DoMyCommand).  Returns its start and sets *len,
+      *line is advanced past it.  NULL when the line is used up.
     readNumber: return a 16bit (for Arduino Uno) signed integer from the command line
-    readWord: get a text word from the command line
 
   */
-  int
-  readNumber () {
-    char * numTextPtr = strtok(NULL, delimiters);         //K&R string.h  pg. 250
-    return atoi(numTextPtr);                              //K&R string.h  pg. 251
+  const char *
+  readToken(const char ** line, uint8_t * len) {
+    const char * p = *line;
+    while ((*p != NULLCHAR) && (strchr(delimiters, *p) != NULL)) {
+      p++;
+    }
+    const char * start = p;
+    while ((*p != NULLCHAR) && (strchr(delimiters, *p) == NULL)) {
+      p++;
+    }
+    *line = p;
+    *len = p - start;
+    return (*len > 0) ? start : NULL;
   }
 
-  char * readWord() {
-    char * word = strtok(NULL, delimiters);               //K&R string.h  pg. 250
-    return word;
+  int
+  readNumber (const char ** line) {
+    uint8_t len;
+    const char * numTextPtr = readToken(line, &len);
+    return (numTextPtr != NULL) ? atoi(numTextPtr) : 0;   //K&R string.h  pg. 251
   }
 
   void
-  nullCommand(char * ptrToCommandName) {
-    print2("Command not found: ", ptrToCommandName);      //see above for macro print2
+  nullCommand(const char * ptrToCommandName, uint8_t len) {
+    Serial.print("Command not found: ");
+    Serial.write((const uint8_t *)ptrToCommandName, len);
+    Serial.println();
   }
 
 
@@ -778,75 +1466,312 @@ void homing_4 () {
      Add your commands here
   */
 
-  int addCommand() {                                      //Modify here
-    int firstOperand = readNumber();
-    int secondOperand = readNumber();
-    return firstOperand + secondOperand;
+  int addCommand(int firstOperand, int secondOperand) {         //Modify here
+    print2(">    The sum is = ", firstOperand + secondOperand);
+    return 0;
   }
 
-  int subtractCommand() {                                //Modify here
-    int firstOperand = readNumber();
-    int secondOperand = readNumber();
-    return firstOperand - secondOperand;
+  int subtractCommand(int firstOperand, int secondOperand) {    //Modify here
+    print2(">    The difference is = ", firstOperand - secondOperand);
+    return 0;
   }
 
-  int HOMEcommand() {
-    HOMING_ACTIVE = 1;
-    HOMING = 1;
-    homing_1();
-    homing_2();
-    homing_3();
-    homing_4();
-    HOMING_ACTIVE = 0;
+  // HOME verifies the position saved before a reset when there is one, HOME FULL always searches
+  int HOMEcommand(int full, int) {
+    if (!full && (RESTORE_POS > 0) && (CURRENT_POS == -1) && !HOMING_ACTIVE) {
+      homing_verify(RESTORE_POS);
+      RESTORE_POS = -1;
+      return 0;
+    }
+    homing_begin();
     return 0;
   }
 
-  int MOVEcommand() {
-    SOURCE = CLI;
-    RX_COMMAND = 99;      // Reset RX_COMMAND
-    rxWord = readWord();  // Store the content returned by readWord() in a string
+  int STATUScommand(int, int) {
+    Serial.print("STATUS HOMING: ");
+    Serial.print(HOMING);
+    Serial.print(" STEP: ");
+    Serial.print(HOME_STEP);
+    Serial.print(" MOTION: ");
+    Serial.print(MOTION_STATE);
+    Serial.print(" PPOS: ");
+    Serial.print(PREVIOUS_POS);
+    Serial.print(" CPOS: ");
+    Serial.println(CURRENT_POS);
+    return 0;
+  }
 
-    // Switch statements only work with integers, so convert to integers
-    if (rxWord == "STOP") {
-      RX_COMMAND = STOP;
+  // Commands the host may send now, see CMD_CREDITS_MAX
+  uint8_t
+  command_credits() {
+    uint8_t free = CMD_QUEUE_SIZE - CMD_QUEUE_COUNT;
+    return (free < CMD_CREDITS_MAX) ? free : CMD_CREDITS_MAX;
+  }
+
+  // Report the credit when it or CREDIT_TAKEN changed, as "CREDIT <free> <taken>" or FRAME_OP_CREDIT.
+  // Left for the next pass, not dropped, when the TX buffer has no room.
+  void
+  credit_update() {
+    uint8_t free = command_credits();
+    if (!CREDIT_REPORTING || ((free == CREDIT_SENT_FREE) && (CREDIT_TAKEN == CREDIT_SENT_TAKEN))) {
+      return;
+    }
+    if (FRAME_MODE) {
+      uint8_t payload[2] = { free, CREDIT_TAKEN };
+      if (Serial.availableForWrite() < 2 + FRAME_OVERHEAD) {
+        return;
+      }
+      frame_send(FRAME_OP_CREDIT, 0, payload, 2);
+    } else {
+      char line[20];
+      strcpy_P(line, PSTR("CREDIT "));
+      ltoa(free, line + strlen(line), 10);
+      strcat_P(line, PSTR(" "));
+      ltoa(CREDIT_TAKEN, line + strlen(line), 10);
+      strcat_P(line, PSTR("\r\n"));
+      if (Serial.availableForWrite() < (int)strlen(line)) {
+        return;
+      }
+      Serial.write((const uint8_t *)line, strlen(line));
     }
-    if (rxWord == "RIGHT") {
-      RX_COMMAND = RIGHT;
+    CREDIT_SENT_FREE = free;
+    CREDIT_SENT_TAKEN = CREDIT_TAKEN;
+  }
+
+  // CREDIT starts flow control: the credit is reported now and whenever it changes, free being how many
+  // more commands the host may send and taken how many lines and frames have been read (mod 256, this
+  // one included).  The host can send free less those it sent that aren't taken yet.  CREDIT OFF stops it.
+  int CREDITcommand(int off, int) {
+    CREDIT_REPORTING = !off;
+    CREDIT_SENT_FREE = CREDIT_NONE;
+    return 0;
+  }
+
+  // Sensor edge to relay off time for the stops since boot or LATENCY RESET
+  int LATENCYcommand(int reset, int) {
+    if (reset) {
+      LATENCY_COUNT = 0;
+      LATENCY_MIN = 0xFFFF;
+      LATENCY_MAX = 0;
+      LATENCY_SUM = 0;
     }
-    if (rxWord == "LEFT") {
-      RX_COMMAND = LEFT;
+    Serial.print("LATENCY STOPS: ");
+    Serial.print(LATENCY_COUNT);
+    if (LATENCY_COUNT > 0) {
+      Serial.print(" MIN_US: ");
+      Serial.print((float)LATENCY_MIN / LATENCY_TICKS_PER_US, 3);
+      Serial.print(" MEAN_US: ");
+      Serial.print((float)LATENCY_SUM / LATENCY_COUNT / LATENCY_TICKS_PER_US, 3);
+      Serial.print(" MAX_US: ");
+      Serial.print((float)LATENCY_MAX / LATENCY_TICKS_PER_US, 3);
     }
-    if (rxWord == "GOCNC") {
-      RX_COMMAND = CNC;
+    Serial.println();
+    return 0;
+  }
+
+  void stats_print(const char * key, unsigned long value) {
+    Serial.print(' ');
+    Serial.print(key);
+    Serial.print(": ");
+    Serial.print(value);
+  }
+
+  void stats_print_hist(const char * key, const uint16_t * hist, uint8_t bins) {
+    Serial.print(' ');
+    Serial.print(key);
+    Serial.print(": ");
+    for (uint8_t i = 0; i < bins; i++) {
+      if (i > 0) {
+        Serial.print(',');
+      }
+      Serial.print(hist[i]);
     }
-    if (rxWord == "GOCHOPSAW") {
-      RX_COMMAND = CHOPSAW;
+  }
+
+  // Counters since boot or STATS RESET, on one line for the host to scrape.  MOVE_HIST bins are
+  // STATS_MOVE_BIN_MS wide, HOME_SWEEP counts sweeps by flags passed, 0..STATION_COUNT - 1.
+  int STATScommand(int reset, int) {
+    if (reset) {
+      memset(&STATS, 0, sizeof(STATS));
+      LOG_DROPPED = 0;
+      stats_since_ms = millis();
     }
-    if (rxWord == "GOWORKBENCH") {
-      RX_COMMAND = WORKBENCH;
+    Serial.print("STATS");
+    stats_print("UP_S", (millis() - stats_since_ms) / 1000);
+    stats_print("MOVES", STATS.MOVES);
+    stats_print("ARRIVED", STATS.ARRIVED);
+    stats_print("TIMEOUTS", STATS.TIMEOUTS);
+    stats_print("ABORTS", STATS.ABORTS);
+    stats_print("REDIRECTS", STATS.REDIRECTS);
+    stats_print("MOVE_MEAN_MS", STATS.MOVES ? (STATS.MOVE_SUM_MS / STATS.MOVES) : 0);
+    stats_print("MOVE_MAX_MS", STATS.MOVE_MAX_MS);
+    stats_print_hist("MOVE_HIST", STATS.MOVE_HIST, STATS_MOVE_BINS);
+    stats_print("ISR", STATS.ISR);
+    stats_print("BOUNCES", STATS.BOUNCES);
+    stats_print("PASSES", STATS.PASSES);
+    stats_print("DROPPED", STATS.DROPPED);
+    stats_print("LOG_DROPPED", LOG_DROPPED);
+    stats_print("RX_OVERRUNS", STATS.RX_OVERRUNS);
+    stats_print("RX_TOO_LONG", STATS.RX_TOO_LONG);
+    stats_print("QUEUE_FULL", STATS.QUEUE_FULL);
+    stats_print("HOMES", STATS.HOMES);
+    stats_print("HOME_FAILS", STATS.HOME_FAILS);
+    stats_print("HOME_VERIFIED", STATS.HOME_VERIFIED);
+    stats_print("HOME_MEAN_MS", STATS.HOMES ? (STATS.HOME_SUM_MS / STATS.HOMES) : 0);
+    stats_print("HOME_MAX_MS", STATS.HOME_MAX_MS);
+    stats_print_hist("HOME_SWEEP", STATS.HOME_SWEEP, STATS_SWEEP_BINS);
+    Serial.println();
+    return 0;
+  }
+
+  void trace_print_command(int16_t row);
+
+  // TRACE DUMP prints the ring oldest first as "TRACE <us> <id> <arg>" lines between a header and
+  // TRACE END, for host/trace2chrome.  NOW_US is micros() as the header goes out, to line it up with
+  // host time.  LOST counts events overwritten before this dump.  TRACE CLEAR empties the ring.
+  int TRACEcommand(int dump, int) {
+    if (!dump) {
+      TRACE.COUNT = 0;
+      TRACE.NEXT = 0;
+      Serial.println("TRACE CLEARED");
+      return 0;
     }
-       if (rxWord == "GL1") {
-      RX_COMMAND = GL1;
+    uint8_t held = trace_held(&TRACE);
+    Serial.print("TRACE DUMP NOW_US: ");
+    Serial.print(micros());
+    Serial.print(" EVENTS: ");
+    Serial.print(held);
+    Serial.print(" LOST: ");
+    Serial.println(TRACE.COUNT - held);
+    for (uint8_t i = 0; i < held; i++) {
+      const TRACE_EVENT * e = trace_get(&TRACE, i);
+      Serial.print("TRACE ");
+      Serial.print(e->US);
+      Serial.print(' ');
+      Serial.print(e->ID);
+      Serial.print(' ');
+      Serial.print(e->ARG);
+      if (e->ID == TRACE_COMMAND) {
+        trace_print_command(e->ARG);
+      }
+      Serial.println();
     }
-    if (rxWord == "GR1") {
-      RX_COMMAND = GR1;
+    Serial.println("TRACE END");
+    return 0;
+  }
+
+  // Learned hop times, TRAVEL RESET forgets them, e.g. after the actuator is replaced
+  int TRAVELcommand(int reset, int) {
+    if (reset) {
+      memset(TRAVEL.SEG, 0, sizeof(TRAVEL.SEG));
+      TRAVEL_DIRTY = (1UL << TRAVEL_SEGMENTS) - 1;
+      TRAVEL_WARNED = 0;
+      travel_save(true);
     }
-    if (rxWord == "H1") {
-      RX_COMMAND = H1;
+    for (uint8_t i = 0; i < TRAVEL_SEGMENTS; i++) {
+      Serial.print("TRAVEL ");
+      travel_print_segment(i);
+      Serial.print(" HOPS: ");
+      Serial.print(TRAVEL.SEG[i].COUNT);
+      Serial.print(" MEAN_MS: ");
+      Serial.print(TRAVEL.SEG[i].MEAN_MS, 0);
+      Serial.print(" SD_MS: ");
+      Serial.print(sqrt(TRAVEL.SEG[i].VAR_MS2), 0);
+      Serial.print(" BASE_MS: ");
+      Serial.print(TRAVEL.SEG[i].BASE_MS, 0);
+      print2(" LIMIT_MS: ", travel_limit_ms(i));
     }
-    if (rxWord == "H2") {
-      RX_COMMAND = H2;
+    return 0;
+  }
+
+  // Station number for a name or number typed on the command line, 0 if it isn't one
+  int station_find(const char * token, uint8_t len) {
+    if ((len == 0) || (len >= STATION_NAME_MAX)) {
+      return 0;
     }
-    if (rxWord == "H3") {
-      RX_COMMAND = H3;
+    if (isdigit(token[0])) {
+      int station = atoi(token);
+      return ((station >= 1) && (station <= STATION_COUNT)) ? station : 0;
     }
-    if (rxWord == "H4") {
-      RX_COMMAND = H4;
+    for (int i = 0; i < STATION_COUNT; i++) {
+      if ((strncmp_P(token, STATION_NAME_ARRAY[i], len) == 0) && (pgm_read_byte(&STATION_NAME_ARRAY[i][len]) == 0)) {
+        return i + 1;
+      }
     }
-  
-    switch (RX_COMMAND) {
+    return 0;
+  }
+
+  // CMD_ARGS_STATION: the next word as a station, with or without MOVE's GO prefix
+  int readStation(const char ** args) {
+    uint8_t len;
+    const char * token = readToken(args, &len);
+    if (token == NULL) {
+      return 0;
+    }
+    int station = station_find(token, len);
+    if ((station == 0) && (len > 2) && (strncmp(token, "GO", 2) == 0)) {
+      station = station_find(token + 2, len - 2);
+    }
+    return station;
+  }
+
+  // Travel to a station by number, by the most direct route.  0 on success, 1 for no such station,
+  // 2 if the machine has to be homed first.
+  int goto_station(int station) {
+    if ((station < 1) || (station > STATION_COUNT)) {
+      LOG_ERROR("ERROR: (GOTO) Unknown station");
+      return 1;
+    }
+    if (CURRENT_POS == -1) {
+      LOG_ERROR("ERROR: (GOTO) Machine not homed. SOURCE: ", SOURCE);
+      return 2;
+    }
+    move_to(station);
+    return 0;
+  }
+
+  int GOTOcommand(int station, int) {
+    SOURCE = CLI;
+    return goto_station(station);
+  }
+
+  int STATIONScommand(int, int) {
+    char name[STATION_NAME_MAX];
+    for (int i = 0; i < STATION_COUNT; i++) {
+      memcpy_P(name, STATION_NAME_ARRAY[i], STATION_NAME_MAX);
+      Serial.print("STATION ");
+      Serial.print(i + 1);
+      Serial.print(' ');
+      Serial.println(name);
+    }
+    return 0;
+  }
+
+  int move_command(uint8_t command);
+  void command_queue_flush();
+
+  // Station for the original three MOVE GO<name> targets, 0 for any other MOVE
+  int move_station(uint8_t command) {
+    switch (command) {
+      case CNC:       return station_find("CNC", 3);
+      case CHOPSAW:   return station_find("CHOPSAW", 7);
+      case WORKBENCH: return station_find("WORKBENCH", 9);
+      default:        return 0;
+    }
+  }
+
+  int MOVEcommand(int command, int) {
+    SOURCE = CLI;
+    return move_command(command);
+  }
+
+  // Run a MOVE by its target define, for the text and binary protocols.  0 on success, 1 for an unknown
+  // target, 2 if the machine has to be homed first.
+  int move_command(uint8_t command) {
+    switch (command) {
       case STOP:
-        motor_stop();
+        motion_abort();
+        command_queue_flush();    // Nothing asked for before the STOP should still happen after it
         return 0;
         break;
 
@@ -870,82 +1795,18 @@ void homing_4 () {
         return 0;
         break;
 
-      case CNC: 
-        if (CURRENT_POS == -1) {
-          print2("ERROR: (MOVEcommand CNC) Machine not homed. SOURCE: ", SOURCE);
-        } else {
-            if (CURRENT_POS == 1) {
-              move_right();
-              move_right();
-            }
-            if (CURRENT_POS == 2) {
-              move_right();
-            }
-            if (CURRENT_POS == 3) {
-              // We're already where we need to be
-            }        
-          }
-        return 0;
-        break;
- 
+      // The original three outlets, by name so they follow STATION_NAMES.  Kept for FRAME_MOVE_* hosts.
+      case CNC:
       case CHOPSAW:
-        if (CURRENT_POS == -1) {
-          print2("ERROR: (MOVEcommand CHOPSAW) Machine not homed. SOURCE: ", SOURCE);
-        } else {
-            if (CURRENT_POS == 1) {
-              move_right();
-            }
-            if (CURRENT_POS == 2) {
-              // We're already where we need to be
-            }
-            if (CURRENT_POS == 3) {
-              move_left();
-            }
-          }
-        return 0;
-        break;
- 
       case WORKBENCH:
-        if (CURRENT_POS == -1) {
-          print2("ERROR: (MOVEcommand WORKBENCH) Machine not homed. SOURCE: ", SOURCE);
-        } else {
-          if (CURRENT_POS == 1) {
-            // We're already where we need to be
-          }
-          if (CURRENT_POS == 2) {
-            move_left();
-          }
-          if (CURRENT_POS == 3) {
-            move_left();
-            move_left();
-          }
-        }
-        return 0;
-        break;
- 
-      case H1:
-
-        if (digitalRead(PIN_PROX_SENSOR) == LOW) {
-          HOMING = 3;
-        } else {
-          HOMING = 1;
-        }
-          homing_1();
-          return 0;
-          break;
+        return goto_station(move_station(command));
 
+      // Debug entry points into the old four stage homing, which is one sweep now
+      case H1:
       case H2:
-          homing_2();
-          return 0;
-          break;
-
       case H3:
-          homing_3();
-          return 0;
-          break;
-
       case H4:
-          homing_4();
+          homing_begin();
           return 0;
           break;
 
@@ -957,45 +1818,420 @@ void homing_4 () {
   }    
        
 
+  /*************************************************************************************************************
+     your Command Names Here
+
+     One row per command, or per command and subcommand.  Kept in flash, lookup compares the length and
+     hash of the words typed against each row and only confirms a match with strncmp_P, so the parse path
+     allocates nothing and the cost of a miss stays a couple of byte compares per row.  A row with an
+     empty subcommand after rows with subcommands catches a missing or unknown subcommand.
+  */
+  #define COMMAND(name, sub, args, arg, flags, handler) \
+    { sizeof(name) - 1, token_hash(name, sizeof(name) - 1), sizeof(sub) - 1, token_hash(sub, sizeof(sub) - 1), \
+      name, sub, args, arg, flags, handler }
+
+  static const COMMAND_CFG COMMAND_ARRAY[] PROGMEM = {
+    COMMAND("add",    "",            CMD_ARGS_INTS, 0,         0,             addCommand),       //Modify here
+    COMMAND("sub",    "",            CMD_ARGS_INTS, 0,         0,             subtractCommand),  //Modify here
+    COMMAND("HOME",   "FULL",        CMD_ARGS_NONE, 1,         0,             HOMEcommand),
+    COMMAND("HOME",   "",            CMD_ARGS_NONE, 0,         0,             HOMEcommand),
+    COMMAND("STATUS", "STATIONS",    CMD_ARGS_NONE, 0,         CMD_IMMEDIATE, STATIONScommand),
+    COMMAND("STATUS", "",            CMD_ARGS_NONE, 0,         CMD_IMMEDIATE, STATUScommand),
+    COMMAND("GOTO",   "",            CMD_ARGS_STATION, 0,      0,             GOTOcommand),
+    COMMAND("TRACE",  "DUMP",        CMD_ARGS_NONE, 1,         0,             TRACEcommand),
+    COMMAND("TRACE",  "CLEAR",       CMD_ARGS_NONE, 0,         0,             TRACEcommand),
+    COMMAND("STATS",  "RESET",       CMD_ARGS_NONE, 1,         CMD_IMMEDIATE, STATScommand),
+    COMMAND("STATS",  "",            CMD_ARGS_NONE, 0,         CMD_IMMEDIATE, STATScommand),
+    COMMAND("LATENCY", "RESET",      CMD_ARGS_NONE, 1,         CMD_IMMEDIATE, LATENCYcommand),
+    COMMAND("LATENCY", "",           CMD_ARGS_NONE, 0,         CMD_IMMEDIATE, LATENCYcommand),
+    COMMAND("CREDIT", "OFF",         CMD_ARGS_NONE, 1,         CMD_IMMEDIATE, CREDITcommand),
+    COMMAND("CREDIT", "",            CMD_ARGS_NONE, 0,         CMD_IMMEDIATE, CREDITcommand),
+    COMMAND("TRAVEL", "RESET",       CMD_ARGS_NONE, 1,         0,             TRAVELcommand),
+    COMMAND("TRAVEL", "",            CMD_ARGS_NONE, 0,         CMD_IMMEDIATE, TRAVELcommand),
+    COMMAND("MOVE",   "STOP",        CMD_ARGS_NONE, STOP,      CMD_IMMEDIATE, MOVEcommand),
+    COMMAND("MOVE",   "RIGHT",       CMD_ARGS_NONE, RIGHT,     0,             MOVEcommand),
+    COMMAND("MOVE",   "LEFT",        CMD_ARGS_NONE, LEFT,      0,             MOVEcommand),
+    COMMAND("MOVE",   "GL1",         CMD_ARGS_NONE, GL1,       0,             MOVEcommand),
+    COMMAND("MOVE",   "GR1",         CMD_ARGS_NONE, GR1,       0,             MOVEcommand),
+    COMMAND("MOVE",   "H1",          CMD_ARGS_NONE, H1,        0,             MOVEcommand),
+    COMMAND("MOVE",   "H2",          CMD_ARGS_NONE, H2,        0,             MOVEcommand),
+    COMMAND("MOVE",   "H3",          CMD_ARGS_NONE, H3,        0,             MOVEcommand),
+    COMMAND("MOVE",   "H4",          CMD_ARGS_NONE, H4,        0,             MOVEcommand),
+    COMMAND("MOVE",   "",            CMD_ARGS_STATION, 0,      0,             GOTOcommand),      // MOVE GOCNC, MOVE GO3 ...
+  };
+
+  #define COMMAND_COUNT (sizeof(COMMAND_ARRAY) / sizeof(COMMAND_ARRAY[0]))
+
   /****************************************************
-     DoMyCommand
+     command_find: find the COMMAND_ARRAY row for the start of commandLine and copy it to *cmd.
+       *args is left pointing at what follows the words that matched.  Returns the row, -1 if the
+       command is unknown.  command_lookup is the same as a yes or no.
   */
+  int8_t
+  command_find(const char * commandLine, COMMAND_CFG * cmd, const char ** args) {
+    const char * line = commandLine;
+    uint8_t len;
+    const char * name = readToken(&line, &len);
+    if (name == NULL) {
+      return -1;
+    }
+    uint16_t hash = token_hash(name, len);
+    const char * after_name = line;
+    uint8_t sub_len;
+    const char * sub = readToken(&line, &sub_len);
+    uint16_t sub_hash = (sub != NULL) ? token_hash(sub, sub_len) : 0;
+    int8_t found = -1;
+
+    for (uint8_t i = 0; i < COMMAND_COUNT; i++) {
+      const COMMAND_CFG * row = &COMMAND_ARRAY[i];
+      if ((pgm_read_byte(&row->LEN) != len) || (pgm_read_word(&row->HASH) != hash) ||
+          (strncmp_P(name, row->NAME, len) != 0)) {
+        continue;
+      }
+      uint8_t row_sub_len = pgm_read_byte(&row->SUB_LEN);
+      if (row_sub_len == 0) {
+        found = i;          // No subcommand, or the fallback for an unknown one
+        break;
+      }
+      if ((row_sub_len == sub_len) && (pgm_read_word(&row->SUB_HASH) == sub_hash) &&
+          (strncmp_P(sub, row->SUB, sub_len) == 0)) {
+        found = i;
+        break;
+      }
+    }
+    if (found < 0) {
+      return -1;
+    }
+    memcpy_P(cmd, &COMMAND_ARRAY[found], sizeof(COMMAND_CFG));
+    *args = (cmd->SUB_LEN > 0) ? line : after_name;
+    return found;
+  }
+
   bool
-  DoMyCommand(char * commandLine) {
-    //  print2("\nCommand: ", commandLine);
-    int result;
+  command_lookup(const char * commandLine, COMMAND_CFG * cmd, const char ** args) {
+    return command_find(commandLine, cmd, args) >= 0;
+  }
+
+  // Name of a TRACE_COMMAND row for TRACE DUMP
+  void
+  trace_print_command(int16_t row) {
+    if ((row < 0) || (row >= (int16_t)COMMAND_COUNT)) {
+      return;
+    }
+    COMMAND_CFG cmd;
+    memcpy_P(&cmd, &COMMAND_ARRAY[row], sizeof(COMMAND_CFG));
+    Serial.print(' ');
+    Serial.print(cmd.NAME);
+    if (cmd.SUB_LEN > 0) {
+      Serial.print(' ');
+      Serial.print(cmd.SUB);
+    }
+  }
+
+  /****************************************************
+     command_is_immediate: MOVE STOP and STATUS must not wait behind a move or homing in progress
+  */
+  bool
+  command_is_immediate(const char * commandLine) {
+    COMMAND_CFG cmd;
+    const char * args;
+    return command_lookup(commandLine, &cmd, &args) && (cmd.FLAGS & CMD_IMMEDIATE);
+  }
+
+  bool
+  machine_busy() {
+    return (MOTION_STATE != MOTION_IDLE) || HOMING_ACTIVE;
+  }
+
+  /****************************************************
+     Binary frame commands, see frame.h
+  */
+  void
+  frame_ack(uint8_t op, uint8_t seq, uint8_t result) {
+    uint8_t ack[2] = { op, result };
+    frame_send(FRAME_OP_ACK, seq, ack, 2);
+  }
+
+  bool
+  frame_valid(const FRAME * frame) {
+    switch (frame->OP) {
+      case FRAME_OP_HOME:
+      case FRAME_OP_STATUS:
+      case FRAME_OP_STATS:
+        return frame->LEN == 0;
+      case FRAME_OP_MOVE:
+      case FRAME_OP_GOTO:
+        return frame->LEN == 1;
+      default:
+        return false;
+    }
+  }
+
+  bool
+  frame_is_immediate(const FRAME * frame) {
+    return (frame->OP == FRAME_OP_STATUS) || (frame->OP == FRAME_OP_STATS) ||
+           ((frame->OP == FRAME_OP_MOVE) && (frame->PAYLOAD[0] == FRAME_MOVE_STOP));
+  }
+
+  uint8_t
+  frame_execute(const FRAME * frame) {
+    switch (frame->OP) {
+      case FRAME_OP_HOME:
+        FRAME_SEQ = frame->SEQ;
+        HOMEcommand(0, 0);
+        return FRAME_ACK_OK;
+
+      case FRAME_OP_MOVE:
+        FRAME_SEQ = frame->SEQ;
+        SOURCE = CLI;
+        switch (move_command(frame->PAYLOAD[0])) {
+          case 0:  return FRAME_ACK_OK;
+          case 1:  return FRAME_ACK_INVALID;
+          default: return FRAME_ACK_ERROR;
+        }
+
+      case FRAME_OP_GOTO:
+        FRAME_SEQ = frame->SEQ;
+        SOURCE = CLI;
+        switch (goto_station(frame->PAYLOAD[0])) {
+          case 0:  return FRAME_ACK_OK;
+          case 1:  return FRAME_ACK_INVALID;
+          default: return FRAME_ACK_ERROR;
+        }
+
+      case FRAME_OP_STATS:
+        STATScommand(0, 0);     // Text, but asked for in a frame so FRAME_MODE stays on
+        return FRAME_ACK_OK;
 
-    char * ptrToCommandName = strtok(commandLine, delimiters);
-    //  print2("commandName= ", ptrToCommandName);
+      default: {
+        uint8_t status[5] = { (uint8_t)HOMING, (uint8_t)HOME_STEP, (uint8_t)MOTION_STATE, (uint8_t)PREVIOUS_POS,
+                              (uint8_t)CURRENT_POS };
+        frame_send(FRAME_OP_STATUS_REPLY, frame->SEQ, status, 5);
+        return FRAME_ACK_OK;
+      }
+    }
+  }
+
+  FRAME_SEEN *
+  frame_seen(const FRAME * frame) {
+    for (uint8_t i = 0; i < FRAME_WINDOW; i++) {
+      if ((FRAME_SEEN_ARRAY[i].SEQ == frame->SEQ) && (FRAME_SEEN_ARRAY[i].OP == frame->OP)) {
+        return &FRAME_SEEN_ARRAY[i];
+      }
+    }
+    return NULL;
+  }
+
+  // Ack a queued binary command a second time, with how it went
+  void
+  frame_ack_queued(const FRAME * frame, uint8_t result) {
+    FRAME_SEEN * seen = frame_seen(frame);
+    if (seen != NULL) {
+      seen->RESULT = result;
+    }
+    frame_ack(frame->OP, frame->SEQ, result);
+  }
+
+  /****************************************************
+     Command queue, see CMD_QUEUE
+  */
+  bool DoMyCommand(char * commandLine);
+
+  // Station a text command moves to, 0 if it isn't a station move
+  int
+  command_station(const char * commandLine) {
+    COMMAND_CFG cmd;
+    const char * args;
+    if (!command_lookup(commandLine, &cmd, &args) || (cmd.ARGS != CMD_ARGS_STATION)) {
+      return 0;
+    }
+    return readStation(&args);
+  }
 
-    if (strcmp(ptrToCommandName, addCommandToken) == 0) {                   //Modify here
-      result = addCommand();
-      print2(">    The sum is = ", result);
+  // Station a binary command moves to, 0 if it isn't a station move
+  int
+  frame_station(const FRAME * frame) {
+    if (frame->OP == FRAME_OP_GOTO) {
+      return ((frame->PAYLOAD[0] >= 1) && (frame->PAYLOAD[0] <= STATION_COUNT)) ? frame->PAYLOAD[0] : 0;
+    }
+    if (frame->OP == FRAME_OP_MOVE) {
+      return move_station(frame->PAYLOAD[0]);
+    }
+    return 0;
+  }
 
+  // Take a queued command out without running it
+  void
+  command_queue_cancel(const CMD_QUEUED * queued, bool superseded) {
+    if (queued->KIND == CMD_QUEUED_FRAME) {
+      frame_ack_queued(&queued->BIN, FRAME_ACK_CANCELLED);
+    } else if (superseded) {
+      LOG_INFO("QUEUE: SUPERSEDED ", queued->LINE);
     } else {
-      if (strcmp(ptrToCommandName, subtractCommandToken) == 0) {           //Modify here
-        result = subtractCommand();                                       //K&R string.h  pg. 251
-        print2(">    The difference is = ", result);
+      LOG_INFO("QUEUE: CANCELLED ", queued->LINE);
+    }
+  }
 
-      } else {
-        if (strcmp(ptrToCommandName, MOVECommandToken) == 0) {
-          result = MOVEcommand();
-          if (result != 0) {
-            print2("ERROR: (DoMyCommand) Return result of MOVE command goes here, ", result);
-          }   
+  // Remove entry i (counted from the oldest), closing the gap
+  void
+  command_queue_remove(uint8_t i) {
+    for (; (i + 1) < CMD_QUEUE_COUNT; i++) {
+      CMD_QUEUE[(CMD_QUEUE_HEAD + i) % CMD_QUEUE_SIZE] = CMD_QUEUE[(CMD_QUEUE_HEAD + i + 1) % CMD_QUEUE_SIZE];
+    }
+    CMD_QUEUE_COUNT--;
+  }
 
+  // Add to the back of the queue.  A station move first drops the station moves already waiting, only
+  // the latest target matters.  False if the queue is full.
+  bool
+  command_queue_push(const CMD_QUEUED * queued) {
+    if (queued->STATION) {
+      uint8_t i = 0;
+      while (i < CMD_QUEUE_COUNT) {
+        CMD_QUEUED * old = &CMD_QUEUE[(CMD_QUEUE_HEAD + i) % CMD_QUEUE_SIZE];
+        if (old->STATION) {
+          command_queue_cancel(old, true);
+          command_queue_remove(i);
         } else {
-          if (strcmp(ptrToCommandName, HOMECommandToken) == 0) {
-            result = HOMEcommand();
-            if (result != 0) {
-              print2("ERROR: (DoMyCommand) Return result of HOME command goes here, ", result);
-            }
+          i++;
+        }
+      }
+    }
+    if (CMD_QUEUE_COUNT >= CMD_QUEUE_SIZE) {
+      return false;
+    }
+    CMD_QUEUE[(CMD_QUEUE_HEAD + CMD_QUEUE_COUNT) % CMD_QUEUE_SIZE] = *queued;
+    CMD_QUEUE_COUNT++;
+    return true;
+  }
 
-          } else {
-              nullCommand(ptrToCommandName);
-            }
+  void
+  command_queue_flush() {
+    while (CMD_QUEUE_COUNT) {
+      command_queue_cancel(&CMD_QUEUE[CMD_QUEUE_HEAD], false);
+      CMD_QUEUE_HEAD = (CMD_QUEUE_HEAD + 1) % CMD_QUEUE_SIZE;
+      CMD_QUEUE_COUNT--;
+    }
+  }
+
+  // Queue a text command.  Anything the queue can't take is answered now rather than left in the serial buffer.
+  void
+  command_queue_text(const char * commandLine) {
+    CMD_QUEUED queued;
+    queued.KIND = CMD_QUEUED_TEXT;
+    queued.STATION = command_station(commandLine);
+    strcpy(queued.LINE, commandLine);
+    if (!command_queue_push(&queued)) {
+      stats_count(&STATS.QUEUE_FULL);
+      LOG_ERROR("ERROR: (queue) Full, dropped: ", commandLine);
+    }
+  }
+
+  // Run what's at the front of the queue once the machine is idle.  A station move at the front
+  // redirects a station move in progress instead of waiting for it to finish.
+  void
+  command_queue_update() {
+    while (CMD_QUEUE_COUNT) {
+      CMD_QUEUED queued = CMD_QUEUE[CMD_QUEUE_HEAD];
+      bool redirect = machine_busy();
+      if (redirect && !(queued.STATION && motion_redirect(queued.STATION))) {
+        return;
+      }
+      CMD_QUEUE_HEAD = (CMD_QUEUE_HEAD + 1) % CMD_QUEUE_SIZE;
+      CMD_QUEUE_COUNT--;
+      if (redirect) {
+        SOURCE = CLI;
+        if (queued.KIND == CMD_QUEUED_FRAME) {
+          FRAME_SEQ = queued.BIN.SEQ;
+          frame_ack_queued(&queued.BIN, FRAME_ACK_OK);
         }
+      } else if (queued.KIND == CMD_QUEUED_TEXT) {
+        DoMyCommand(queued.LINE);
+      } else {
+        frame_ack_queued(&queued.BIN, frame_execute(&queued.BIN));
+      }
+    }
+  }
+
+  // A frame arrived, run it now, queue it behind the current move or turn it away, and ack it
+  void
+  frame_received(uint8_t rx) {
+    FRAME * frame = &FrameRx.DATA;
+    uint8_t result;
+
+    FRAME_MODE = 1;
+    if (rx == FRAME_RX_BAD) {
+      frame_ack(frame->OP, frame->SEQ, FRAME_ACK_CRC);
+      return;
+    }
+    trace_add(&TRACE, micros(), TRACE_FRAME, frame->OP | (frame->SEQ << 8));
+    FRAME_SEEN * seen = frame_seen(frame);
+    if (seen != NULL) {
+      // The host resent a command we already took, its ack must have been lost
+      frame_ack(frame->OP, frame->SEQ, seen->RESULT);
+      return;
+    }
+    if (!frame_valid(frame)) {
+      result = FRAME_ACK_INVALID;
+    } else if ((!machine_busy() && !CMD_QUEUE_COUNT) || frame_is_immediate(frame)) {
+      result = frame_execute(frame);
+    } else {
+      CMD_QUEUED queued;
+      queued.KIND = CMD_QUEUED_FRAME;
+      queued.STATION = frame_station(frame);
+      queued.BIN = *frame;
+      if (!command_queue_push(&queued)) {
+        stats_count(&STATS.QUEUE_FULL);
+        frame_ack(frame->OP, frame->SEQ, FRAME_ACK_BUSY);   // Not taken, so not remembered, a resend is tried again
+        return;
       }
+      result = FRAME_ACK_QUEUED;
+    }
+    seen = &FRAME_SEEN_ARRAY[FRAME_SEEN_NEXT];
+    FRAME_SEEN_NEXT = (FRAME_SEEN_NEXT + 1) % FRAME_WINDOW;
+    seen->SEQ = frame->SEQ;
+    seen->OP = frame->OP;
+    seen->RESULT = result;
+    frame_ack(frame->OP, frame->SEQ, result);
+  }
+
+  /****************************************************
+     DoMyCommand
+  */
+  bool
+  DoMyCommand(char * commandLine) {
+    //  print2("\nCommand: ", commandLine);
+    int result;
+
+    FRAME_MODE = 0;       // Host is talking text, answer in text
+
+    COMMAND_CFG cmd;
+    const char * args;
+    int8_t row = command_find(commandLine, &cmd, &args);
+    if (row < 0) {
+      const char * line = commandLine;
+      uint8_t len;
+      const char * ptrToCommandName = readToken(&line, &len);
+      if (ptrToCommandName != NULL) {
+        nullCommand(ptrToCommandName, len);
+      }
+      return 0;
+    }
+
+    trace_add(&TRACE, micros(), TRACE_COMMAND, row);
+    if (cmd.ARGS == CMD_ARGS_INTS) {
+      int firstOperand = readNumber(&args);
+      int secondOperand = readNumber(&args);
+      result = cmd.HANDLER(firstOperand, secondOperand);
+    } else if (cmd.ARGS == CMD_ARGS_STATION) {
+      result = cmd.HANDLER(readStation(&args), 0);
+    } else {
+      result = cmd.HANDLER(cmd.ARG, 0);
+    }
+    if (result != 0) {
+      Serial.print("ERROR: (DoMyCommand) Return result of ");
+      Serial.print(cmd.NAME);
+      print2(" command goes here, ", result);
     }
   return 0;
   }
@@ -1016,13 +2252,14 @@ void homing_4 () {
   digitalWrite(PIN_LED_RED, HIGH);
   pinMode(PIN_LED_GREEN, OUTPUT);
   digitalWrite(PIN_LED_GREEN, HIGH);
+  travel_load();
+  position_load();
+  LATENCY_TIMER_START();
   attachInterrupt(digitalPinToInterrupt(PIN_PROX_SENSOR), isr_prox_sensor, CHANGE) ;
   // Do a command to print the timing defines
   // Serial.println("CONFIG VARIABLES:");
   //print2("SAFETY_CUTOFF: ", SAFETY_CUTOFF);
   //print2("SENSOR_FALLOFF: ", SENSOR_FALLOFF);
-  //print2("HOMING_TIMEOUT_SHORT: ", HOMING_TIMEOUT_SHORT);
-  //print2("HOMING_TIMEOUT_LONG: ", HOMING_TIMEOUT_LONG);
   print2("PIN_MOTOR_FWD (for left movement) is: ", PIN_MOTOR_FWD);
   print2("PIN_MOTOR_REV (for right movement) is: ", PIN_MOTOR_REV);
   SENSOR_STATE = (digitalRead(PIN_PROX_SENSOR));
@@ -1055,9 +2292,27 @@ void homing_4 () {
         }      
       }
     }
-    if (( HOMING == 5 ) && (digitalRead(PIN_MOTOR_FWD == 1)) && (digitalRead(PIN_MOTOR_REV == 1)) ) {
+    drag_lights_update();
+    if (( HOMING == 5 ) && (DRAG_STEP == 0) && (FAST_MOTOR_FWD::output() == 1) && (FAST_MOTOR_REV::output() == 1) ) {
       rgb_set_led(GREEN);
     } 
-    bool received = getCommandLineFromSerialPort(CommandLine);      //global CommandLine is defined in CommandLine.h
-    if (received) DoMyCommand(CommandLine);
+    sensor_update();
+    motion_update();
+
+    // Drain the port every pass, moving or not, so STOP and STATUS get through and a burst of tool
+    // events never backs up into the 64 byte RX buffer.  Everything else goes through CMD_QUEUE while
+    // the arm is busy or older commands are still waiting.
+    while (getCommandLineFromSerialPort(CommandLine)) {      //global CommandLine is defined in CommandLine.h
+      if (command_is_immediate(CommandLine) || (!machine_busy() && !CMD_QUEUE_COUNT)) {
+        DoMyCommand(CommandLine);
+      } else {
+        command_queue_text(CommandLine);
+      }
+    }
+    command_queue_update();
+    credit_update();
+    position_flush(false);
+    if (!machine_busy()) {
+      travel_save(false);
+    }
   }
@@ -0,0 +1,64 @@
+/*  trace.h - Timestamped event trace, dumped with TRACE DUMP and turned into a Chrome trace by host/trace2chrome
+
+                A ring of the last TRACE_SIZE events, each a micros() timestamp, an event ID and a small
+                argument, the oldest overwritten.  Recording is a handful of stores, cheap enough to leave
+                on everywhere the print2() debug lines used to be uncommented.  Only loop() records, so
+                there is no locking: sensor edges are recorded as sensor_update() drains SENSOR_EDGES,
+                stamped with the time the ISR took, not when loop() got to them.
+*/
+#ifndef VACROUTER_TRACE_H
+#define VACROUTER_TRACE_H
+
+#include <stdint.h>
+
+#ifndef TRACE_SIZE
+#define TRACE_SIZE          64      // Power of two, 8 bytes of RAM each
+#endif
+#define TRACE_MASK          ((TRACE_SIZE) - 1)
+
+// Event IDs, ARG in brackets.  host/trace2chrome.cpp names them, keep the two in step.
+#define TRACE_MOTOR_RIGHT   1       // Relay on (CURRENT_POS)
+#define TRACE_MOTOR_LEFT    2       // Relay on (CURRENT_POS)
+#define TRACE_MOTOR_STOP    3       // Relays off from loop() (SOURCE)
+#define TRACE_SENSOR        4       // Sensor edge at the ISR's timestamp (LEVEL | EDGE_* << 1)
+#define TRACE_MOVE_END      5       // Seek ended outside homing (MOTION_ARRIVED or MOTION_TIMEOUT)
+#define TRACE_HOME_STEP     6       // Homing seek started (HS_*)
+#define TRACE_HOME_DONE     7       // Homing ended (station, -1 failed)
+#define TRACE_COMMAND       8       // Text command run (COMMAND_ARRAY row), the dump adds its name
+#define TRACE_FRAME         9       // Binary command received (OP | SEQ << 8)
+#define TRACE_REDIRECT      10      // Move in progress pointed at a new station (station)
+
+typedef struct {
+    uint32_t US;
+    uint8_t  ID;
+    uint8_t  RESERVED;
+    int16_t  ARG;
+} TRACE_EVENT;
+
+typedef struct {
+    uint16_t    COUNT;              // Events recorded since the last clear, stops at 65535
+    uint8_t     NEXT;               // Slot the next event goes in
+    TRACE_EVENT BUF[TRACE_SIZE];
+} TRACE_RING;
+
+static inline void trace_add(TRACE_RING *t, uint32_t us, uint8_t id, int16_t arg) {
+    TRACE_EVENT *e = &t->BUF[t->NEXT & TRACE_MASK];
+    e->US = us;
+    e->ID = id;
+    e->ARG = arg;
+    t->NEXT = (t->NEXT + 1) & TRACE_MASK;
+    if (t->COUNT != 0xFFFF) {
+        t->COUNT++;
+    }
+}
+
+// Events still in the ring, and the i'th oldest of them
+static inline uint8_t trace_held(const TRACE_RING *t) {
+    return (t->COUNT < TRACE_SIZE) ? t->COUNT : TRACE_SIZE;
+}
+
+static inline const TRACE_EVENT *trace_get(const TRACE_RING *t, uint8_t i) {
+    return &t->BUF[(t->NEXT - trace_held(t) + i) & TRACE_MASK];
+}
+
+#endif
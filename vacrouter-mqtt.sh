@@ -8,6 +8,8 @@
 # Rev .2        -Added more error handling around the temp file creation
 # Rev .3        -Added new MOVE GOCNC, MOVE GOCHOPSAW and MOVE GOWORKBENCH commands
 #               -Powering off the vacuum returns to CHOPSAW position when complete
+# Rev .4        -Serial lines come from ardith over a FIFO, read as they arrive instead of polling lastline.txt
+# Rev .5        -Commands go through the vacrouter-serial port broker instead of echo to the tty
 #
 # TODO:         -Monitor to amke sure ardith.sh is running
 
@@ -19,13 +21,14 @@ DEBUG=1                 # Enable (1) / Disable (0) Console log messages
 
 #  VARIABLES & PATHS
 VAC_DELAY_DEF=2         # Number of seconds to leave vacuum on to clear the line, before shutting down
-CONSOLE=/dev/ttyACM0    # Port Arduino is connected to (stty setup handled by ardith which holds the port open and reads lines)
-TMP_LASTLINE=/tmp/lastline.txt  # Stores the last line of text sent on the serial port
+SERIAL_CLIENT=/sdcard/vacrouter-serial  # Port broker, the only process with the Arduino's port open (S70vacrouter.sh)
+CHANNEL=/tmp/vacrouter.serial   # FIFO ardith writes every serial line to, in order
+CHANNEL_FD=4                    # Our read end of $CHANNEL
 DEVICE=""               # MQTT device (e.g. cnc, chopsaw etc) - Nulled to allow test to skip case stmt in main loop
 JQ=/usr/bin/jq          # JSON slicer for mosquitto_sub output
 VACR_CPOS=""            # Store the current position of the arm
 VACR_STATE=""           # Store the last reported state of the arm
-OLDLASTLINE=""          # Store the previous serial line received, for comparison
+SERIAL_QUIET=3          # Seconds without a serial line before we go back to waiting on MQTT
 NOHUP=/usr/bin/nohup    # No allow ardith to keep running in the event we stop and start this script
 PIDOF=/bin/pidof        # To get the pid of ardith.sh on startup
 SLEEP=/bin/sleep
@@ -124,6 +127,14 @@ MON_TOPIC() {
         DEVICE_VAR="$(echo ${TOPIC[2]})"        # Reference the sub-topic for the device
 }
 
+# Send a command to the arm through the port broker, which queues it behind ardith's and pairs the
+# arm's answer with it.  Position reports still come over $CHANNEL like every other line.
+SERIAL_SEND() {
+        if ! RESULT=$($SERIAL_CLIENT --send "$1"); then
+                LOG ${FUNCNAME[1]} "Arduino didn't take $1: ${RESULT##*$'\n'}"
+        fi
+}
+
 ### Miscellaneous Functions
 # arg1 = function name from ${FUNCNAME[0]}
 # arg2 = message to log
@@ -137,9 +148,14 @@ INIT() {
         LOG ${FUNCNAME[0]} "*** Vacrouter v1.0 ***"
         # Start Ardith if not already running
         ARDITH_PID=$($PIDOF $ARDITH_SHORT)
+        if [ ! -p $CHANNEL ]; then
+                rm -f $CHANNEL
+                mkfifo $CHANNEL
+        fi
+        # Read-write so the open doesn't wait for ardith, and a restart of ardith doesn't give us EOF
+        eval "exec $CHANNEL_FD<>$CHANNEL"
         if [[ -z $ARDITH_PID ]]; then
                 LOG ${FUNCNAME[0]} "Initializing ardith.sh for background arduino communication."
-                echo > $TMP_LASTLINE
                 $NOHUP $ARDITH >/dev/null 2>&1 &
                 INIT_WAIT_HOMING=1
         else
@@ -154,35 +170,8 @@ INIT() {
 }
 
 
-SERIAL() {
-        LASTLINE=$( cat $TMP_LASTLINE )
-        if [ ${FUNCNAME[1]} == "INIT" ] && [ "$INIT_WAIT_HOMING" == "1" ]; then
-                LOG ${FUNCNAME[0]} "Waiting for HOME signal from ardith."
-                LASTLINE=$( cat $TMP_LASTLINE )
-                # Loop until HOME is reported on serial port
-                until [[ ${LASTLINE:0:4} == "HOME" ]]
-                do
-                        LASTLINE=$( cat $TMP_LASTLINE )
-                done
-
-                # Do a discovery while we wait
-                if [[ ${LASTLINE:0:4} == "HOME" ]]; then
-                        # Not using this info for anything yet
-                        LOG ${FUNCNAME[0]} "Vacrouter is HOMING. Discovering devices while homing completes."
-                        # Using jq This loads all non-null entries of key ".t" in to a bash array
-                        devs=$( ($M_SUB -h $BROKER -t 'tasmota/discovery/+/+' -W 1 | $JQ -r '.t | strings | @sh') 2>/dev/null ) 
-                        read devarray <<< $devs
-                        #echo "${devs[@]}"
-                fi
-
-                # Loop until we are no longer reporting "HOME" on the serial port
-                until [[ ${LASTLINE:0:4} != "HOME" ]]
-                do
-                        LASTLINE=$( cat $TMP_LASTLINE )
-                done
-                INIT_WAIT_HOME=0
-        fi
-
+# Handle one serial line from ardith, in LASTLINE
+SERIAL_LINE() {
         if [[ ${LASTLINE:0:7} == "OK PPOS" ]]; then
                 #0   1     2  3    4
                 #OK PPOS: -1 CPOS: 2
@@ -194,12 +183,42 @@ SERIAL() {
                 MSG_PUBLISH $VACR_ST_TOPIC $VACR_STATE
                 MSG_PUBLISH $VACR_CPOS_TOPIC $VACR_CPOS
         fi
+        LOG SERIAL "$LASTLINE"
+}
+
+# Handle every serial line waiting in the channel, without blocking
+SERIAL() {
+        if [ ${FUNCNAME[1]} == "INIT" ] && [ "$INIT_WAIT_HOMING" == "1" ]; then
+                LOG ${FUNCNAME[0]} "Waiting for HOME signal from ardith."
+                # Blocking read, we sleep until ardith passes the next line along
+                until [[ ${LASTLINE:0:4} == "HOME" ]]
+                do
+                        read -r -u $CHANNEL_FD LASTLINE
+                        SERIAL_LINE
+                done
+
+                # Do a discovery while we wait
+                # Not using this info for anything yet
+                LOG ${FUNCNAME[0]} "Vacrouter is HOMING. Discovering devices while homing completes."
+                # Using jq This loads all non-null entries of key ".t" in to a bash array
+                devs=$( ($M_SUB -h $BROKER -t 'tasmota/discovery/+/+' -W 1 | $JQ -r '.t | strings | @sh') 2>/dev/null ) 
+                read devarray <<< $devs
+                #echo "${devs[@]}"
+                INIT_WAIT_HOMING=0
+        fi
 
-        
-        if [ "$OLDLASTLINE" != "$LASTLINE" ]; then
-                LOG  ${FUNCNAME[0]} "$LASTLINE"
-        fi      
-        OLDLASTLINE="$LASTLINE"
+        while read -r -t 0 -u $CHANNEL_FD && read -r -u $CHANNEL_FD LASTLINE
+        do
+                SERIAL_LINE
+        done
+}
+
+# Handle serial lines as they arrive until the arm has been quiet for $1 seconds
+SERIAL_WAIT() {
+        while read -r -t $1 -u $CHANNEL_FD LASTLINE
+        do
+                SERIAL_LINE
+        done
 }
 
 
@@ -231,7 +250,7 @@ vacuum_CONTROL() {
 
 cnc_POWER() {
         if [ "$TOPIC_MSG" == "ON" ]; then
-                echo "MOVE GOCNC" > $CONSOLE
+                SERIAL_SEND "MOVE GOCNC"
                 LOG ${FUNCNAME[0]} "Sent MOVE GOCNC command to Arduino. TOPIC_MSG = $TOPIC_MSG"
                 SERIAL
         fi
@@ -245,7 +264,7 @@ cnc_POWER() {
 
 chopsaw_POWER() {
         if [ "$TOPIC_MSG" == "ON" ]; then
-                echo "MOVE GOCHOPSAW" > $CONSOLE
+                SERIAL_SEND "MOVE GOCHOPSAW"
                 LOG ${FUNCNAME[0]} "Sent MOVE GOCNC command to Arduino. TOPIC_MSG = $TOPIC_MSG"
                 SERIAL
         fi
@@ -259,7 +278,7 @@ chopsaw_POWER() {
 
 workbench_POWER() {
         if [ "$TOPIC_MSG" == "ON" ]; then
-                echo "MOVE GOWORKBENCH" > $CONSOLE
+                SERIAL_SEND "MOVE GOWORKBENCH"
                 LOG ${FUNCNAME[0]} "Sent MOVE GOCNC command to Arduino. TOPIC_MSG = $TOPIC_MSG"
                 SERIAL
         fi
@@ -284,7 +303,7 @@ vacuum_POWER() {
                 LOG ${FUNCNAME[0]} "Clearing vacuum line for $VAC_DELAY seconds"
                 # Push the sleep and vacuum off to the background so they don't block
                 sleep $VAC_DELAY && MSG_PUBLISH $VAC_POWER_CMD $VAC_SWITCH 
-                echo "MOVE GOCHOPSAW" > $CONSOLE
+                SERIAL_SEND "MOVE GOCHOPSAW"
                 SERIAL
         fi
 }
@@ -329,7 +348,5 @@ do
                         ;;
                 esac
         fi
-        SERIAL
-        $SLEEP 3        # To allow the arm to finish moving and report so we receive it before the blocking MQTT subscription holds for a new msg
-        SERIAL
+        SERIAL_WAIT $SERIAL_QUIET   # Let the arm finish moving and report before the blocking MQTT subscription holds for a new msg
 done